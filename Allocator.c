@@ -0,0 +1,117 @@
+#include "Allocator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static void* allocator_default_alloc(size_t size, size_t alignment, void* user)
+{
+    (void)user;
+
+    if(alignment < alignof(max_align_t))
+        alignment = alignof(max_align_t);
+
+    #ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+    #else
+    void* ptr = NULL;
+    if(posix_memalign(&ptr, alignment, size) != 0)
+        return NULL;
+    return ptr;
+    #endif
+}
+
+static void* allocator_default_realloc(void* ptr, size_t size, size_t alignment, void* user)
+{
+    if(alignment < alignof(max_align_t))
+        alignment = alignof(max_align_t);
+
+    #ifdef _WIN32
+    (void)user;
+    return _aligned_realloc(ptr, size, alignment);
+    #else
+    void* new_ptr = realloc(ptr, size);
+    if(!new_ptr || ((uintptr_t)new_ptr % alignment) == 0)
+        return new_ptr;
+
+    // realloc lost the alignment, move the block to aligned memory
+    void* aligned_ptr = allocator_default_alloc(size, alignment, user);
+    if(aligned_ptr)
+        memcpy(aligned_ptr, new_ptr, size);
+    free(new_ptr);
+    return aligned_ptr;
+    #endif
+}
+
+static void allocator_default_free(void* ptr, void* user)
+{
+    (void)user;
+
+    #ifdef _WIN32
+    _aligned_free(ptr);
+    #else
+    free(ptr);
+    #endif
+}
+
+static const CAllocator default_allocator = 
+{
+    allocator_default_alloc,
+    allocator_default_realloc,
+    allocator_default_free,
+    NULL
+};
+
+static CAllocator current_allocator = 
+{
+    allocator_default_alloc,
+    allocator_default_realloc,
+    allocator_default_free,
+    NULL
+};
+
+void allocator_set(const CAllocator* allocator)
+{
+    if(allocator && allocator->alloc && allocator->realloc && allocator->free)
+        current_allocator = *allocator;
+    else
+        current_allocator = default_allocator;
+}
+
+const CAllocator* allocator_get()
+{
+    return &current_allocator;
+}
+
+void* allocator_malloc(size_t size)
+{
+    return current_allocator.alloc(size, alignof(max_align_t), current_allocator.user);
+}
+
+void* allocator_aligned_malloc(size_t size, size_t alignment)
+{
+    return current_allocator.alloc(size, alignment, current_allocator.user);
+}
+
+void* allocator_realloc(void* ptr, size_t size)
+{
+    return current_allocator.realloc(ptr, size, alignof(max_align_t), current_allocator.user);
+}
+
+void allocator_free(void* ptr)
+{
+    if(ptr)
+        current_allocator.free(ptr, current_allocator.user);
+}
+
+char* allocator_strdup(const char* str)
+{
+    size_t str_size = strlen(str) + 1;
+    char* copy = (char*)allocator_malloc(sizeof(char) * str_size);
+    if(copy)
+        memcpy(copy, str, str_size);
+    return copy;
+}
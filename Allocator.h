@@ -0,0 +1,95 @@
+#ifndef AV_ALLOCATOR
+#define AV_ALLOCATOR
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Alignment used for frame and sample buffers. Covers the widest SIMD registers used by ffmpeg.
+ */
+#define ALLOCATOR_DEFAULT_ALIGNMENT 64
+
+typedef void* (*allocator_alloc_t)(size_t size, size_t alignment, void* user);
+typedef void* (*allocator_realloc_t)(void* ptr, size_t size, size_t alignment, void* user);
+typedef void  (*allocator_free_t)(void* ptr, void* user);
+
+/**
+ * Memory allocator interface used for all library allocations.
+ * 
+ * Allows to route structures, frame buffers and converted data into engine 
+ * arenas or tracked heaps. All three callbacks must be set.
+ */
+typedef struct CAllocator
+{
+    allocator_alloc_t   alloc;
+    allocator_realloc_t realloc;
+    allocator_free_t    free;
+
+    /**
+     * User pointer passed to every callback.
+     */
+    void*               user;
+} CAllocator;
+
+/**
+ * Sets the allocator used by the library. Must be called before any other library call,
+ * because memory is always released through the allocator that is currently set.
+ *
+ * @param allocator Pointer to allocator description, NULL restores the default allocator.
+ */
+void allocator_set(const CAllocator* allocator);
+
+/**
+ * @return Returns the allocator currently used by the library.
+ */
+const CAllocator* allocator_get(void);
+
+/**
+ * Allocates memory with natural alignment.
+ *
+ * @param size Size of the block in bytes.
+ *
+ * @return Returns pointer to allocated memory or NULL on failure.
+ */
+void* allocator_malloc(size_t size);
+
+/**
+ * Allocates memory with specified alignment.
+ *
+ * @param size Size of the block in bytes.
+ *
+ * @param alignment Power of two alignment of the block.
+ *
+ * @return Returns pointer to allocated memory or NULL on failure.
+ */
+void* allocator_aligned_malloc(size_t size, size_t alignment);
+
+/**
+ * Resizes memory allocated with allocator_malloc.
+ *
+ * @param ptr Pointer to previously allocated block or NULL.
+ *
+ * @param size New size of the block in bytes.
+ *
+ * @return Returns pointer to reallocated memory or NULL on failure.
+ */
+void* allocator_realloc(void* ptr, size_t size);
+
+/**
+ * Releases memory allocated with any of allocator functions.
+ *
+ * @param ptr Pointer to allocated block or NULL.
+ */
+void allocator_free(void* ptr);
+
+/**
+ * Duplicates string using library allocator.
+ *
+ * @param str Null terminated string.
+ *
+ * @return Returns the copy of string or NULL on failure.
+ */
+char* allocator_strdup(const char* str);
+
+#endif
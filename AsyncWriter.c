@@ -0,0 +1,202 @@
+#include "AsyncWriter.h"
+#include "Allocator.h"
+#include "MemoryBudget.h"
+#include <libavutil/avutil.h>
+#include <string.h>
+
+static void async_writer_thread(void* arg)
+{
+    CAsyncWriter* writer = (CAsyncWriter*)arg;
+
+    mutex_lock(&writer->mutex);
+    while (true)
+    {
+        while (!writer->size && !writer->stopping)
+            condition_wait(&writer->data_available, &writer->mutex);
+
+        if (!writer->size)
+            break;
+
+        // Only the part up to the end of the ring is written at once, the rest follows on the next pass
+        size_t head = writer->head;
+        size_t count = FFMIN(writer->size, writer->capacity - head);
+        writer->writing = true;
+        mutex_unlock(&writer->mutex);
+
+        bool result = fwrite(writer->buffer + head, 1, count, writer->file) == count;
+
+        mutex_lock(&writer->mutex);
+        writer->head = (head + count) % writer->capacity;
+        writer->size -= count;
+        writer->bytes_written += count;
+        condition_broadcast(&writer->space_available);
+
+        // Readers following the file see everything written so far
+        if (result && !writer->size)
+        {
+            mutex_unlock(&writer->mutex);
+            result = fflush(writer->file) == 0;
+            mutex_lock(&writer->mutex);
+        }
+
+        if (!result)
+        {
+            fprintf(stderr, "Couldn't write to file.\n");
+            writer->failed = true;
+        }
+
+        writer->writing = false;
+        if (!writer->size)
+            condition_broadcast(&writer->drained);
+    }
+    mutex_unlock(&writer->mutex);
+}
+
+CAsyncWriter* async_writer_alloc()
+{
+    CAsyncWriter* writer = NULL;
+    writer = (CAsyncWriter*)allocator_malloc(sizeof(CAsyncWriter));
+
+    if (!writer)
+    {
+        fprintf(stderr, "Couldn't allocate async writer.\n");
+        return NULL;
+    }
+
+    writer->file = NULL;
+    writer->buffer = NULL;
+    writer->capacity = 0;
+    writer->head = 0;
+    writer->size = 0;
+    writer->running = false;
+    writer->stopping = false;
+    writer->writing = false;
+    writer->failed = false;
+    writer->bytes_written = 0;
+
+    mutex_init(&writer->mutex);
+    condition_init(&writer->data_available);
+    condition_init(&writer->space_available);
+    condition_init(&writer->drained);
+
+    return writer;
+}
+
+bool async_writer_open(CAsyncWriter** writer_ptr, const char* filename, size_t capacity)
+{
+    CAsyncWriter* writer = *writer_ptr;
+
+    if (writer->running || !capacity)
+        return false;
+
+    if (!(writer->buffer = (uint8_t*)allocator_malloc(capacity)))
+    {
+        fprintf(stderr, "Couldn't allocate async writer buffer.\n");
+        return false;
+    }
+    writer->capacity = capacity;
+    memory_budget_acquire(MEMORY_CATEGORY_PACKETS, capacity);
+
+    #ifdef _WIN32
+    if(fopen_s(&writer->file, filename, "wb") != 0)
+    #else
+    if(!(writer->file = fopen(filename, "wb")))
+    #endif
+    {
+        fprintf(stderr, "Cannot open file writer.\n");
+        return false;
+    }
+
+    if (!thread_start(&writer->thread, async_writer_thread, writer))
+    {
+        fprintf(stderr, "Couldn't start writer thread.\n");
+        return false;
+    }
+
+    writer->running = true;
+    return true;
+}
+
+bool async_writer_write(CAsyncWriter** writer_ptr, const uint8_t* data, size_t size)
+{
+    CAsyncWriter* writer = *writer_ptr;
+
+    if (!writer->running)
+        return false;
+
+    mutex_lock(&writer->mutex);
+    while (size && !writer->failed)
+    {
+        while (writer->size == writer->capacity && !writer->failed)
+            condition_wait(&writer->space_available, &writer->mutex);
+        if (writer->failed)
+            break;
+
+        // Data larger than the free space is queued in pieces
+        size_t tail = (writer->head + writer->size) % writer->capacity;
+        size_t count = FFMIN(size, FFMIN(writer->capacity - writer->size, writer->capacity - tail));
+
+        memcpy(writer->buffer + tail, data, count);
+        writer->size += count;
+        data += count;
+        size -= count;
+        condition_signal(&writer->data_available);
+    }
+
+    bool result = !writer->failed;
+    mutex_unlock(&writer->mutex);
+
+    return result;
+}
+
+bool async_writer_flush(CAsyncWriter** writer_ptr)
+{
+    CAsyncWriter* writer = *writer_ptr;
+
+    if (!writer->running)
+        return !writer->failed;
+
+    mutex_lock(&writer->mutex);
+    while ((writer->size || writer->writing) && !writer->failed)
+        condition_wait(&writer->drained, &writer->mutex);
+
+    bool result = !writer->failed;
+    mutex_unlock(&writer->mutex);
+
+    return result;
+}
+
+void async_writer_close(CAsyncWriter** writer_ptr)
+{
+    CAsyncWriter* writer = *writer_ptr;
+
+    if (!writer)
+        return;
+
+    if (writer->running)
+    {
+        mutex_lock(&writer->mutex);
+        writer->stopping = true;
+        condition_signal(&writer->data_available);
+        mutex_unlock(&writer->mutex);
+
+        thread_join(&writer->thread);
+    }
+
+    if (writer->file)
+        fclose(writer->file);
+
+    if (writer->buffer)
+    {
+        memory_budget_release(MEMORY_CATEGORY_PACKETS, writer->capacity);
+        allocator_free(writer->buffer);
+    }
+
+    condition_destroy(&writer->drained);
+    condition_destroy(&writer->space_available);
+    condition_destroy(&writer->data_available);
+    mutex_destroy(&writer->mutex);
+
+    allocator_free(writer);
+    *writer_ptr = NULL;
+}
\ No newline at end of file
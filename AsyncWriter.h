@@ -0,0 +1,93 @@
+#ifndef AV_ASYNCWRITER
+#define AV_ASYNCWRITER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "Threading.h"
+
+/**
+ * Buffered file writer with a dedicated thread.
+ *
+ * Writes are copied into a ring buffer and return at once unless the buffer is full,
+ * the thread writes them out and flushes the file every time the buffer runs empty,
+ * so a reader following the file sees the data shortly after it was written.
+ */
+typedef struct CAsyncWriter
+{
+    FILE*                   file;
+
+    uint8_t*                buffer;
+    size_t                  capacity;
+    size_t                  head;
+    size_t                  size;
+
+    CThread                 thread;
+    bool                    running;
+    bool                    stopping;
+
+    /**
+     * Set while the thread writes data taken from the buffer.
+     */
+    bool                    writing;
+    bool                    failed;
+
+    CMutex                  mutex;
+    CCondition              data_available;
+    CCondition              space_available;
+    CCondition              drained;
+
+    int64_t                 bytes_written;
+} CAsyncWriter;
+
+/**
+ * Allocate an CAsyncWriter and set its fields to default values.
+ *
+ * @return An CAsyncWriter filled with default values or NULL on failure.
+ */
+CAsyncWriter* async_writer_alloc(void);
+
+/**
+ * Creates the file and starts the writer thread.
+ *
+ * @param writer_ptr Pointer to pointer to CAsyncWriter structure.
+ *
+ * @param filename Path to the file, existing file is overwritten.
+ *
+ * @param capacity Size of the ring buffer in bytes.
+ *
+ * @return Returns true if the file was created.
+ */
+bool async_writer_open(CAsyncWriter** writer_ptr, const char* filename, size_t capacity);
+
+/**
+ * Queues data for writing, blocks while the buffer is full.
+ *
+ * @param writer_ptr Pointer to pointer to CAsyncWriter structure.
+ *
+ * @param data Data to write.
+ *
+ * @param size Size of data in bytes.
+ *
+ * @return Returns false if writing failed.
+ */
+bool async_writer_write(CAsyncWriter** writer_ptr, const uint8_t* data, size_t size);
+
+/**
+ * Waits until every queued byte is written and flushed.
+ *
+ * @param writer_ptr Pointer to pointer to CAsyncWriter structure.
+ *
+ * @return Returns false if writing failed.
+ */
+bool async_writer_flush(CAsyncWriter** writer_ptr);
+
+/**
+ * Writes queued data, closes the file and releases the writer.
+ *
+ * @param writer_ptr Pointer to pointer to CAsyncWriter structure.
+ */
+void async_writer_close(CAsyncWriter** writer_ptr);
+
+#endif
\ No newline at end of file
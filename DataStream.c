@@ -1,35 +1,206 @@
 #include "DataStream.h"
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 #include "helpers.h"
+#include "Allocator.h"
+
+static enum EMemoryCategory data_stream_buffer_category(CDataStream* stream)
+{
+    return stream->stream_type == AVMEDIA_TYPE_AUDIO ? MEMORY_CATEGORY_AUDIO : MEMORY_CATEGORY_CONVERTED_FRAMES;
+}
+
+// Adaptive quality hysteresis: consecutive frames over/under the budget needed to change level
+#define QUALITY_OVERRUN_FRAMES 8
+#define QUALITY_UNDERRUN_FRAMES 90
+#define QUALITY_OVERRUN_RATIO 0.9
+#define QUALITY_UNDERRUN_RATIO 0.5
+#define QUALITY_AVERAGE_WEIGHT 0.1
+
+#define FRAGMENTED_OUTPUT_IO_BUFFER_SIZE (64 * 1024)
+#define FRAGMENTED_OUTPUT_WRITER_CAPACITY (8 * 1024 * 1024)
+
+static void data_stream_apply_quality_level(CDataStream* stream)
+{
+    AVCodecContext* av_codec_ctx = stream->av_codec_ctx;
+    enum EDecodeQuality level = stream->stats.quality_level;
+
+    av_codec_ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+    av_codec_ctx->skip_idct = AVDISCARD_DEFAULT;
+    av_codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+
+    if(level >= DECODE_QUALITY_SKIP_NONREF_LOOP_FILTER)
+        av_codec_ctx->skip_loop_filter = AVDISCARD_NONREF;
+    if(level >= DECODE_QUALITY_SKIP_LOOP_FILTER)
+        av_codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+    if(level >= DECODE_QUALITY_SKIP_NONREF_IDCT)
+        av_codec_ctx->skip_idct = AVDISCARD_NONREF;
+    if(level >= DECODE_QUALITY_SKIP_NONREF_FRAMES)
+        av_codec_ctx->skip_frame = AVDISCARD_NONREF;
+
+    // Fast playback shows fewer frames, whatever the quality level is
+    if(stream->stream_type == AVMEDIA_TYPE_VIDEO && stream->playback_rate >= DATA_STREAM_KEYFRAME_RATE)
+        av_codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    else if(stream->stream_type == AVMEDIA_TYPE_VIDEO && stream->playback_rate > DATA_STREAM_NONREF_RATE && av_codec_ctx->skip_frame < AVDISCARD_NONREF)
+        av_codec_ctx->skip_frame = AVDISCARD_NONREF;
+}
+
+static void data_stream_update_quality(CDataStream* stream, int64_t decode_time_us)
+{
+    CDataStreamStats* stats = &stream->stats;
+
+    stats->frames_decoded++;
+    stats->last_decode_time_us = decode_time_us;
+
+    // Plain mean of the first samples at a level, so the cost of the previous level is not carried over
+    double weight = 1.0 / ++stream->quality_level_samples;
+    if(weight < QUALITY_AVERAGE_WEIGHT)
+        weight = QUALITY_AVERAGE_WEIGHT;
+    stats->average_decode_time_us += ((double)decode_time_us - stats->average_decode_time_us) * weight;
+
+    if(!stream->adaptive_quality || stream->stream_type != AVMEDIA_TYPE_VIDEO || stream->frame_budget_us <= 0)
+        return;
+
+    double budget = (double)stream->frame_budget_us;
+    enum EDecodeQuality level = stats->quality_level;
+
+    if(stats->average_decode_time_us > budget * QUALITY_OVERRUN_RATIO)
+    {
+        stream->quality_underruns = 0;
+        if(++stream->quality_overruns >= QUALITY_OVERRUN_FRAMES && level + 1 < DECODE_QUALITY_COUNT)
+            level++;
+    }
+    else if(stats->average_decode_time_us < budget * QUALITY_UNDERRUN_RATIO)
+    {
+        stream->quality_overruns = 0;
+        if(++stream->quality_underruns >= QUALITY_UNDERRUN_FRAMES && level > DECODE_QUALITY_FULL)
+            level--;
+    }
+    else
+    {
+        stream->quality_overruns = 0;
+        stream->quality_underruns = 0;
+    }
+
+    if(level != stats->quality_level)
+    {
+        stats->quality_level = level;
+        stats->quality_level_changes++;
+        stream->quality_overruns = 0;
+        stream->quality_underruns = 0;
+        stream->quality_level_samples = 0;
+        data_stream_apply_quality_level(stream);
+    }
+}
+
+static void data_stream_free_block_buffer(CDataStream* stream)
+{
+    if (!stream->block_buffer_borrowed)
+    {
+        memory_budget_release(data_stream_buffer_category(stream), stream->block_buffer_capacity);
+        allocator_free(stream->block_buffer);
+    }
+    stream->block_buffer = NULL;
+    stream->block_buffer_capacity = 0;
+    stream->block_buffer_borrowed = false;
+}
+
+// Frames decoded at reduced quality or in another format must not stay in the cache
+static void data_stream_write_cached_frame(CDataStream* stream)
+{
+    CFrameCacheHeader* header = &stream->frame_cache->header;
+
+    if (stream->stats.quality_level != DECODE_QUALITY_FULL || stream->texture_format != TEXTURE_FORMAT_NONE || header->width != stream->swidth ||
+        header->height != stream->sheight || header->pix_fmt != stream->av_output_pix_fmt)
+    {
+        frame_cache_abort(&stream->frame_cache);
+        return;
+    }
+
+    frame_cache_write_frame(&stream->frame_cache, stream->block_buffer, stream->pts);
+}
 
 CDataStream* data_stream_alloc()
 {
     CDataStream* dstream = NULL;
-    dstream = (CDataStream*)malloc(sizeof(CDataStream));
+    dstream = (CDataStream*)allocator_malloc(sizeof(CDataStream));
     dstream->hwdecoder = hw_alloc();
 
     dstream->manuality_device_name = NULL;
     dstream->is_hardware_avaliable = false;
     dstream->thread_count = 1;
-    dstream->thread_type |= FF_THREAD_FRAME | FF_THREAD_SLICE;
+    dstream->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
     dstream->stream_type = 0;
+    dstream->fwidth = dstream->fheight = 0;
+    dstream->swidth = dstream->sheight = 0;
+    dstream->time_base = av_make_q(0, 1);
+    dstream->bit_rate = 0;
+    dstream->encoder_preset = NULL;
+    dstream->file_writer = NULL;
+    dstream->fragment_duration_us = 0;
+    dstream->av_output_format_ctx = NULL;
+    dstream->async_writer = NULL;
     dstream->vneed_rescaler_update = 0;
     dstream->allow_hardware_decoding = 0;
     dstream->allocated_block_size = 0;
+    dstream->block_buffer_capacity = 0;
     dstream->block_buffer = NULL;
+    dstream->block_buffer_borrowed = false;
     dstream->pts = 0;
+    dstream->pts_offset = 0;
+    dstream->loop_first_pts = AV_NOPTS_VALUE;
+    dstream->loop_end_pts = AV_NOPTS_VALUE;
+    dstream->loop_cached_dts = AV_NOPTS_VALUE;
     dstream->data_stream_index = -1;
+    dstream->wanted_stream_index = -1;
     dstream->av_codec_ctx = NULL;
+    dstream->frame_pool = NULL;
     dstream->av_output_pix_fmt = AV_PIX_FMT_RGB0;
     dstream->av_output_flags = SWS_BICUBLIN;
+    dstream->texture_format = TEXTURE_FORMAT_NONE;
+    dstream->texture_source_buffer = NULL;
+    dstream->texture_source_capacity = 0;
     dstream->av_frame = NULL;
     dstream->sc_frame = NULL;
     dstream->av_first_pkt = NULL;
     dstream->sws_scaler_ctx = NULL;
+    memset(dstream->scaler_cache, 0, sizeof(dstream->scaler_cache));
+    dstream->scaler_cache_clock = 0;
     dstream->swr_ctx = NULL;
+    dstream->shared_ring = NULL;
+    dstream->atlas = NULL;
+    dstream->atlas_rect = -1;
+    dstream->frame_cache = NULL;
+    dstream->frames_pending = false;
+    dstream->end_of_stream = false;
+    dstream->pending_decode_time_us = 0;
+    dstream->nb_samples = 0;
+    dstream->playback_rate = 1.0;
+    dstream->tempo_graph = NULL;
+    dstream->tempo_source = NULL;
+    dstream->tempo_sink = NULL;
+    dstream->tempo_frame = NULL;
+    dstream->tempo_update = false;
+    dstream->wait_for_keyframe = false;
+    dstream->min_frame_interval_us = 0;
+    dstream->last_output_pts = AV_NOPTS_VALUE;
+    dstream->change_detection = false;
+    dstream->last_frame_hash_valid = false;
+    dstream->last_frame_hash = 0;
+    dstream->frame_unchanged = false;
+    dstream->adaptive_quality = false;
+    dstream->frame_budget_us = 0;
+    dstream->quality_overruns = 0;
+    dstream->quality_underruns = 0;
+    dstream->quality_level_samples = 0;
+    memset(&dstream->stats, 0, sizeof(CDataStreamStats));
 
     return dstream;
 }
@@ -47,8 +218,12 @@ bool data_stream_initialize_decode(CDataStream** stream_ptr, AVFormatContext* av
     (*stream_ptr)->stream_type = stream_type;
     (*stream_ptr)->allow_hardware_decoding = allow_hardware;
 
-    // Find the first valid video stream inside the file
-    ffmpeg_call((stream->data_stream_index = av_find_best_stream(av_format_ctx, stream_type, -1, -1, &av_codec, 0)));
+    // Find the wanted or the first valid stream of the type inside the file
+    if ((stream->data_stream_index = av_find_best_stream(av_format_ctx, stream_type, stream->wanted_stream_index, -1, &av_codec, 0)) < 0)
+    {
+        print_error(stream->data_stream_index);
+        return false;
+    }
 
     av_codec_params = av_format_ctx->streams[stream->data_stream_index]->codecpar;
     stream->time_base = av_format_ctx->streams[stream->data_stream_index]->time_base;
@@ -56,6 +231,10 @@ bool data_stream_initialize_decode(CDataStream** stream_ptr, AVFormatContext* av
     {
         stream->fwidth = av_codec_params->width;
         stream->fheight = av_codec_params->height;
+
+        AVRational frame_rate = av_format_ctx->streams[stream->data_stream_index]->avg_frame_rate;
+        if(!stream->frame_budget_us && frame_rate.num > 0 && frame_rate.den > 0)
+            stream->frame_budget_us = (int64_t)1000000 * frame_rate.den / frame_rate.num;
     }
 
     if(allow_hardware)
@@ -82,10 +261,18 @@ bool data_stream_initialize_decode(CDataStream** stream_ptr, AVFormatContext* av
 
     if(hw_result)
         stream->is_hardware_avaliable = hw_initialize_decoder(&stream->hwdecoder, &stream->av_codec_ctx);
+
+    if(stream_type == AVMEDIA_TYPE_VIDEO && (av_codec->capabilities & AV_CODEC_CAP_DR1))
+    {
+        stream->frame_pool = frame_pool_alloc();
+        frame_pool_attach(&stream->frame_pool, stream->av_codec_ctx);
+    }
     
     stream->av_codec_ctx->thread_count = stream->thread_count;
     stream->av_codec_ctx->thread_type |= stream->thread_type;
 
+    data_stream_apply_quality_level(stream);
+
     ffmpeg_call_m(avcodec_open2(stream->av_codec_ctx, av_codec, NULL), "Couldn't open codec\n");
 
     ffmpeg_call_m((void*)(
@@ -101,12 +288,121 @@ bool data_stream_initialize_decode(CDataStream** stream_ptr, AVFormatContext* av
 
 }
 
+static enum AVPixelFormat data_stream_select_encoder_pix_fmt(const AVCodec* av_codec)
+{
+    const enum AVPixelFormat* pix_fmt;
+
+    if (!av_codec->pix_fmts)
+        return AV_PIX_FMT_YUV420P;
+
+    // Planar 4:2:0 is the cheapest conversion target, use it when possible
+    for (pix_fmt = av_codec->pix_fmts; *pix_fmt != AV_PIX_FMT_NONE; pix_fmt++)
+    {
+        if (*pix_fmt == AV_PIX_FMT_YUV420P)
+            return *pix_fmt;
+    }
+
+    return av_codec->pix_fmts[0];
+}
+
+static int data_stream_write_output(void* opaque, uint8_t* data, int size)
+{
+    CAsyncWriter* writer = (CAsyncWriter*)opaque;
+    return async_writer_write(&writer, data, size) ? size : AVERROR(EIO);
+}
+
+// Writes the last fragment, waits for the writer thread and releases the muxer
+static bool data_stream_close_fragmented_output(CDataStream* stream)
+{
+    AVFormatContext* av_format_ctx = stream->av_output_format_ctx;
+    bool result = true;
+
+    if (!av_format_ctx)
+        return true;
+
+    if (stream->async_writer)
+        result = av_write_trailer(av_format_ctx) >= 0;
+
+    if (av_format_ctx->pb)
+    {
+        av_freep(&av_format_ctx->pb->buffer);
+        avio_context_free(&av_format_ctx->pb);
+    }
+    avformat_free_context(av_format_ctx);
+    stream->av_output_format_ctx = NULL;
+
+    if (stream->async_writer)
+        result = async_writer_flush(&stream->async_writer) && result;
+    async_writer_close(&stream->async_writer);
+
+    return result;
+}
+
+static bool data_stream_open_fragmented_output(CDataStream* stream, const char* filename)
+{
+    AVFormatContext* av_format_ctx = NULL;
+    AVDictionary* options = NULL;
+    AVStream* av_stream = NULL;
+    uint8_t* io_buffer = NULL;
+    int result;
+
+    if (avformat_alloc_output_context2(&av_format_ctx, NULL, "mp4", filename) < 0)
+    {
+        fprintf(stderr, "Couldn't allocate output context.\n");
+        return false;
+    }
+    stream->av_output_format_ctx = av_format_ctx;
+
+    if (!(av_stream = avformat_new_stream(av_format_ctx, NULL)) || 
+        avcodec_parameters_from_context(av_stream->codecpar, stream->av_codec_ctx) < 0)
+    {
+        fprintf(stderr, "Couldn't create output stream.\n");
+        data_stream_close_fragmented_output(stream);
+        return false;
+    }
+    av_stream->time_base = stream->av_codec_ctx->time_base;
+
+    // Output is not seekable, everything the muxer writes goes straight to the writer thread
+    if (!(stream->async_writer = async_writer_alloc()) || 
+        !async_writer_open(&stream->async_writer, filename, FRAGMENTED_OUTPUT_WRITER_CAPACITY) ||
+        !(io_buffer = (uint8_t*)av_malloc(FRAGMENTED_OUTPUT_IO_BUFFER_SIZE)) ||
+        !(av_format_ctx->pb = avio_alloc_context(io_buffer, FRAGMENTED_OUTPUT_IO_BUFFER_SIZE, 1, stream->async_writer, NULL, data_stream_write_output, NULL)))
+    {
+        av_free(io_buffer);
+        async_writer_close(&stream->async_writer);
+        data_stream_close_fragmented_output(stream);
+        return false;
+    }
+    av_format_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+
+    // Empty moov makes the file playable before the first fragment is complete
+    av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+    av_dict_set_int(&options, "frag_duration", stream->fragment_duration_us, 0);
+    result = avformat_write_header(av_format_ctx, &options);
+    av_dict_free(&options);
+
+    if (result < 0)
+    {
+        fprintf(stderr, "Couldn't write output header.\n");
+        print_error(result);
+        async_writer_close(&stream->async_writer);
+        data_stream_close_fragmented_output(stream);
+        return false;
+    }
+
+    return true;
+}
+
 bool data_stream_initialize_encode(CDataStream** stream_ptr, const char* filename, enum AVCodecID id, enum AVMediaType stream_type, bool allow_hardware)
 {
     CDataStream* stream = *stream_ptr;
     AVCodec* av_codec = NULL;
+    AVCodecContext* av_codec_ctx = NULL;
     int result;
 
+    stream->stream_type = stream_type;
+    stream->allow_hardware_decoding = allow_hardware;
+
     ffmpeg_call_m((void*)(
         av_codec = avcodec_find_encoder(id)), "Codec could not found.\n"
         );
@@ -114,20 +410,62 @@ bool data_stream_initialize_encode(CDataStream** stream_ptr, const char* filenam
     ffmpeg_call_m((void*)(
         stream->av_codec_ctx = avcodec_alloc_context3(av_codec)), "Cannot allocate codec context.\n"
         );
+    av_codec_ctx = stream->av_codec_ctx;
 
     //Init codec params
+    if (stream_type == AVMEDIA_TYPE_VIDEO)
+    {
+        if (stream->swidth <= 0 || stream->sheight <= 0)
+        {
+            fprintf(stderr, "Output frame size is not set.\n");
+            return false;
+        }
 
-    //Init codec params
+        av_codec_ctx->width = stream->swidth;
+        av_codec_ctx->height = stream->sheight;
+        av_codec_ctx->pix_fmt = data_stream_select_encoder_pix_fmt(av_codec);
+        av_codec_ctx->time_base = stream->time_base.num > 0 ? stream->time_base : av_make_q(1, 25);
+
+        // Frames passed to the encoder must be converted to this format
+        stream->av_output_pix_fmt = av_codec_ctx->pix_fmt;
+    }
+    else if (stream_type == AVMEDIA_TYPE_AUDIO)
+    {
+        av_codec_ctx->sample_fmt = av_codec->sample_fmts ? av_codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+        av_codec_ctx->sample_rate = av_codec->supported_samplerates ? av_codec->supported_samplerates[0] : 44100;
+        av_codec_ctx->channel_layout = AV_CH_LAYOUT_STEREO;
+        av_codec_ctx->channels = av_get_channel_layout_nb_channels(AV_CH_LAYOUT_STEREO);
+        av_codec_ctx->time_base = av_make_q(1, av_codec_ctx->sample_rate);
+    }
+    stream->time_base = av_codec_ctx->time_base;
+
+    if (stream->bit_rate > 0)
+        av_codec_ctx->bit_rate = stream->bit_rate;
+
+    av_codec_ctx->thread_count = stream->thread_count;
+    av_codec_ctx->thread_type |= stream->thread_type;
+
+    // MP4 keeps codec headers in the sample description instead of the bitstream
+    if (stream->fragment_duration_us > 0)
+        av_codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
     if (av_codec->id == AV_CODEC_ID_H264)
-        ffmpeg_call(av_opt_set(stream->av_codec_ctx->priv_data, "preset", "slow", 0));
+        ffmpeg_call(av_opt_set(stream->av_codec_ctx->priv_data, "preset", stream->encoder_preset ? stream->encoder_preset : "slow", 0));
+
+    if ((result = avcodec_open2(stream->av_codec_ctx, av_codec, NULL)) < 0)
+    {
+        fprintf(stderr, "Couldn't open encoder.\n");
+        print_error(result);
+        return false;
+    }
 
-    ffmpeg_call((result = avcodec_open2(stream->av_codec_ctx, av_codec, NULL)));
+    if (stream->fragment_duration_us > 0)
+        return data_stream_open_fragmented_output(stream, filename);
 
     #ifdef _WIN32
-    if((result = fopen_s(stream->file_writer, filename, "wb")) < 0)
+    if(fopen_s(&stream->file_writer, filename, "wb") != 0)
     #else
-    if((stream->file_writer = fopen(filename, "wb")) < 0)
+    if(!(stream->file_writer = fopen(filename, "wb")))
     #endif
     {
         fprintf(stderr, "Cannot open file writer.\n");
@@ -137,77 +475,586 @@ bool data_stream_initialize_encode(CDataStream** stream_ptr, const char* filenam
     return true;
 }
 
-int data_stream_decode(CDataStream** stream_ptr, AVFormatContext* av_format_ctx, AVPacket* av_packet)
+int data_stream_encode(CDataStream** stream_ptr, AVFrame* av_frame)
 {
     int response;
     CDataStream* stream = *stream_ptr;
+    AVPacket* av_packet = NULL;
 
-    ffmpeg_call((
-        response = avcodec_send_packet(stream->av_codec_ctx, av_packet)
-    ));
+    if ((response = avcodec_send_frame(stream->av_codec_ctx, av_frame)) < 0)
+    {
+        fprintf(stderr, "Error while sending frame to encoder\n");
+        print_error(response);
+        return response;
+    }
+
+    ffmpeg_call_m((void*)(
+        av_packet = av_packet_alloc()), 
+        "Couldn't allocate AVPacket\n"
+        );
 
-    while(true)
+    while ((response = avcodec_receive_packet(stream->av_codec_ctx, av_packet)) >= 0)
     {
-        if (!(stream->av_frame = av_frame_alloc()) || !(stream->hwdecoder->sw_frame = av_frame_alloc())) 
+        stream->pts = av_packet->pts;
+
+        if (stream->av_output_format_ctx)
         {
-            fprintf(stderr, "Can not alloc frames\n");
-            response = AVERROR(ENOMEM);
+            AVStream* av_stream = stream->av_output_format_ctx->streams[0];
+            av_packet->stream_index = av_stream->index;
+            av_packet_rescale_ts(av_packet, stream->av_codec_ctx->time_base, av_stream->time_base);
+
+            // Single stream needs no interleaving, packets reach the muxer without delay
+            if ((response = av_write_frame(stream->av_output_format_ctx, av_packet)) < 0)
+            {
+                fprintf(stderr, "Error while writing packet\n");
+                av_packet_free(&av_packet);
+                print_error(response);
+                return response;
+            }
+        }
+        else if (stream->file_writer)
+            fwrite(av_packet->data, 1, av_packet->size, stream->file_writer);
+
+        av_packet_unref(av_packet);
+    }
+
+    av_packet_free(&av_packet);
+
+    // Flushed encoder has nothing more, finish the file so it is complete right away
+    if (response == AVERROR_EOF && !data_stream_close_fragmented_output(stream))
+    {
+        fprintf(stderr, "Couldn't finish fragmented output\n");
+        return AVERROR(EIO);
+    }
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
+        return 0;
+
+    print_error(response);
+    return response;
+}
+
+int data_stream_send_packet(CDataStream** stream_ptr, AVPacket* av_packet)
+{
+    int response;
+    CDataStream* stream = *stream_ptr;
+    int64_t send_start_time = av_gettime_relative();
+
+    response = avcodec_send_packet(stream->av_codec_ctx, av_packet);
+    stream->pending_decode_time_us += av_gettime_relative() - send_start_time;
+
+    if (response >= 0 || response == AVERROR(EAGAIN))
+        stream->frames_pending = true;
+    else if (response != AVERROR_EOF)
+    {
+        fprintf(stderr, "Error while sending packet to decoder\n");
+        print_error(response);
+    }
+
+    return response;
+}
+
+// Fast playback converts only frames at least min_frame_interval_us apart, jumps back always convert
+static bool data_stream_should_drop_frame(CDataStream* stream)
+{
+    if (stream->stream_type != AVMEDIA_TYPE_VIDEO || stream->min_frame_interval_us <= 0 || stream->pts == AV_NOPTS_VALUE)
+        return false;
+
+    int64_t interval = av_rescale_q(stream->min_frame_interval_us, AV_TIME_BASE_Q, stream->time_base);
+    if (stream->last_output_pts != AV_NOPTS_VALUE && stream->pts >= stream->last_output_pts && stream->pts < stream->last_output_pts + interval)
+        return true;
+
+    stream->last_output_pts = stream->pts;
+    return false;
+}
+
+int data_stream_receive_frame(CDataStream** stream_ptr)
+{
+    int response;
+    size_t decoded_size = 0;
+    CDataStream* stream = *stream_ptr;
+    int64_t receive_start_time;
+
+    if (!(stream->av_frame = av_frame_alloc()) || !(stream->hwdecoder->sw_frame = av_frame_alloc())) 
+    {
+        fprintf(stderr, "Can not alloc frames\n");
+        response = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    // Only decoder time is measured, the quality level can't make conversion faster
+    receive_start_time = av_gettime_relative();
+    response = avcodec_receive_frame(stream->av_codec_ctx, stream->av_frame);
+    stream->pending_decode_time_us += av_gettime_relative() - receive_start_time;
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
+    {
+        stream->frames_pending = false;
+        stream->end_of_stream = response == AVERROR_EOF;
+
+        if (stream->end_of_stream && stream->frame_cache && stream->frame_cache->is_writer)
+            frame_cache_finish(&stream->frame_cache, stream->pts + av_rescale_q(stream->frame_budget_us, AV_TIME_BASE_Q, stream->time_base));
+        goto fail;
+    }
+    else if (response < 0)
+    {
+        fprintf(stderr, "Error while decoding\n");
+        stream->frames_pending = false;
+        goto fail;
+    }
+
+    decoded_size = frame_buffer_size(stream->av_frame);
+    memory_budget_acquire(MEMORY_CATEGORY_DECODED_FRAMES, decoded_size);
+
+    // Frames the decoder returned in system memory are used as is
+    if (stream->is_hardware_avaliable && stream->allow_hardware_decoding)
+        hw_get_decoded_frame(&stream->hwdecoder, NULL, &stream->av_frame);
+
+    stream->pts = stream->av_frame->pts;
+
+    if (data_stream_should_drop_frame(stream))
+    {
+        // The cache must hold every frame
+        if (stream->frame_cache && stream->frame_cache->is_writer)
+            frame_cache_abort(&stream->frame_cache);
+
+        // Decode time of dropped frames is not carried over to the next converted frame
+        stream->stats.frames_dropped++;
+        stream->pending_decode_time_us = 0;
+        response = DATA_STREAM_FRAME_DROPPED;
+        goto fail;
+    }
+
+    if(!stream->data_stream_get_sw_data_ptr(stream_ptr))
+    {
+        printf("Failed while scaling frame.\n");
+        response = AVERROR(EINVAL);
+        goto fail;
+    }
+
+    data_stream_update_quality(stream, stream->pending_decode_time_us);
+    stream->pending_decode_time_us = 0;
+
+    fail:
+        memory_budget_release(MEMORY_CATEGORY_DECODED_FRAMES, decoded_size);
+        av_frame_free(&stream->av_frame);
+        av_frame_free(&stream->hwdecoder->sw_frame);
+        if (response < 0 && response != AVERROR(EAGAIN) && response != AVERROR_EOF)
             print_error(response);
-            goto fail;
+
+    return response;
+}
+
+int data_stream_receive_raw_frame(CDataStream** stream_ptr, AVFrame* av_frame)
+{
+    int response;
+    CDataStream* stream = *stream_ptr;
+
+    response = avcodec_receive_frame(stream->av_codec_ctx, av_frame);
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
+    {
+        stream->frames_pending = false;
+        stream->end_of_stream = response == AVERROR_EOF;
+        return response;
+    }
+    else if (response < 0)
+    {
+        fprintf(stderr, "Error while decoding\n");
+        print_error(response);
+        stream->frames_pending = false;
+        return response;
+    }
+
+    // Kept frames must own their data, so hardware surfaces are downloaded into a new frame
+    if (av_frame->hw_frames_ctx)
+    {
+        AVFrame* sw_frame = av_frame_alloc();
+        if (!sw_frame || (response = av_hwframe_transfer_data(sw_frame, av_frame, 0)) < 0 || (response = av_frame_copy_props(sw_frame, av_frame)) < 0)
+        {
+            fprintf(stderr, "Error transferring the data to system memory\n");
+            av_frame_free(&sw_frame);
+            av_frame_unref(av_frame);
+            return response < 0 ? response : AVERROR(ENOMEM);
         }
 
-        response = avcodec_receive_frame(stream->av_codec_ctx, stream->av_frame);
-        if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
+        av_frame_unref(av_frame);
+        av_frame_move_ref(av_frame, sw_frame);
+        av_frame_free(&sw_frame);
+    }
+
+    return 0;
+}
+
+bool data_stream_convert_frame(CDataStream** stream_ptr, AVFrame* av_frame)
+{
+    CDataStream* stream = *stream_ptr;
+    AVFrame* decoded_frame = stream->av_frame;
+
+    stream->av_frame = av_frame;
+    stream->pts = av_frame->pts;
+    bool result = stream->data_stream_get_sw_data_ptr(stream_ptr);
+    stream->av_frame = decoded_frame;
+
+    return result;
+}
+
+// Scaler for the source geometry of the frame and the output geometry, the least recently used one is replaced
+static struct SwsContext* data_stream_get_scaler(CDataStream* stream, int32_t src_width, int32_t src_height, enum AVPixelFormat src_pix_fmt,
+    int32_t dst_width, int32_t dst_height, enum AVPixelFormat dst_pix_fmt)
+{
+    CScalerCacheEntry* victim = &stream->scaler_cache[0];
+
+    for (int32_t i = 0; i < DATA_STREAM_SCALER_CACHE_SIZE; i++)
+    {
+        CScalerCacheEntry* entry = &stream->scaler_cache[i];
+
+        if (entry->sws_ctx && entry->src_width == src_width && entry->src_height == src_height && entry->src_pix_fmt == src_pix_fmt &&
+            entry->dst_width == dst_width && entry->dst_height == dst_height && entry->dst_pix_fmt == dst_pix_fmt &&
+            entry->flags == stream->av_output_flags)
         {
-            av_frame_free(&stream->av_frame);
-            av_frame_free(&stream->hwdecoder->sw_frame);
-            print_error(response);
-            return 0;
+            entry->last_used = ++stream->scaler_cache_clock;
+            return entry->sws_ctx;
         }
-        else if (response < 0)
+
+        if (!entry->sws_ctx || (victim->sws_ctx && entry->last_used < victim->last_used))
+            victim = entry;
+    }
+
+    sws_freeContext(victim->sws_ctx);
+    victim->sws_ctx = sws_getContext(src_width, src_height, src_pix_fmt, dst_width, dst_height, dst_pix_fmt,
+                                     stream->av_output_flags, NULL, NULL, NULL);
+    victim->src_width = src_width;
+    victim->src_height = src_height;
+    victim->src_pix_fmt = src_pix_fmt;
+    victim->dst_width = dst_width;
+    victim->dst_height = dst_height;
+    victim->dst_pix_fmt = dst_pix_fmt;
+    victim->flags = stream->av_output_flags;
+    victim->last_used = ++stream->scaler_cache_clock;
+    return victim->sws_ctx;
+}
+
+static void data_stream_free_scalers(CDataStream* stream)
+{
+    for (int32_t i = 0; i < DATA_STREAM_SCALER_CACHE_SIZE; i++)
+    {
+        sws_freeContext(stream->scaler_cache[i].sws_ctx);
+        stream->scaler_cache[i].sws_ctx = NULL;
+    }
+    stream->scaler_cache_clock = 0;
+    stream->sws_scaler_ctx = NULL;
+}
+
+bool data_stream_adopt_converters(CDataStream** stream_ptr, CDataStream** source_ptr)
+{
+    CDataStream* stream = *stream_ptr;
+    CDataStream* source = *source_ptr;
+    bool adopted = false;
+
+    if (stream->stream_type != source->stream_type || !stream->av_codec_ctx || !source->av_codec_ctx)
+        return false;
+
+    // Scalers are keyed by geometry, so the whole cache is taken over and any matching context is reused
+    if (stream->stream_type == AVMEDIA_TYPE_VIDEO && !stream->scaler_cache_clock && source->scaler_cache_clock && !source->vneed_rescaler_update &&
+        stream->swidth == source->swidth && stream->sheight == source->sheight && 
+        stream->av_output_pix_fmt == source->av_output_pix_fmt && stream->av_output_flags == source->av_output_flags &&
+        stream->texture_format == source->texture_format &&
+        stream->shared_ring == source->shared_ring && stream->atlas == source->atlas)
+    {
+        memcpy(stream->scaler_cache, source->scaler_cache, sizeof(stream->scaler_cache));
+        stream->scaler_cache_clock = source->scaler_cache_clock;
+        memset(source->scaler_cache, 0, sizeof(source->scaler_cache));
+        source->scaler_cache_clock = 0;
+        source->sws_scaler_ctx = NULL;
+        adopted = true;
+    }
+
+    if (stream->stream_type == AVMEDIA_TYPE_AUDIO && !stream->swr_ctx && source->swr_ctx &&
+        stream->av_codec_ctx->channel_layout == source->av_codec_ctx->channel_layout &&
+        stream->av_codec_ctx->sample_rate == source->av_codec_ctx->sample_rate &&
+        stream->av_codec_ctx->sample_fmt == source->av_codec_ctx->sample_fmt)
+    {
+        stream->swr_ctx = source->swr_ctx;
+        source->swr_ctx = NULL;
+        adopted = true;
+    }
+
+    // The output buffer goes together with the converter it was sized for, frames mapped from the frame cache are not owned
+    if (adopted && !stream->block_buffer && !source->block_buffer_borrowed)
+    {
+        stream->block_buffer = source->block_buffer;
+        stream->block_buffer_capacity = source->block_buffer_capacity;
+        stream->allocated_block_size = source->allocated_block_size;
+        source->block_buffer = NULL;
+        source->block_buffer_capacity = 0;
+        stream->vneed_rescaler_update = false;
+    }
+
+    return adopted;
+}
+
+int data_stream_decode(CDataStream** stream_ptr, AVFormatContext* av_format_ctx, AVPacket* av_packet)
+{
+    int response;
+
+    if ((response = data_stream_send_packet(stream_ptr, av_packet)) < 0 && response != AVERROR(EAGAIN))
+        return response;
+
+    while ((response = data_stream_receive_frame(stream_ptr)) >= 0);
+
+    if (response == AVERROR(EAGAIN) || response == AVERROR_EOF)
+        return 0;
+
+    return response;
+}
+
+// Decodes every frame of the stream and adds it to the waveform, returns false on a decoding error
+static bool data_stream_receive_waveform_frames(CDataStream** stream_ptr, AVFrame* av_frame, CWaveform** waveform_ptr)
+{
+    int response;
+
+    while ((response = data_stream_receive_raw_frame(stream_ptr, av_frame)) >= 0)
+    {
+        bool added = waveform_add_frame(waveform_ptr, av_frame);
+        av_frame_unref(av_frame);
+        if (!added)
+            return false;
+    }
+
+    return response == AVERROR(EAGAIN) || response == AVERROR_EOF;
+}
+
+bool data_stream_build_waveform(CDataStream** stream_ptr, AVFormatContext* av_format_ctx, CWaveform** waveform_ptr, int32_t samples_per_bucket)
+{
+    CDataStream* stream = *stream_ptr;
+    enum AVDiscard* discard = NULL;
+    AVPacket* av_packet = NULL;
+    AVFrame* av_frame = NULL;
+    bool result = false;
+    int response;
+
+    if (stream->stream_type != AVMEDIA_TYPE_AUDIO || !stream->av_codec_ctx || stream->data_stream_index < 0 ||
+        !waveform_begin(waveform_ptr, stream->av_codec_ctx->sample_rate, stream->av_codec_ctx->channels, samples_per_bucket))
+        return false;
+
+    if (!(discard = (enum AVDiscard*)allocator_malloc(sizeof(enum AVDiscard) * av_format_ctx->nb_streams)))
+        return false;
+
+    // The demuxer skips packets of every other stream, video is never read or decoded
+    for (unsigned i = 0; i < av_format_ctx->nb_streams; i++)
+    {
+        discard[i] = av_format_ctx->streams[i]->discard;
+        if ((int32_t)i != stream->data_stream_index)
+            av_format_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    int64_t start_time = av_format_ctx->start_time != AV_NOPTS_VALUE ? av_format_ctx->start_time : 0;
+    av_seek_frame(av_format_ctx, -1, start_time, AVSEEK_FLAG_BACKWARD);
+    avcodec_flush_buffers(stream->av_codec_ctx);
+
+    if (!(av_packet = av_packet_alloc()) || !(av_frame = av_frame_alloc()))
+        goto cleanup;
+
+    // Raw decoded frames are reduced as they are, nothing is resampled or converted
+    bool draining = false;
+    while (!draining)
+    {
+        if (av_read_frame(av_format_ctx, av_packet) < 0)
+            draining = true;
+        else if (av_packet->stream_index != stream->data_stream_index)
         {
-            fprintf(stderr, "Error while decoding\n");
-            print_error(response);
-            goto fail;
+            av_packet_unref(av_packet);
+            continue;
         }
 
-        if (stream->is_hardware_avaliable && stream->allow_hardware_decoding)
+        do
         {
-            if (!hw_get_decoded_frame(&stream->hwdecoder, av_packet, &stream->av_frame))
+            response = data_stream_send_packet(stream_ptr, draining ? NULL : av_packet);
+            if (!data_stream_receive_waveform_frames(stream_ptr, av_frame, waveform_ptr))
             {
-                printf("Failed while decoding frame on gpu.\n");
-                goto fail;
+                av_packet_unref(av_packet);
+                goto cleanup;
             }
-        }
+        } 
+        while (response == AVERROR(EAGAIN));
+        av_packet_unref(av_packet);
+
+        // Damaged packets are skipped, the rest of the waveform is still useful
+        if (response < 0 && response != AVERROR_EOF && response != AVERROR_INVALIDDATA)
+            goto cleanup;
+    }
+
+    result = waveform_finish(waveform_ptr);
+
+    cleanup:
+        av_packet_free(&av_packet);
+        av_frame_free(&av_frame);
+
+        for (unsigned i = 0; i < av_format_ctx->nb_streams; i++)
+            av_format_ctx->streams[i]->discard = discard[i];
+        allocator_free(discard);
+
+        av_seek_frame(av_format_ctx, -1, start_time, AVSEEK_FLAG_BACKWARD);
+        avcodec_flush_buffers(stream->av_codec_ctx);
+        stream->frames_pending = false;
+        stream->end_of_stream = false;
+
+    return result;
+}
+
+static void data_stream_free_tempo_graph(CDataStream* stream)
+{
+    avfilter_graph_free(&stream->tempo_graph);
+    av_frame_free(&stream->tempo_frame);
+    stream->tempo_source = NULL;
+    stream->tempo_sink = NULL;
+}
+
+static bool data_stream_link_tempo_filter(CDataStream* stream, AVFilterContext** last, const char* name, const char* args)
+{
+    AVFilterContext* filter = NULL;
+
+    if (avfilter_graph_create_filter(&filter, avfilter_get_by_name(name), NULL, args, NULL, stream->tempo_graph) < 0 ||
+        avfilter_link(*last, 0, filter, 0) < 0)
+    {
+        fprintf(stderr, "Couldn't create %s filter\n", name);
+        return false;
+    }
+
+    *last = filter;
+    return true;
+}
+
+// abuffer -> atempo chain -> aformat to interleaved S16 -> abuffersink
+static bool data_stream_build_tempo_graph(CDataStream* stream)
+{
+    AVFrame* av_frame = stream->av_frame;
+    uint64_t channel_layout = av_frame->channel_layout ? av_frame->channel_layout : (uint64_t)av_get_default_channel_layout(av_frame->channels);
+    double rate = stream->playback_rate;
+    AVFilterContext* last;
+    char args[256];
 
-        stream->pts = stream->av_frame->pts;
+    ffmpeg_call_m((void*)(
+        stream->tempo_graph = avfilter_graph_alloc()), "Couldn't allocate tempo filter graph\n"
+    );
+    ffmpeg_call_m((void*)(
+        stream->tempo_frame = av_frame_alloc()), "Can not alloc frame\n"
+    );
+
+    snprintf(args, sizeof(args), "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%" PRIx64,
+        stream->time_base.num, stream->time_base.den, av_frame->sample_rate,
+        av_get_sample_fmt_name((enum AVSampleFormat)av_frame->format), channel_layout);
+    if (avfilter_graph_create_filter(&stream->tempo_source, avfilter_get_by_name("abuffer"), "in", args, NULL, stream->tempo_graph) < 0)
+    {
+        fprintf(stderr, "Couldn't create abuffer filter\n");
+        return false;
+    }
+    last = stream->tempo_source;
+
+    // Older atempo accepts 0.5 - 2.0 only, larger changes are chained
+    while (rate > 2.0 || rate < 0.5)
+    {
+        double step = rate > 2.0 ? 2.0 : 0.5;
+        rate /= step;
+
+        snprintf(args, sizeof(args), "tempo=%f", step);
+        if (!data_stream_link_tempo_filter(stream, &last, "atempo", args))
+            return false;
+    }
+
+    snprintf(args, sizeof(args), "tempo=%f", rate);
+    if (rate != 1.0 && !data_stream_link_tempo_filter(stream, &last, "atempo", args))
+        return false;
+
+    snprintf(args, sizeof(args), "sample_fmts=s16:channel_layouts=0x%" PRIx64, channel_layout);
+    if (!data_stream_link_tempo_filter(stream, &last, "aformat", args))
+        return false;
 
-        if(!stream->data_stream_get_sw_data_ptr(stream_ptr))
+    if (avfilter_graph_create_filter(&stream->tempo_sink, avfilter_get_by_name("abuffersink"), "out", NULL, NULL, stream->tempo_graph) < 0 ||
+        avfilter_link(last, 0, stream->tempo_sink, 0) < 0 || avfilter_graph_config(stream->tempo_graph, NULL) < 0)
+    {
+        fprintf(stderr, "Couldn't configure tempo filter graph\n");
+        return false;
+    }
+
+    return true;
+}
+
+// Time-stretched samples of every frame the graph returned are appended into block_buffer
+static bool data_stream_get_sw_data_tempo(CDataStream* stream)
+{
+    int bytes_per_sample = av_get_bytes_per_sample(AV_SAMPLE_FMT_S16) * stream->av_frame->channels;
+
+    ffmpeg_call_m(
+        av_buffersrc_add_frame_flags(stream->tempo_source, stream->av_frame, AV_BUFFERSRC_FLAG_KEEP_REF),
+        "Couldn't feed tempo filter graph\n"
+    );
+
+    stream->nb_samples = 0;
+    stream->allocated_block_size = 0;
+
+    while (av_buffersink_get_frame(stream->tempo_sink, stream->tempo_frame) >= 0)
+    {
+        size_t size = (size_t)stream->tempo_frame->nb_samples * bytes_per_sample;
+        size_t required_size = (size_t)stream->allocated_block_size + size;
+
+        if (!stream->block_buffer || stream->block_buffer_capacity < required_size)
         {
-            printf("Failed while scaling frame.\n");
-            return 0;
+            uint8_t* buffer = (uint8_t*)allocator_aligned_malloc(required_size, ALLOCATOR_DEFAULT_ALIGNMENT);
+            ffmpeg_call_m((void*)buffer, "Couldn't allocate audio buffer\n");
+
+            if (stream->allocated_block_size > 0)
+                memcpy(buffer, stream->block_buffer, stream->allocated_block_size);
+            data_stream_free_block_buffer(stream);
+
+            stream->block_buffer = buffer;
+            stream->block_buffer_capacity = required_size;
+            memory_budget_acquire(MEMORY_CATEGORY_AUDIO, stream->block_buffer_capacity);
         }
 
-        fail:
-            av_frame_free(&stream->av_frame);
-            av_frame_free(&stream->hwdecoder->sw_frame);
-            if (response < 0)
-            {
-                print_error(response);
-                return response;
-            }
+        memcpy(stream->block_buffer + stream->allocated_block_size, stream->tempo_frame->data[0], size);
+        stream->allocated_block_size += (int32_t)size;
+        stream->nb_samples += stream->tempo_frame->nb_samples;
+        av_frame_unref(stream->tempo_frame);
     }
 
-    return 0;
+    return true;
 }
 
 bool data_stream_get_sw_data_audio(CDataStream** stream_ptr)
 {
     CDataStream* stream = *stream_ptr;
 
-    ffmpeg_call(
-        av_samples_alloc(&stream->block_buffer, &stream->allocated_block_size, stream->av_frame->channels, stream->av_frame->sample_rate, AV_SAMPLE_FMT_FLT, 0)
-    );
+    if (stream->tempo_update)
+    {
+        data_stream_free_tempo_graph(stream);
+        stream->tempo_update = false;
+
+        if (stream->playback_rate != 1.0 && !data_stream_build_tempo_graph(stream))
+        {
+            data_stream_free_tempo_graph(stream);
+            return false;
+        }
+    }
+
+    if (stream->tempo_graph)
+        return data_stream_get_sw_data_tempo(stream);
+
+    int required_size = av_samples_get_buffer_size(&stream->allocated_block_size, stream->av_frame->channels, stream->av_frame->sample_rate, AV_SAMPLE_FMT_FLT, 0);
+    ffmpeg_call(required_size);
+
+    // Reuse the sample buffer while it is large enough
+    if (!stream->block_buffer || stream->block_buffer_capacity < (size_t)required_size)
+    {
+        data_stream_free_block_buffer(stream);
+
+        ffmpeg_call_m((void*)(
+            stream->block_buffer = (uint8_t*)allocator_aligned_malloc(required_size, ALLOCATOR_DEFAULT_ALIGNMENT)),
+            "Couldn't allocate audio buffer\n"
+        );
+
+        stream->block_buffer_capacity = required_size;
+        memory_budget_acquire(MEMORY_CATEGORY_AUDIO, stream->block_buffer_capacity);
+    }
 
     if (!stream->swr_ctx)
     {
@@ -229,49 +1076,235 @@ bool data_stream_get_sw_data_audio(CDataStream** stream_ptr)
         response = swr_convert(stream->swr_ctx, &stream->block_buffer, stream->av_frame->sample_rate, (const uint8_t **)stream->av_frame->extended_data, stream->av_frame->nb_samples)),
         "Couldn't convert audio frame.\n"
     );
+    stream->nb_samples = response;
     ffmpeg_call((
-        stream->allocated_block_size = av_get_bytes_per_sample(AV_SAMPLE_FMT_FLT) * stream->av_frame->channels * response
+        stream->allocated_block_size = av_get_bytes_per_sample(AV_SAMPLE_FMT_S16) * stream->av_frame->channels * response
     ));
 
     return true;
 }
 
-bool data_stream_get_sw_data_video(CDataStream** stream_ptr)
+// Encodes the frame into block-compressed texture, YUV 4:2:0 frames of the output size are not scaled
+static bool data_stream_get_sw_data_texture(CDataStream* stream)
 {
-    CDataStream* stream = *stream_ptr;
+    AVFrame* av_frame = stream->av_frame;
+    enum AVPixelFormat source_pix_fmt = (enum AVPixelFormat)av_frame->format;
+    enum AVColorSpace colorspace = av_frame->colorspace;
+    enum AVColorRange color_range = source_pix_fmt == AV_PIX_FMT_YUVJ420P ? AVCOL_RANGE_JPEG : av_frame->color_range;
+    uint8_t* planes[3];
+    int linesize[3];
+
+    if (stream->frame_cache && stream->frame_cache->is_writer)
+        frame_cache_abort(&stream->frame_cache);
 
-    if (!stream->sws_scaler_ctx || stream->vneed_rescaler_update)
+    size_t texture_size = texture_format_get_size(stream->texture_format, stream->swidth, stream->sheight);
+    if (!stream->block_buffer || stream->block_buffer_borrowed || stream->block_buffer_capacity < texture_size)
+    {
+        data_stream_free_block_buffer(stream);
+        ffmpeg_call_m((void*)(
+            stream->block_buffer = (uint8_t*)allocator_aligned_malloc(texture_size, ALLOCATOR_DEFAULT_ALIGNMENT)),
+            "Couldn't allocate texture buffer\n"
+        );
+        stream->block_buffer_capacity = texture_size;
+        memory_budget_acquire(MEMORY_CATEGORY_CONVERTED_FRAMES, stream->block_buffer_capacity);
+    }
+    stream->allocated_block_size = (int32_t)texture_size;
+    stream->vneed_rescaler_update = false;
+
+    if ((source_pix_fmt == AV_PIX_FMT_YUV420P || source_pix_fmt == AV_PIX_FMT_YUVJ420P) &&
+        av_frame->width == stream->swidth && av_frame->height == stream->sheight)
+    {
+        for (int32_t i = 0; i < 3; i++)
+        {
+            planes[i] = av_frame->data[i];
+            linesize[i] = av_frame->linesize[i];
+        }
+    }
+    else
     {
-        if (stream->vneed_rescaler_update && stream->sws_scaler_ctx)
-            sws_freeContext(stream->sws_scaler_ctx);
+        int source_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P, stream->swidth, stream->sheight, 1);
+        ffmpeg_call(source_size);
 
-        enum AVPixelFormat source_pix_fmt = correct_for_deprecated_pixel_format((enum AVPixelFormat)stream->av_frame->format);
-        //Send here frame params
-        //BEST QUALITY/PERFOMANCE: SWS_BICUBLIN, SWS_AREA
         ffmpeg_call((void*)(
-        stream->sws_scaler_ctx = sws_getContext(stream->fwidth, stream->fheight, source_pix_fmt,
-                                                stream->swidth, stream->sheight, stream->av_output_pix_fmt,
-                                                stream->av_output_flags, NULL, NULL, NULL)
+        stream->sws_scaler_ctx = data_stream_get_scaler(stream, stream->fwidth, stream->fheight, correct_for_deprecated_pixel_format(source_pix_fmt),
+                                                        stream->swidth, stream->sheight, AV_PIX_FMT_YUV420P)
         ));
 
-        if (stream->vneed_rescaler_update && stream->block_buffer)
-            av_free(stream->block_buffer);
+        if (stream->texture_source_capacity < (size_t)source_size)
+        {
+            memory_budget_release(MEMORY_CATEGORY_CONVERTED_FRAMES, stream->texture_source_capacity);
+            allocator_free(stream->texture_source_buffer);
+            ffmpeg_call_m((void*)(
+                stream->texture_source_buffer = (uint8_t*)allocator_aligned_malloc(source_size, ALLOCATOR_DEFAULT_ALIGNMENT)),
+                "Couldn't allocate texture source buffer\n"
+            );
+            stream->texture_source_capacity = source_size;
+            memory_budget_acquire(MEMORY_CATEGORY_CONVERTED_FRAMES, stream->texture_source_capacity);
+        }
 
-        stream->allocated_block_size = av_image_get_buffer_size(stream->av_output_pix_fmt, stream->swidth, stream->sheight, 1);
-        stream->block_buffer = (uint8_t *)av_malloc((stream->allocated_block_size) * sizeof(uint8_t));
-        stream->vneed_rescaler_update = false;
+        av_image_fill_arrays(stream->sc_frame->data, stream->sc_frame->linesize, stream->texture_source_buffer, AV_PIX_FMT_YUV420P, stream->swidth, stream->sheight, 1);
+        ffmpeg_call(
+            sws_scale(stream->sws_scaler_ctx, (const uint8_t* const*)av_frame->data, av_frame->linesize, 0, av_frame->height, stream->sc_frame->data, stream->sc_frame->linesize)
+        );
+
+        for (int32_t i = 0; i < 3; i++)
+        {
+            planes[i] = stream->sc_frame->data[i];
+            linesize[i] = stream->sc_frame->linesize[i];
+        }
+
+        // RGB sources are converted with the default BT.601 limited range matrix
+        if (colorspace == AVCOL_SPC_RGB)
+        {
+            colorspace = AVCOL_SPC_BT470BG;
+            color_range = AVCOL_RANGE_MPEG;
+        }
+    }
+
+    return texture_encode_yuv420p(stream->texture_format, planes, linesize, stream->swidth, stream->sheight, colorspace, color_range, stream->block_buffer);
+}
+
+// Repeated frame is skipped only while the destination still holds the previous conversion,
+// paths that drop or fail the conversion invalidate the recorded hash
+static bool data_stream_is_frame_unchanged(CDataStream* stream)
+{
+    uint64_t hash;
+    bool has_output = stream->block_buffer || stream->shared_ring || stream->atlas;
+
+    if (!frame_content_hash(stream->av_frame, &hash))
+    {
+        stream->stats.frames_unhashed++;
+        stream->last_frame_hash_valid = false;
+        return false;
+    }
+
+    bool unchanged = stream->last_frame_hash_valid && hash == stream->last_frame_hash && has_output && !stream->vneed_rescaler_update;
+    stream->last_frame_hash = hash;
+    stream->last_frame_hash_valid = true;
+    return unchanged;
+}
+
+bool data_stream_get_sw_data_video(CDataStream** stream_ptr)
+{
+    CDataStream* stream = *stream_ptr;
+
+    stream->frame_unchanged = stream->change_detection && data_stream_is_frame_unchanged(stream);
+    if (stream->frame_unchanged)
+    {
+        stream->stats.frames_unchanged++;
+        if (stream->frame_cache && stream->frame_cache->is_writer && stream->block_buffer)
+            data_stream_write_cached_frame(stream);
+        return true;
     }
 
+    // Geometry of the frame itself, adaptive streams change it without a new codec context
+    stream->fwidth = stream->av_frame->width;
+    stream->fheight = stream->av_frame->height;
+
+    if (stream->texture_format != TEXTURE_FORMAT_NONE)
+    {
+        if (data_stream_get_sw_data_texture(stream))
+            return true;
+        stream->last_frame_hash_valid = false;
+        return false;
+    }
+
+    // Ring slots have fixed geometry, the scaler must never write more than a slot holds
+    if (stream->shared_ring)
+    {
+        stream->swidth = stream->shared_ring->header->width;
+        stream->sheight = stream->shared_ring->header->height;
+        stream->av_output_pix_fmt = (enum AVPixelFormat)stream->shared_ring->header->pix_fmt;
+    }
+
+    // Same for atlas rectangles, a larger frame would overwrite it's neighbours
+    if (stream->atlas)
+    {
+        stream->swidth = stream->atlas->rects[stream->atlas_rect].width;
+        stream->sheight = stream->atlas->rects[stream->atlas_rect].height;
+        stream->av_output_pix_fmt = stream->atlas->pix_fmt;
+    }
+
+    //BEST QUALITY/PERFOMANCE: SWS_BICUBLIN, SWS_AREA
+    stream->sws_scaler_ctx = data_stream_get_scaler(stream, stream->fwidth, stream->fheight, 
+                                                    correct_for_deprecated_pixel_format((enum AVPixelFormat)stream->av_frame->format),
+                                                    stream->swidth, stream->sheight, stream->av_output_pix_fmt);
     if (!stream->sws_scaler_ctx)
     {
         printf("Couldn't create sws scaler\n");
+        stream->last_frame_hash_valid = false;
         return false;
     }
 
+    // Frames converted into shared memory or an atlas do not need a local buffer
+    if (!stream->shared_ring && !stream->atlas)
+    {
+        int required_size = av_image_get_buffer_size(stream->av_output_pix_fmt, stream->swidth, stream->sheight, 1);
+        ffmpeg_call(required_size);
+
+        // The buffer is kept while it is large enough, switching between sizes does not reallocate
+        if (!stream->block_buffer || stream->block_buffer_borrowed || stream->block_buffer_capacity < (size_t)required_size)
+        {
+            data_stream_free_block_buffer(stream);
+            ffmpeg_call_m((void*)(
+                stream->block_buffer = (uint8_t*)allocator_aligned_malloc(required_size, ALLOCATOR_DEFAULT_ALIGNMENT)),
+                "Couldn't allocate video buffer\n"
+            );
+            stream->block_buffer_capacity = required_size;
+            memory_budget_acquire(MEMORY_CATEGORY_CONVERTED_FRAMES, stream->block_buffer_capacity);
+        }
+        stream->allocated_block_size = required_size;
+    }
+    else if (stream->block_buffer)
+        data_stream_free_block_buffer(stream);
+    stream->vneed_rescaler_update = false;
+
+    if (stream->shared_ring)
+    {
+        int32_t slot;
+        uint8_t* slot_data[4];
+        int slot_linesize[4];
+
+        // Reader holds every slot, drop the frame instead of waiting. The reader never got it, so a repeat must be published
+        if (!shared_ring_begin_write(&stream->shared_ring, &slot, slot_data, slot_linesize))
+        {
+            stream->last_frame_hash_valid = false;
+            return true;
+        }
+
+        ffmpeg_call(
+            sws_scale(stream->sws_scaler_ctx, (const uint8_t* const*)stream->av_frame->data, stream->av_frame->linesize, 0, stream->av_frame->height, slot_data, slot_linesize)
+        );
+        shared_ring_end_write(&stream->shared_ring, slot, stream->pts);
+        return true;
+    }
+
+    if (stream->atlas)
+    {
+        uint8_t* rect_data[4];
+        int rect_linesize[4];
+
+        // Rectangle is being uploaded, drop the frame instead of waiting. A repeat must be written again
+        if (!frame_atlas_begin_write(&stream->atlas, stream->atlas_rect, rect_data, rect_linesize))
+        {
+            stream->last_frame_hash_valid = false;
+            return true;
+        }
+
+        ffmpeg_call(
+            sws_scale(stream->sws_scaler_ctx, (const uint8_t* const*)stream->av_frame->data, stream->av_frame->linesize, 0, stream->av_frame->height, rect_data, rect_linesize)
+        );
+        frame_atlas_end_write(&stream->atlas, stream->atlas_rect, stream->pts);
+        return true;
+    }
+
     av_image_fill_arrays(stream->sc_frame->data, stream->sc_frame->linesize, stream->block_buffer, stream->av_output_pix_fmt, stream->swidth, stream->sheight, 1);
     ffmpeg_call(
-        sws_scale(stream->sws_scaler_ctx, stream->av_frame->data, stream->av_frame->linesize, 0, stream->fheight, stream->sc_frame->data, stream->sc_frame->linesize)
+        sws_scale(stream->sws_scaler_ctx, (const uint8_t* const*)stream->av_frame->data, stream->av_frame->linesize, 0, stream->av_frame->height, stream->sc_frame->data, stream->sc_frame->linesize)
     );
+
+    if (stream->frame_cache && stream->frame_cache->is_writer)
+        data_stream_write_cached_frame(stream);
     return true;
 }
 
@@ -286,9 +1319,10 @@ double data_stream_get_pt_seconds(CDataStream** stream_ptr)
 void data_stream_set_hw_device_manuality(CDataStream** stream_ptr, const char* device_name)
 {
     CDataStream* stream = *stream_ptr;
-    size_t str_size = strlen(device_name) + 1;
-    stream->manuality_device_name = (char*)malloc(sizeof(char) * str_size);
-    strncpy(stream->manuality_device_name, device_name, str_size);
+    if(stream->manuality_device_name)
+        allocator_free(stream->manuality_device_name);
+
+    stream->manuality_device_name = allocator_strdup(device_name);
 }
 
 void data_stream_set_thread_settings(CDataStream** stream_ptr, int32_t thread_count, int32_t thread_type_flags)
@@ -298,11 +1332,189 @@ void data_stream_set_thread_settings(CDataStream** stream_ptr, int32_t thread_co
     stream->thread_type |= thread_type_flags;
 }
 
+void data_stream_set_playback_rate(CDataStream** stream_ptr, double rate)
+{
+    CDataStream* stream = *stream_ptr;
+
+    if (rate <= 0.0 || rate == stream->playback_rate)
+        return;
+
+    // Frames after the skipped ones reference missing frames until the next keyframe
+    if (stream->playback_rate >= DATA_STREAM_KEYFRAME_RATE && rate < DATA_STREAM_KEYFRAME_RATE)
+        stream->wait_for_keyframe = true;
+
+    stream->playback_rate = rate;
+    stream->tempo_update = stream->stream_type == AVMEDIA_TYPE_AUDIO;
+    if (stream->av_codec_ctx)
+        data_stream_apply_quality_level(stream);
+}
+
+void data_stream_set_min_frame_interval(CDataStream** stream_ptr, int64_t interval_us)
+{
+    CDataStream* stream = *stream_ptr;
+
+    stream->min_frame_interval_us = interval_us;
+    stream->last_output_pts = AV_NOPTS_VALUE;
+}
+
+bool data_stream_wants_packet(CDataStream** stream_ptr, const AVPacket* av_packet)
+{
+    CDataStream* stream = *stream_ptr;
+
+    if (stream->stream_type != AVMEDIA_TYPE_VIDEO || (stream->playback_rate < DATA_STREAM_KEYFRAME_RATE && !stream->wait_for_keyframe))
+        return true;
+
+    if (!(av_packet->flags & AV_PKT_FLAG_KEY))
+        return false;
+
+    stream->wait_for_keyframe = false;
+    return true;
+}
+
+void data_stream_set_change_detection(CDataStream** stream_ptr, bool enable)
+{
+    CDataStream* stream = *stream_ptr;
+
+    stream->change_detection = enable;
+    stream->last_frame_hash_valid = false;
+    stream->frame_unchanged = false;
+}
+
+void data_stream_set_wanted_stream(CDataStream** stream_ptr, int32_t stream_index)
+{
+    (*stream_ptr)->wanted_stream_index = stream_index;
+}
+
+void data_stream_set_adaptive_quality(CDataStream** stream_ptr, bool enable, int64_t frame_budget_us)
+{
+    CDataStream* stream = *stream_ptr;
+    stream->adaptive_quality = enable;
+    stream->quality_overruns = 0;
+    stream->quality_underruns = 0;
+
+    if(frame_budget_us > 0)
+        stream->frame_budget_us = frame_budget_us;
+
+    if(!enable && stream->stats.quality_level != DECODE_QUALITY_FULL)
+    {
+        stream->stats.quality_level = DECODE_QUALITY_FULL;
+        stream->stats.quality_level_changes++;
+        stream->quality_level_samples = 0;
+        if(stream->av_codec_ctx)
+            data_stream_apply_quality_level(stream);
+    }
+}
+
+void data_stream_set_time_base(CDataStream** stream_ptr, AVRational time_base)
+{
+    (*stream_ptr)->time_base = time_base;
+}
+
+void data_stream_set_bit_rate(CDataStream** stream_ptr, int64_t bit_rate)
+{
+    (*stream_ptr)->bit_rate = bit_rate;
+}
+
+void data_stream_set_encoder_preset(CDataStream** stream_ptr, const char* preset)
+{
+    (*stream_ptr)->encoder_preset = preset;
+}
+
+void data_stream_set_fragmented_output(CDataStream** stream_ptr, int64_t fragment_duration_us)
+{
+    (*stream_ptr)->fragment_duration_us = fragment_duration_us;
+}
+
+void data_stream_get_stats(CDataStream** stream_ptr, CDataStreamStats* stats)
+{
+    *stats = (*stream_ptr)->stats;
+}
+
+void data_stream_set_atlas(CDataStream** stream_ptr, CFrameAtlas* atlas, int32_t rect)
+{
+    CDataStream* stream = *stream_ptr;
+
+    stream->atlas = atlas;
+    stream->atlas_rect = atlas ? rect : -1;
+    if (atlas)
+    {
+        stream->swidth = atlas->rects[rect].width;
+        stream->sheight = atlas->rects[rect].height;
+        stream->av_output_pix_fmt = atlas->pix_fmt;
+    }
+    stream->vneed_rescaler_update = true;
+}
+
+void data_stream_set_texture_format(CDataStream** stream_ptr, enum ETextureFormat format)
+{
+    CDataStream* stream = *stream_ptr;
+
+    if (stream->texture_format != format)
+    {
+        stream->texture_format = format;
+        stream->vneed_rescaler_update = true;
+    }
+}
+
+void data_stream_set_frame_cache(CDataStream** stream_ptr, CFrameCache* cache)
+{
+    (*stream_ptr)->frame_cache = cache;
+}
+
+int data_stream_read_cached_frame(CDataStream** stream_ptr)
+{
+    CDataStream* stream = *stream_ptr;
+    const uint8_t* data;
+    int64_t pts;
+
+    if (!frame_cache_is_readable(&stream->frame_cache))
+        return AVERROR(EINVAL);
+
+    if (!(data = frame_cache_read_frame(&stream->frame_cache, &pts)))
+    {
+        stream->end_of_stream = true;
+        return AVERROR_EOF;
+    }
+
+    // Conversion is not needed anymore, frames point into the cache
+    if (!stream->block_buffer_borrowed)
+    {
+        data_stream_free_block_buffer(stream);
+        data_stream_free_scalers(stream);
+    }
+
+    stream->block_buffer = (uint8_t*)data;
+    stream->block_buffer_borrowed = true;
+    stream->allocated_block_size = stream->frame_cache->header.frame_size;
+    stream->pts = pts + stream->pts_offset;
+    return 0;
+}
+
+void data_stream_set_shared_ring(CDataStream** stream_ptr, CSharedFrameRing* ring)
+{
+    CDataStream* stream = *stream_ptr;
+
+    stream->shared_ring = ring;
+    if (ring)
+    {
+        stream->swidth = ring->header->width;
+        stream->sheight = ring->header->height;
+        stream->av_output_pix_fmt = (enum AVPixelFormat)ring->header->pix_fmt;
+    }
+    stream->vneed_rescaler_update = true;
+}
+
 void data_stream_set_frame_size(CDataStream** stream_ptr, int32_t nwidth, int32_t nheight)
 {
     CDataStream* stream = *stream_ptr;
 
-    if(nwidth != stream->swidth && nheight != stream->sheight)
+    if(stream->shared_ring || stream->atlas)
+    {
+        fprintf(stderr, "Frame size is set by the shared ring or atlas\n");
+        return;
+    }
+
+    if(nwidth != stream->swidth || nheight != stream->sheight)
     {
         stream->swidth = nwidth;
         stream->sheight = nheight;
@@ -315,14 +1527,22 @@ void data_stream_close(CDataStream** stream_ptr)
     CDataStream* stream = *stream_ptr;
 
     if(stream->manuality_device_name)
-        free((void*)stream->manuality_device_name);
+        allocator_free((void*)stream->manuality_device_name);
+
+    if(stream->file_writer)
+        fclose(stream->file_writer);
+    data_stream_close_fragmented_output(stream);
 
     hw_close(&stream->hwdecoder);
-    av_free(stream->block_buffer);
+    data_stream_free_block_buffer(stream);
     avcodec_free_context(&stream->av_codec_ctx);
+    frame_pool_close(&stream->frame_pool);
     av_frame_free(&stream->av_frame);
     av_frame_free(&stream->sc_frame);
-    sws_freeContext(stream->sws_scaler_ctx);
+    memory_budget_release(MEMORY_CATEGORY_CONVERTED_FRAMES, stream->texture_source_capacity);
+    allocator_free(stream->texture_source_buffer);
+    data_stream_free_scalers(stream);
     swr_free(&stream->swr_ctx);
-    free(stream);
+    data_stream_free_tempo_graph(stream);
+    allocator_free(stream);
 }
\ No newline at end of file
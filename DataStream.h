@@ -2,9 +2,103 @@
 #define AV_DATASTREAM
 
 #include "HWAccelerator.h"
+#include "MemoryBudget.h"
+#include "FramePool.h"
+#include "SharedFrameRing.h"
+#include "FrameAtlas.h"
+#include "FrameCache.h"
+#include "TextureEncoder.h"
+#include "AsyncWriter.h"
+#include "Waveform.h"
 
 typedef bool (*data_stream_get_sw_data_t)(struct CDataStream**);
 
+/**
+ * Returned by data_stream_receive_frame for a frame that was decoded but not converted, 
+ * because fast playback shows fewer frames than the source has.
+ */
+#define DATA_STREAM_FRAME_DROPPED 1
+
+/**
+ * Number of scaler contexts kept per stream, e.g. for switching between a few ABR renditions or window sizes.
+ */
+#define DATA_STREAM_SCALER_CACHE_SIZE 4
+
+/**
+ * Scaler context for one combination of source and output geometry.
+ */
+typedef struct CScalerCacheEntry
+{
+    struct SwsContext*      sws_ctx;
+    int32_t                 src_width, src_height;
+    enum AVPixelFormat      src_pix_fmt;
+    int32_t                 dst_width, dst_height;
+    enum AVPixelFormat      dst_pix_fmt;
+    int                     flags;
+    uint64_t                last_used;
+} CScalerCacheEntry;
+
+/**
+ * Playback rates above which video decoding skips non-reference frames and from which 
+ * only keyframes are decoded.
+ */
+#define DATA_STREAM_NONREF_RATE 2.0
+#define DATA_STREAM_KEYFRAME_RATE 4.0
+
+/**
+ * Decode quality levels used by the adaptive quality policy.
+ * 
+ * Every next level discards more work in the decoder: first the loop filter 
+ * of non-reference frames, then the whole loop filter, then IDCT of non-reference 
+ * frames and finally the non-reference frames themselves.
+ */
+enum EDecodeQuality
+{
+    DECODE_QUALITY_FULL = 0,
+    DECODE_QUALITY_SKIP_NONREF_LOOP_FILTER,
+    DECODE_QUALITY_SKIP_LOOP_FILTER,
+    DECODE_QUALITY_SKIP_NONREF_IDCT,
+    DECODE_QUALITY_SKIP_NONREF_FRAMES,
+    DECODE_QUALITY_COUNT
+};
+
+/**
+ * Decoding statistics of a single data stream.
+ */
+typedef struct CDataStreamStats
+{
+    int64_t                 frames_decoded;
+
+    /**
+     * Decoder time of the last frame and it's exponential moving average, in microseconds.
+     * Only sending packets and receiving the frame is measured, conversion is excluded.
+     */
+    int64_t                 last_decode_time_us;
+    double                  average_decode_time_us;
+
+    /**
+     * Current decode quality level and how many times it was changed.
+     */
+    enum EDecodeQuality     quality_level;
+    int32_t                 quality_level_changes;
+
+    /**
+     * Frames identical to the previous one, their conversion was skipped. 
+     * Skip rate is frames_unchanged / frames_decoded.
+     */
+    int64_t                 frames_unchanged;
+
+    /**
+     * Frames change detection couldn't hash, e.g. frames left in GPU memory. They are always converted.
+     */
+    int64_t                 frames_unhashed;
+
+    /**
+     * Frames decoded during fast playback but not converted.
+     */
+    int64_t                 frames_dropped;
+} CDataStreamStats;
+
 /**
  * The main structure in the presented api.
  * 
@@ -34,13 +128,14 @@ typedef struct CDataStream
     enum AVMediaType        stream_type;
 
     /**
-     * Source frame size and converted frame size.
+     * Source frame size and converted frame size. Source size is taken from codec parameters 
+     * and updated from every decoded frame.
      */
     int32_t                 fwidth, fheight, swidth, sheight;
 
     /**
-     * Is there a need to update the scaler. 
-     * It is necessary if the data on the output size has been changed during decoding.
+     * Whether the output size or destination has been changed during decoding, 
+     * the output buffer is checked before the next conversion.
      */
     bool                    vneed_rescaler_update;
 
@@ -55,27 +150,78 @@ typedef struct CDataStream
      */
     AVRational              time_base;
 
+    /**
+     * Target bit rate of the encoder, 0 to use the codec default.
+     */
+    int64_t                 bit_rate;
+
+    /**
+     * H.264 encoder preset, NULL uses "slow".
+     */
+    const char*             encoder_preset;
+
     /**
      * The size of the allocated memory block for a frame, taking into account alignment.
      */
     int32_t                 allocated_block_size;
 
+    /**
+     * The real size of memory allocated for block_buffer. Accounted in the memory budget.
+     */
+    size_t                  block_buffer_capacity;
+
     /**
      * Buffer containing the aligned frame data.
      */
     uint8_t*                block_buffer;
 
+    /**
+     * Whether block_buffer points into memory owned by the frame cache.
+     */
+    bool                    block_buffer_borrowed;
+
+    /**
+     * Number of audio samples per channel in block_buffer.
+     */
+    int32_t                 nb_samples;
+
     int64_t                 pts;
 
+    /**
+     * Looped playback. Offset added to timestamps of packets sent to the decoder, 
+     * range of raw timestamps of one iteration and the last packet kept for replay.
+     */
+    int64_t                 pts_offset;
+    int64_t                 loop_first_pts, loop_end_pts;
+    int64_t                 loop_cached_dts;
+
     int32_t                 data_stream_index;
 
+    /**
+     * Container stream chosen by data_stream_set_wanted_stream, -1 picks the best stream of the type.
+     */
+    int32_t                 wanted_stream_index;
+
     AVPacket*               av_first_pkt;
 
     AVCodecContext*         av_codec_ctx;
 
+    /**
+     * Pool of decoded video surfaces allocated through the library allocator.
+     */
+    CFramePool*             frame_pool;
+
     enum AVPixelFormat      av_output_pix_fmt;
     int                     av_output_flags;
 
+    /**
+     * Block-compressed format of converted video frames, TEXTURE_FORMAT_NONE keeps av_output_pix_fmt. 
+     * Frames that need scaling are scaled to YUV 4:2:0 into texture_source_buffer first.
+     */
+    enum ETextureFormat     texture_format;
+    uint8_t*                texture_source_buffer;
+    size_t                  texture_source_capacity;
+
     /**
      * This structure describes decoded (raw) audio or video data.
      */
@@ -86,9 +232,34 @@ typedef struct CDataStream
      */
     AVFrame*                sc_frame;
 
+    /**
+     * Scaler of the current frame, owned by scaler_cache. Contexts are looked up by the geometry 
+     * of every frame, so resolution changes inside the stream reuse them.
+     */
     struct SwsContext*      sws_scaler_ctx;
+    CScalerCacheEntry       scaler_cache[DATA_STREAM_SCALER_CACHE_SIZE];
+    uint64_t                scaler_cache_clock;
     struct SwrContext*      swr_ctx;
 
+    /**
+     * Playback rate. Audio goes through the atempo filter graph instead of swr_ctx, 
+     * video waits for a keyframe after keyframe-only playback.
+     */
+    double                  playback_rate;
+    struct AVFilterGraph*   tempo_graph;
+    struct AVFilterContext* tempo_source;
+    struct AVFilterContext* tempo_sink;
+    AVFrame*                tempo_frame;
+    bool                    tempo_update;
+    bool                    wait_for_keyframe;
+
+    /**
+     * Video frames closer than this to the last converted frame are not converted, 
+     * last_output_pts is the timestamp of that frame.
+     */
+    int64_t                 min_frame_interval_us;
+    int64_t                 last_output_pts;
+
     /**
      * Contains pointer to rescaler.
      */
@@ -96,6 +267,74 @@ typedef struct CDataStream
 
     FILE* file_writer;
 
+    /**
+     * Fragmented MP4 output used instead of file_writer when fragment_duration_us is set.
+     * Muxed data goes through async_writer, so a player can follow the file while it is written.
+     */
+    int64_t                 fragment_duration_us;
+    AVFormatContext*        av_output_format_ctx;
+    CAsyncWriter*           async_writer;
+
+    /**
+     * Optional frame sink. Converted video frames are written straight into ring slots instead of block_buffer.
+     */
+    CSharedFrameRing*       shared_ring;
+
+    /**
+     * Optional frame sink. Converted video frames are written into rectangle atlas_rect of the atlas instead of block_buffer.
+     */
+    CFrameAtlas*            atlas;
+    int32_t                 atlas_rect;
+
+    /**
+     * Optional cache of converted video frames. Filled while decoding, 
+     * once finished frames are read from it instead of decoding.
+     */
+    CFrameCache*            frame_cache;
+
+    /**
+     * Change detection. Hash of the last converted frame and whether the current frame 
+     * repeated it, so the converted data was left as it was and does not need another upload.
+     */
+    bool                    change_detection;
+    bool                    last_frame_hash_valid;
+    uint64_t                last_frame_hash;
+    bool                    frame_unchanged;
+
+    /**
+     * Whether decode quality is lowered when decoding does not fit into the frame budget.
+     */
+    bool                    adaptive_quality;
+
+    /**
+     * Time available for a single frame in microseconds. 
+     * Taken from the stream frame rate if not set explicitly.
+     */
+    int64_t                 frame_budget_us;
+
+    /**
+     * Decoder state. The decoder may have frames to receive, or was fully drained.
+     */
+    bool                    frames_pending;
+    bool                    end_of_stream;
+
+    /**
+     * Time spent in the decoder since the last measured frame.
+     */
+    int64_t                 pending_decode_time_us;
+
+    /**
+     * Hysteresis counters of the adaptive quality policy.
+     */
+    int32_t                 quality_overruns, quality_underruns;
+
+    /**
+     * Frames measured at the current quality level, the average is seeded again from them after every level change.
+     */
+    int32_t                 quality_level_samples;
+
+    CDataStreamStats        stats;
+
 }CDataStream;
 
 /**
@@ -135,6 +374,20 @@ bool data_stream_initialize_decode(CDataStream** stream_ptr, AVFormatContext* av
  */
 bool data_stream_initialize_encode(CDataStream** stream_ptr, const char* filename, enum AVCodecID id, enum AVMediaType stream_type, bool allow_hardware);
 
+/**
+ * Encodes a single frame and writes produced packets to the output file.
+ * 
+ * Video frames must have the size set with data_stream_set_frame_size and av_output_pix_fmt 
+ * pixel format, timestamps are in time_base units.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param av_frame Raw frame or NULL to flush the encoder.
+ *
+ * @return Returns 0 on success or negative AVERROR code.
+ */
+int data_stream_encode(CDataStream** stream_ptr, AVFrame* av_frame);
+
 /**
  * Sends data to a decoder for further decoding in order to obtain an image.
  *
@@ -148,6 +401,82 @@ bool data_stream_initialize_encode(CDataStream** stream_ptr, const char* filenam
  */
 int data_stream_decode(CDataStream** stream_ptr, AVFormatContext* av_format_ctx, AVPacket* av_packet);
 
+/**
+ * Decodes the whole audio stream into a peak pyramid, frames are reduced without resampling.
+ *
+ * Packets of every other stream are discarded by the demuxer. The format context is read
+ * from the start to the end and seeked back to the start, other decoders of the same 
+ * context must be flushed afterwards. Every file has it's own context, so waveforms
+ * of many files can be built on parallel threads.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure initialized for audio decoding.
+ *
+ * @param av_format_ctx Format context the stream was initialized with.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure receiving the peaks.
+ *
+ * @param samples_per_bucket Samples per bucket of the finest level.
+ *
+ * @return Returns true if the waveform was built.
+ */
+bool data_stream_build_waveform(CDataStream** stream_ptr, AVFormatContext* av_format_ctx, CWaveform** waveform_ptr, int32_t samples_per_bucket);
+
+/**
+ * Sends a single packet to the decoder without receiving frames.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param av_packet Compressed data or NULL to start draining the decoder.
+ *
+ * @return Returns 0 on success, AVERROR(EAGAIN) if frames must be received first, or negative AVERROR code.
+ */
+int data_stream_send_packet(CDataStream** stream_ptr, AVPacket* av_packet);
+
+/**
+ * Receives and converts a single frame from the decoder.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @return Returns 0 if the frame was written to the output, DATA_STREAM_FRAME_DROPPED if it was skipped, 
+ * AVERROR(EAGAIN) if the decoder needs more packets, AVERROR_EOF if the decoder is drained, or negative AVERROR code.
+ */
+int data_stream_receive_frame(CDataStream** stream_ptr);
+
+/**
+ * Receives a single decoded frame without converting it. Hardware frames are downloaded to system memory.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param av_frame Frame that receives decoded data, owned by the caller.
+ *
+ * @return Returns 0 on success, AVERROR(EAGAIN) if the decoder needs more packets, 
+ * AVERROR_EOF if the decoder is drained, or negative AVERROR code.
+ */
+int data_stream_receive_raw_frame(CDataStream** stream_ptr, AVFrame* av_frame);
+
+/**
+ * Converts a frame previously received with data_stream_receive_raw_frame into the stream output.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param av_frame Decoded frame.
+ *
+ * @return Returns true if the frame was converted.
+ */
+bool data_stream_convert_frame(CDataStream** stream_ptr, AVFrame* av_frame);
+
+/**
+ * Takes over the scaler or resampler and the output buffer of another stream if formats match.
+ * Lets a stream opened for the next file skip converter initialization.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure that receives converters.
+ *
+ * @param source_ptr Pointer to pointer to CDataStream structure that gives them away.
+ *
+ * @return Returns true if anything was taken over.
+ */
+bool data_stream_adopt_converters(CDataStream** stream_ptr, CDataStream** source_ptr);
+
 /**
  * Method to get the number of seconds from the first decoded or encoded frame.
  *
@@ -162,11 +491,195 @@ void data_stream_set_hw_device_manuality(CDataStream** stream_ptr, const char* d
 void data_stream_set_thread_settings(CDataStream** stream_ptr, int32_t thread_count, int32_t thread_type_flags);
 
 /**
- * Initialize an CHardwareAccelerator as encoder.
+ * Enables detection of repeated video frames.
+ * 
+ * Decoded frames are hashed, a frame equal to the previous one is not converted again and 
+ * frame_unchanged is set, the converted data of the previous frame stays valid. 
+ * Frames written into a shared ring are not published again, atlas rectangles stay clean.
  *
- * @param stream_ptr
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
  *
- * @return Returns true if all initialization got well.
+ * @param enable Whether to detect repeated frames.
+ */
+void data_stream_set_change_detection(CDataStream** stream_ptr, bool enable);
+
+/**
+ * Sets playback rate of the stream.
+ * 
+ * Audio is time-stretched with preserved pitch. Video decoding skips non-reference frames 
+ * above DATA_STREAM_NONREF_RATE and decodes keyframes only from DATA_STREAM_KEYFRAME_RATE. 
+ * Timestamps stay in the source timeline, the player clock advances rate times faster.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param rate Playback rate, 1.0 is normal speed.
+ */
+void data_stream_set_playback_rate(CDataStream** stream_ptr, double rate);
+
+/**
+ * Sets the shortest source time between converted video frames. Frames closer to the previous 
+ * converted frame are decoded for reference but not converted.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param interval_us Interval in microseconds, 0 converts every frame.
+ */
+void data_stream_set_min_frame_interval(CDataStream** stream_ptr, int64_t interval_us);
+
+/**
+ * Whether the video packet should be decoded at the current playback rate.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param av_packet Packet of the stream.
+ *
+ * @return Returns false for packets skipped by keyframe-only playback.
+ */
+bool data_stream_wants_packet(CDataStream** stream_ptr, const AVPacket* av_packet);
+
+/**
+ * Chooses container stream decoded by data_stream_initialize_decode.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param stream_index Index of the stream in the container, -1 picks the best stream of the type.
+ */
+void data_stream_set_wanted_stream(CDataStream** stream_ptr, int32_t stream_index);
+
+/**
+ * Enables or disables adaptive decode quality.
+ * 
+ * When the average decode time exceeds the frame budget, the decoder steps down 
+ * through EDecodeQuality levels, and steps back up once it has enough headroom.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param enable Enable adaptive quality.
+ *
+ * @param frame_budget_us Time available for decoding one frame, 0 to use the stream frame rate.
+ */
+void data_stream_set_adaptive_quality(CDataStream** stream_ptr, bool enable, int64_t frame_budget_us);
+
+/**
+ * Sets time base of encoder timestamps. Must be called before data_stream_initialize_encode.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param time_base Time base, 1/25 is used if not set.
+ */
+void data_stream_set_time_base(CDataStream** stream_ptr, AVRational time_base);
+
+/**
+ * Sets target bit rate of encoder. Must be called before data_stream_initialize_encode.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param bit_rate Bit rate in bits per second, 0 to use the codec default.
+ */
+void data_stream_set_bit_rate(CDataStream** stream_ptr, int64_t bit_rate);
+
+/**
+ * Sets H.264 encoder preset. Must be called before data_stream_initialize_encode.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param preset Preset name such as "veryfast", the string must outlive the stream. NULL to use "slow".
+ */
+void data_stream_set_encoder_preset(CDataStream** stream_ptr, const char* preset);
+
+/**
+ * Writes encoded packets as fragmented MP4 instead of raw codec output. Must be called before data_stream_initialize_encode.
+ *
+ * A fragment is closed at every keyframe and once it is fragment_duration_us long,
+ * the file is playable up to the last closed fragment while encoding goes on.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param fragment_duration_us Longest fragment in microseconds, 0 to write raw codec output.
+ */
+void data_stream_set_fragmented_output(CDataStream** stream_ptr, int64_t fragment_duration_us);
+
+/**
+ * Copies decoding statistics of the stream.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param stats Pointer to structure that receives the statistics.
+ */
+void data_stream_get_stats(CDataStream** stream_ptr, CDataStreamStats* stats);
+
+/**
+ * Sets block-compressed texture format of converted video frames.
+ * 
+ * Frames are encoded from YUV 4:2:0 planes into block_buffer, allocated_block_size 
+ * is the size of the whole texture. Decoded YUV 4:2:0 frames of the output size are 
+ * encoded without scaling. Textures are not written into shared ring or frame cache.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param format Texture format or TEXTURE_FORMAT_NONE to convert into av_output_pix_fmt again.
+ */
+void data_stream_set_texture_format(CDataStream** stream_ptr, enum ETextureFormat format);
+
+/**
+ * Sets cache of converted video frames.
+ * 
+ * A cache opened as writer is filled with every converted frame and finished when the 
+ * decoder is drained. Writing is aborted if frames are decoded at reduced quality or 
+ * the output format changes. Frames of a readable cache are taken with 
+ * data_stream_read_cached_frame. The stream does not take ownership of the cache.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param cache Cache opened with frame_cache_open for the stream output format, or NULL.
+ */
+void data_stream_set_frame_cache(CDataStream** stream_ptr, CFrameCache* cache);
+
+/**
+ * Takes the next frame from a readable frame cache without decoding.
+ * 
+ * block_buffer points to the frame data until the next frame, pts is set like for decoded frames.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @return Returns 0 on success, AVERROR_EOF after the last frame.
+ */
+int data_stream_read_cached_frame(CDataStream** stream_ptr);
+
+/**
+ * Sets shared memory ring as destination of converted video frames.
+ * 
+ * The output size and pixel format are taken from the ring. The stream 
+ * does not take ownership of the ring.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param ring Ring created with shared_ring_create or NULL to write into block_buffer again.
+ */
+void data_stream_set_shared_ring(CDataStream** stream_ptr, CSharedFrameRing* ring);
+
+/**
+ * Sets rectangle of frame atlas as destination of converted video frames.
+ * 
+ * The output size is taken from the rectangle and the pixel format from the atlas. 
+ * The stream does not take ownership of the atlas or the rectangle.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param atlas Atlas created with frame_atlas_create or NULL to write into block_buffer again.
+ *
+ * @param rect Rectangle returned by frame_atlas_add_rect.
+ */
+void data_stream_set_atlas(CDataStream** stream_ptr, CFrameAtlas* atlas, int32_t rect);
+
+/**
+ * Sets size of converted frames. Ignored while a shared ring or an atlas is attached, its slots or rectangle set the size.
+ *
+ * @param stream_ptr Pointer to pointer to CDataStream structure.
+ *
+ * @param nwidth Width of converted frames.
+ *
+ * @param nheight Height of converted frames.
  */
 void data_stream_set_frame_size(CDataStream** stream_ptr, int32_t nwidth, int32_t nheight);
 
@@ -0,0 +1,334 @@
+#include "FrameAtlas.h"
+#include "Allocator.h"
+#include "MemoryBudget.h"
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FRAME_ATLAS_ROW_ALIGNMENT 64
+
+// Free rectangles at the end of the shelf give their area back to it
+static void frame_atlas_trim_shelf(CFrameAtlas* atlas, CAtlasShelf* shelf)
+{
+    bool trimmed = true;
+
+    while (trimmed)
+    {
+        trimmed = false;
+        for (int32_t i = 0; i < atlas->rect_count; i++)
+        {
+            CAtlasRect* rect = &atlas->rects[i];
+            if (rect->in_use || !rect->capacity_width || rect->y != shelf->y || rect->x + rect->capacity_width != shelf->used_width)
+                continue;
+
+            shelf->used_width = rect->x;
+            rect->capacity_width = 0;
+            rect->capacity_height = 0;
+            trimmed = true;
+        }
+    }
+
+    while (atlas->shelf_count > 0 && atlas->shelves[atlas->shelf_count - 1].used_width == 0)
+        atlas->shelf_count--;
+}
+
+static int32_t frame_atlas_find_free_slot(CFrameAtlas* atlas)
+{
+    for (int32_t i = 0; i < atlas->rect_count; i++)
+    {
+        if (!atlas->rects[i].in_use && !atlas->rects[i].capacity_width)
+            return i;
+    }
+    return atlas->rect_count < atlas->max_rects ? atlas->rect_count++ : -1;
+}
+
+static CAtlasShelf* frame_atlas_find_shelf(CFrameAtlas* atlas, int32_t width, int32_t height)
+{
+    CAtlasShelf* best = NULL;
+
+    for (int32_t i = 0; i < atlas->shelf_count; i++)
+    {
+        CAtlasShelf* shelf = &atlas->shelves[i];
+        if (shelf->height >= height && atlas->width - shelf->used_width >= width && (!best || shelf->height < best->height))
+            best = shelf;
+    }
+
+    int32_t next_y = atlas->shelf_count ? atlas->shelves[atlas->shelf_count - 1].y + atlas->shelves[atlas->shelf_count - 1].height : 0;
+    bool can_open = next_y + height <= atlas->height && atlas->shelf_count < atlas->max_shelves;
+
+    // Small rectangles in a much taller shelf waste its height, prefer a new shelf
+    if (can_open && (!best || best->height > height * 2))
+    {
+        best = &atlas->shelves[atlas->shelf_count++];
+        best->y = next_y;
+        best->height = height;
+        best->used_width = 0;
+    }
+
+    return best;
+}
+
+CFrameAtlas* frame_atlas_alloc()
+{
+    CFrameAtlas* atlas = NULL;
+    atlas = (CFrameAtlas*)allocator_malloc(sizeof(CFrameAtlas));
+
+    atlas->buffer = NULL;
+    atlas->buffer_size = 0;
+    for (int32_t i = 0; i < 4; i++)
+    {
+        atlas->data[i] = NULL;
+        atlas->linesize[i] = 0;
+    }
+    atlas->width = 0;
+    atlas->height = 0;
+    atlas->pix_fmt = AV_PIX_FMT_NONE;
+    atlas->chroma_shift_h = 0;
+    atlas->rects = NULL;
+    atlas->max_rects = 0;
+    atlas->rect_count = 0;
+    atlas->shelves = NULL;
+    atlas->shelf_count = 0;
+    atlas->max_shelves = 0;
+    mutex_init(&atlas->mutex);
+    atomic_init(&atlas->sequence, 0);
+
+    return atlas;
+}
+
+bool frame_atlas_create(CFrameAtlas** atlas_ptr, int32_t width, int32_t height, enum AVPixelFormat pix_fmt, int32_t max_rects)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pix_fmt);
+
+    if (!desc || width <= 0 || height <= 0 || max_rects <= 0)
+    {
+        fprintf(stderr, "Invalid frame atlas parameters.\n");
+        return false;
+    }
+
+    if (av_image_fill_linesizes(atlas->linesize, pix_fmt, width) < 0)
+    {
+        fprintf(stderr, "Unsupported frame atlas pixel format.\n");
+        return false;
+    }
+
+    for (int32_t i = 0; i < 4; i++)
+        atlas->linesize[i] = FFALIGN(atlas->linesize[i], FRAME_ATLAS_ROW_ALIGNMENT);
+
+    int size = av_image_fill_pointers(atlas->data, pix_fmt, height, NULL, atlas->linesize);
+    if (size < 0)
+        return false;
+
+    atlas->buffer = (uint8_t*)allocator_aligned_malloc(size, ALLOCATOR_DEFAULT_ALIGNMENT);
+    if (!atlas->buffer)
+    {
+        fprintf(stderr, "Couldn't allocate frame atlas.\n");
+        return false;
+    }
+    memset(atlas->buffer, 0, size);
+    av_image_fill_pointers(atlas->data, pix_fmt, height, atlas->buffer, atlas->linesize);
+
+    atlas->buffer_size = size;
+    memory_budget_acquire(MEMORY_CATEGORY_CONVERTED_FRAMES, atlas->buffer_size);
+
+    atlas->width = width;
+    atlas->height = height;
+    atlas->pix_fmt = pix_fmt;
+    atlas->chroma_shift_h = desc->log2_chroma_h;
+
+    atlas->max_rects = max_rects;
+    atlas->rects = (CAtlasRect*)allocator_malloc(sizeof(CAtlasRect) * max_rects);
+    for (int32_t i = 0; i < max_rects; i++)
+    {
+        CAtlasRect* rect = &atlas->rects[i];
+        rect->x = rect->y = 0;
+        rect->width = rect->height = 0;
+        rect->capacity_width = rect->capacity_height = 0;
+        rect->in_use = false;
+        atomic_init(&rect->state, ATLAS_RECT_CLEAN);
+        rect->pts = AV_NOPTS_VALUE;
+        rect->sequence = 0;
+    }
+
+    atlas->max_shelves = height / FRAME_ATLAS_ALIGNMENT + 1;
+    atlas->shelves = (CAtlasShelf*)allocator_malloc(sizeof(CAtlasShelf) * atlas->max_shelves);
+    return true;
+}
+
+int32_t frame_atlas_add_rect(CFrameAtlas** atlas_ptr, int32_t width, int32_t height)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+    int32_t aligned_width = FFALIGN(width, FRAME_ATLAS_ALIGNMENT);
+    int32_t aligned_height = FFALIGN(height, FRAME_ATLAS_ALIGNMENT);
+    int32_t index = -1;
+
+    if (width <= 0 || height <= 0)
+        return -1;
+
+    mutex_lock(&atlas->mutex);
+
+    // Best fitting area left by a removed rectangle
+    int64_t best_area = INT64_MAX;
+    for (int32_t i = 0; i < atlas->rect_count; i++)
+    {
+        CAtlasRect* rect = &atlas->rects[i];
+        int64_t area = (int64_t)rect->capacity_width * rect->capacity_height;
+
+        if (!rect->in_use && rect->capacity_width >= aligned_width && rect->capacity_height >= aligned_height && area < best_area)
+        {
+            index = i;
+            best_area = area;
+        }
+    }
+
+    if (index < 0)
+    {
+        CAtlasShelf* shelf = NULL;
+        index = frame_atlas_find_free_slot(atlas);
+
+        if (index >= 0 && !(shelf = frame_atlas_find_shelf(atlas, aligned_width, aligned_height)))
+        {
+            if (index == atlas->rect_count - 1)
+                atlas->rect_count--;
+            index = -1;
+        }
+
+        if (shelf)
+        {
+            CAtlasRect* rect = &atlas->rects[index];
+            rect->x = shelf->used_width;
+            rect->y = shelf->y;
+            rect->capacity_width = aligned_width;
+            rect->capacity_height = shelf->height;
+            shelf->used_width += aligned_width;
+        }
+    }
+
+    if (index >= 0)
+    {
+        CAtlasRect* rect = &atlas->rects[index];
+        rect->width = width;
+        rect->height = height;
+        rect->in_use = true;
+        rect->pts = AV_NOPTS_VALUE;
+        atomic_store_explicit(&rect->state, ATLAS_RECT_CLEAN, memory_order_release);
+    }
+
+    mutex_unlock(&atlas->mutex);
+    return index;
+}
+
+void frame_atlas_remove_rect(CFrameAtlas** atlas_ptr, int32_t rect)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+
+    if (rect < 0 || rect >= atlas->rect_count)
+        return;
+
+    mutex_lock(&atlas->mutex);
+
+    atlas->rects[rect].in_use = false;
+    for (int32_t i = 0; i < atlas->shelf_count; i++)
+    {
+        if (atlas->shelves[i].y == atlas->rects[rect].y)
+        {
+            frame_atlas_trim_shelf(atlas, &atlas->shelves[i]);
+            break;
+        }
+    }
+
+    mutex_unlock(&atlas->mutex);
+}
+
+bool frame_atlas_begin_write(CFrameAtlas** atlas_ptr, int32_t rect, uint8_t* data[4], int linesize[4])
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+    CAtlasRect* atlas_rect = &atlas->rects[rect];
+    int x_offset[4] = {0};
+
+    uint32_t expected = atomic_load_explicit(&atlas_rect->state, memory_order_relaxed);
+    do
+    {
+        if (expected == ATLAS_RECT_READING || expected == ATLAS_RECT_WRITING)
+            return false;
+    } while (!atomic_compare_exchange_weak_explicit(&atlas_rect->state, &expected, ATLAS_RECT_WRITING, memory_order_acquire, memory_order_relaxed));
+
+    // Byte offsets of the rectangle column in every plane
+    av_image_fill_linesizes(x_offset, atlas->pix_fmt, atlas_rect->x);
+
+    for (int32_t p = 0; p < 4; p++)
+    {
+        int32_t y = (p == 1 || p == 2) ? atlas_rect->y >> atlas->chroma_shift_h : atlas_rect->y;
+
+        data[p] = atlas->data[p] ? atlas->data[p] + (size_t)y * atlas->linesize[p] + x_offset[p] : NULL;
+        linesize[p] = atlas->linesize[p];
+    }
+
+    return true;
+}
+
+void frame_atlas_end_write(CFrameAtlas** atlas_ptr, int32_t rect, int64_t pts)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+    CAtlasRect* atlas_rect = &atlas->rects[rect];
+
+    atlas_rect->pts = pts;
+    atlas_rect->sequence = atomic_fetch_add_explicit(&atlas->sequence, 1, memory_order_relaxed) + 1;
+    atomic_store_explicit(&atlas_rect->state, ATLAS_RECT_DIRTY, memory_order_release);
+}
+
+int32_t frame_atlas_acquire_dirty(CFrameAtlas** atlas_ptr, CAtlasDirtyRect* rects, int32_t max_count)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+    int32_t count = 0;
+
+    for (int32_t i = 0; i < atlas->rect_count && count < max_count; i++)
+    {
+        CAtlasRect* atlas_rect = &atlas->rects[i];
+        uint32_t expected = ATLAS_RECT_DIRTY;
+
+        if (!atomic_compare_exchange_strong_explicit(&atlas_rect->state, &expected, ATLAS_RECT_READING, memory_order_acquire, memory_order_relaxed))
+            continue;
+
+        CAtlasDirtyRect* dirty = &rects[count++];
+        dirty->rect = i;
+        dirty->x = atlas_rect->x;
+        dirty->y = atlas_rect->y;
+        dirty->width = atlas_rect->width;
+        dirty->height = atlas_rect->height;
+        dirty->pts = atlas_rect->pts;
+        dirty->sequence = atlas_rect->sequence;
+    }
+
+    return count;
+}
+
+void frame_atlas_release_dirty(CFrameAtlas** atlas_ptr, const CAtlasDirtyRect* rects, int32_t count)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+
+    for (int32_t i = 0; i < count; i++)
+        atomic_store_explicit(&atlas->rects[rects[i].rect].state, ATLAS_RECT_CLEAN, memory_order_release);
+}
+
+void frame_atlas_close(CFrameAtlas** atlas_ptr)
+{
+    CFrameAtlas* atlas = *atlas_ptr;
+
+    if (!atlas)
+        return;
+
+    if (atlas->buffer)
+    {
+        memory_budget_release(MEMORY_CATEGORY_CONVERTED_FRAMES, atlas->buffer_size);
+        allocator_free(atlas->buffer);
+    }
+    allocator_free(atlas->rects);
+    allocator_free(atlas->shelves);
+    mutex_destroy(&atlas->mutex);
+
+    allocator_free(atlas);
+    *atlas_ptr = NULL;
+}
\ No newline at end of file
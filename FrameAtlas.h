@@ -0,0 +1,206 @@
+#ifndef AV_FRAMEATLAS
+#define AV_FRAMEATLAS
+
+#include <libavutil/avutil.h>
+#include <libavutil/pixfmt.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "Threading.h"
+
+/**
+ * Rectangle positions and sizes are rounded up to this many pixels,
+ * which keeps chroma planes and rows of every rectangle aligned.
+ */
+#define FRAME_ATLAS_ALIGNMENT 16
+
+/**
+ * Rectangle states. A writer moves rectangles CLEAN/DIRTY -> WRITING -> DIRTY,
+ * the engine moves them DIRTY -> READING -> CLEAN.
+ */
+enum EAtlasRectState
+{
+    ATLAS_RECT_CLEAN = 0,
+    ATLAS_RECT_WRITING,
+    ATLAS_RECT_DIRTY,
+    ATLAS_RECT_READING
+};
+
+/**
+ * Rectangle of the atlas assigned to a single stream.
+ */
+typedef struct CAtlasRect
+{
+    int32_t                 x, y;
+    int32_t                 width, height;
+
+    /**
+     * Area reserved for the rectangle, kept when the rectangle is removed and reused by the next one that fits.
+     */
+    int32_t                 capacity_width, capacity_height;
+    bool                    in_use;
+
+    _Atomic uint32_t        state;
+    int64_t                 pts;
+    uint64_t                sequence;
+} CAtlasRect;
+
+/**
+ * Rectangle with a new frame returned by frame_atlas_acquire_dirty.
+ */
+typedef struct CAtlasDirtyRect
+{
+    int32_t                 rect;
+    int32_t                 x, y;
+    int32_t                 width, height;
+    int64_t                 pts;
+    uint64_t                sequence;
+} CAtlasDirtyRect;
+
+/**
+ * Row of rectangles with the same reserved height.
+ */
+typedef struct CAtlasShelf
+{
+    int32_t                 y;
+    int32_t                 height;
+    int32_t                 used_width;
+} CAtlasShelf;
+
+/**
+ * Large buffer of converted frames shared by many small streams.
+ *
+ * Every stream converts its frames straight into an assigned rectangle, the engine
+ * uploads the whole atlas or the dirty rectangles once per frame. Rectangles are packed
+ * into shelves and can be added and removed while other streams keep writing.
+ * Writers never wait: a frame for a rectangle being uploaded is dropped.
+ */
+typedef struct CFrameAtlas
+{
+    uint8_t*                buffer;
+    size_t                  buffer_size;
+    uint8_t*                data[4];
+    int                     linesize[4];
+    int32_t                 width, height;
+    enum AVPixelFormat      pix_fmt;
+    int32_t                 chroma_shift_h;
+
+    CAtlasRect*             rects;
+    int32_t                 max_rects;
+    int32_t                 rect_count;
+
+    CAtlasShelf*            shelves;
+    int32_t                 shelf_count;
+    int32_t                 max_shelves;
+
+    /**
+     * Guards rectangle allocation, writes and uploads do not take it.
+     */
+    CMutex                  mutex;
+    _Atomic uint64_t        sequence;
+} CFrameAtlas;
+
+/**
+ * Allocate an CFrameAtlas and set its fields to default values.
+ *
+ * @return An CFrameAtlas filled with default values or NULL on failure.
+ */
+CFrameAtlas* frame_atlas_alloc(void);
+
+/**
+ * Allocates the atlas buffer.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param width Width of the atlas.
+ *
+ * @param height Height of the atlas.
+ *
+ * @param pix_fmt Pixel format of the atlas and of every stream writing into it.
+ *
+ * @param max_rects Largest number of rectangles.
+ *
+ * @return Returns true if initialization was successful.
+ */
+bool frame_atlas_create(CFrameAtlas** atlas_ptr, int32_t width, int32_t height, enum AVPixelFormat pix_fmt, int32_t max_rects);
+
+/**
+ * Reserves a rectangle for a stream.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param width Width of the stream frames.
+ *
+ * @param height Height of the stream frames.
+ *
+ * @return Returns index of the rectangle or -1 if the atlas is full.
+ */
+int32_t frame_atlas_add_rect(CFrameAtlas** atlas_ptr, int32_t width, int32_t height);
+
+/**
+ * Returns the rectangle back to the atlas, nothing may write into it anymore.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param rect Index returned by frame_atlas_add_rect.
+ */
+void frame_atlas_remove_rect(CFrameAtlas** atlas_ptr, int32_t rect);
+
+/**
+ * Reserves the rectangle for writing the next frame.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param rect Index of the rectangle.
+ *
+ * @param data Receives plane pointers of the rectangle.
+ *
+ * @param linesize Receives plane strides.
+ *
+ * @return Returns false if the rectangle is being uploaded and the frame must be dropped.
+ */
+bool frame_atlas_begin_write(CFrameAtlas** atlas_ptr, int32_t rect, uint8_t* data[4], int linesize[4]);
+
+/**
+ * Marks the frame written into the rectangle as dirty.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param rect Index of the rectangle.
+ *
+ * @param pts Presentation timestamp of the frame.
+ */
+void frame_atlas_end_write(CFrameAtlas** atlas_ptr, int32_t rect, int64_t pts);
+
+/**
+ * Locks every dirty rectangle for upload, writers drop frames for them until they are released.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param rects Receives dirty rectangles.
+ *
+ * @param max_count Size of rects array.
+ *
+ * @return Returns number of acquired rectangles.
+ */
+int32_t frame_atlas_acquire_dirty(CFrameAtlas** atlas_ptr, CAtlasDirtyRect* rects, int32_t max_count);
+
+/**
+ * Marks uploaded rectangles clean and returns them to the writers.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ *
+ * @param rects Rectangles returned by frame_atlas_acquire_dirty.
+ *
+ * @param count Number of rectangles.
+ */
+void frame_atlas_release_dirty(CFrameAtlas** atlas_ptr, const CAtlasDirtyRect* rects, int32_t count);
+
+/**
+ * Releases the atlas buffer and the atlas.
+ *
+ * @param atlas_ptr Pointer to pointer to CFrameAtlas structure.
+ */
+void frame_atlas_close(CFrameAtlas** atlas_ptr);
+
+#endif
\ No newline at end of file
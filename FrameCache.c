@@ -0,0 +1,471 @@
+#include "FrameCache.h"
+#include "Allocator.h"
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <inttypes.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef EVPL_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#define FRAME_CACHE_ALIGNMENT 64
+#define FRAME_CACHE_HASH_CHUNK (1024 * 1024)
+
+static uint64_t frame_cache_fnv1a(uint64_t hash, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Pads the file so the next frame starts aligned in the mapping
+static bool frame_cache_write_padding(CFrameCache* cache)
+{
+    static const uint8_t zeros[FRAME_CACHE_ALIGNMENT] = { 0 };
+    size_t padding = FFALIGN(cache->write_offset, FRAME_CACHE_ALIGNMENT) - cache->write_offset;
+
+    if (padding && fwrite(zeros, 1, padding, cache->file_writer) != padding)
+        return false;
+
+    cache->write_offset += padding;
+    return true;
+}
+
+static void frame_cache_unmap(CFrameCache* cache)
+{
+    #if defined(_WIN32)
+    if (cache->mapping)
+        UnmapViewOfFile(cache->mapping);
+    if (cache->mapping_handle)
+        CloseHandle(cache->mapping_handle);
+    if (cache->file_handle && cache->file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(cache->file_handle);
+    cache->file_handle = NULL;
+    cache->mapping_handle = NULL;
+    #else
+    if (cache->mapping)
+        munmap((void*)cache->mapping, cache->mapped_size);
+    if (cache->fd >= 0)
+        close(cache->fd);
+    cache->fd = -1;
+    #endif
+
+    cache->mapping = NULL;
+    cache->mapped_size = 0;
+    cache->mapped_entries = NULL;
+}
+
+static bool frame_cache_map(CFrameCache* cache)
+{
+    #if defined(_WIN32)
+    LARGE_INTEGER size;
+
+    cache->file_handle = CreateFileA(cache->path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (cache->file_handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(cache->file_handle, &size) || size.QuadPart < (LONGLONG)sizeof(CFrameCacheHeader))
+        return false;
+
+    if (!(cache->mapping_handle = CreateFileMappingA(cache->file_handle, NULL, PAGE_READONLY, 0, 0, NULL)))
+        return false;
+
+    if (!(cache->mapping = (const uint8_t*)MapViewOfFile(cache->mapping_handle, FILE_MAP_READ, 0, 0, 0)))
+        return false;
+
+    cache->mapped_size = (size_t)size.QuadPart;
+    #else
+    struct stat info;
+
+    if ((cache->fd = open(cache->path, O_RDONLY)) < 0)
+        return false;
+
+    if (fstat(cache->fd, &info) < 0 || info.st_size < (off_t)sizeof(CFrameCacheHeader))
+        return false;
+
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, cache->fd, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    cache->mapping = (const uint8_t*)mapping;
+    cache->mapped_size = (size_t)info.st_size;
+    #endif
+
+    return true;
+}
+
+// Checks that the mapped file belongs to the source and output format of the cache
+static bool frame_cache_validate(CFrameCache* cache)
+{
+    const CFrameCacheHeader* header = (const CFrameCacheHeader*)cache->mapping;
+
+    if (header->magic != FRAME_CACHE_MAGIC || header->version != FRAME_CACHE_VERSION)
+        return false;
+
+    if (header->source_hash != cache->header.source_hash || header->width != cache->header.width ||
+        header->height != cache->header.height || header->pix_fmt != cache->header.pix_fmt ||
+        header->frame_size != cache->header.frame_size || header->frame_count == 0)
+        return false;
+
+    #ifndef EVPL_WITH_LZ4
+    if (header->compression != FRAME_CACHE_COMPRESSION_NONE)
+        return false;
+    #endif
+
+    if (header->index_offset > cache->mapped_size ||
+        (cache->mapped_size - header->index_offset) / sizeof(CFrameCacheEntry) < header->frame_count)
+        return false;
+
+    cache->mapped_entries = (const CFrameCacheEntry*)(cache->mapping + header->index_offset);
+    for (uint32_t i = 0; i < header->frame_count; i++)
+    {
+        const CFrameCacheEntry* entry = &cache->mapped_entries[i];
+        if (entry->size > header->frame_size || entry->offset > header->index_offset || entry->size > header->index_offset - entry->offset)
+            return false;
+    }
+
+    cache->header = *header;
+    return true;
+}
+
+static bool frame_cache_open_reader(CFrameCache* cache)
+{
+    if (!frame_cache_map(cache) || !frame_cache_validate(cache))
+    {
+        frame_cache_unmap(cache);
+        return false;
+    }
+
+    if (cache->header.compression != FRAME_CACHE_COMPRESSION_NONE && !cache->frame_buffer)
+        cache->frame_buffer = (uint8_t*)allocator_aligned_malloc(cache->header.frame_size, ALLOCATOR_DEFAULT_ALIGNMENT);
+
+    cache->is_writer = false;
+    cache->read_index = 0;
+    return true;
+}
+
+static bool frame_cache_open_writer(CFrameCache* cache)
+{
+    CFrameCacheHeader placeholder;
+
+    if (!(cache->file_writer = fopen(cache->temp_path, "wb")))
+    {
+        fprintf(stderr, "Couldn't create frame cache %s\n", cache->temp_path);
+        return false;
+    }
+
+    cache->is_writer = true;
+    cache->header.frame_count = 0;
+
+    // The header is written again when the cache is finished
+    memset(&placeholder, 0, sizeof(placeholder));
+    if (fwrite(&placeholder, sizeof(placeholder), 1, cache->file_writer) != 1)
+    {
+        frame_cache_abort(&cache);
+        return false;
+    }
+
+    cache->write_offset = sizeof(placeholder);
+    return true;
+}
+
+CFrameCache* frame_cache_alloc()
+{
+    CFrameCache* cache = NULL;
+    cache = (CFrameCache*)allocator_malloc(sizeof(CFrameCache));
+
+    cache->path = NULL;
+    cache->temp_path = NULL;
+    cache->is_writer = false;
+    memset(&cache->header, 0, sizeof(CFrameCacheHeader));
+    cache->file_writer = NULL;
+    cache->entries = NULL;
+    cache->entry_capacity = 0;
+    cache->write_offset = 0;
+    cache->max_size = FRAME_CACHE_DEFAULT_MAX_SIZE;
+    cache->compress_buffer = NULL;
+    cache->compress_capacity = 0;
+    cache->mapping = NULL;
+    cache->mapped_size = 0;
+    cache->mapped_entries = NULL;
+    cache->frame_buffer = NULL;
+    cache->read_index = 0;
+    #ifdef _WIN32
+    cache->file_handle = NULL;
+    cache->mapping_handle = NULL;
+    #else
+    cache->fd = -1;
+    #endif
+
+    return cache;
+}
+
+bool frame_cache_hash_file(const char* filepath, uint64_t* hash)
+{
+    FILE* file = fopen(filepath, "rb");
+    uint8_t* chunk = NULL;
+    int64_t file_size;
+    bool result = false;
+
+    if (!file)
+        return false;
+
+    if (fseek(file, 0, SEEK_END) != 0 || (file_size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0)
+        goto end;
+
+    chunk = (uint8_t*)allocator_malloc(FRAME_CACHE_HASH_CHUNK);
+    *hash = frame_cache_fnv1a(0xcbf29ce484222325ull, (const uint8_t*)&file_size, sizeof(file_size));
+
+    size_t read_size = fread(chunk, 1, FRAME_CACHE_HASH_CHUNK, file);
+    *hash = frame_cache_fnv1a(*hash, chunk, read_size);
+
+    if (file_size > 2 * FRAME_CACHE_HASH_CHUNK)
+    {
+        if (fseek(file, -FRAME_CACHE_HASH_CHUNK, SEEK_END) != 0)
+            goto end;
+        read_size = fread(chunk, 1, FRAME_CACHE_HASH_CHUNK, file);
+        *hash = frame_cache_fnv1a(*hash, chunk, read_size);
+    }
+    else if (file_size > FRAME_CACHE_HASH_CHUNK)
+    {
+        read_size = fread(chunk, 1, FRAME_CACHE_HASH_CHUNK, file);
+        *hash = frame_cache_fnv1a(*hash, chunk, read_size);
+    }
+
+    result = true;
+
+    end:
+        allocator_free(chunk);
+        fclose(file);
+
+    return result;
+}
+
+bool frame_cache_open(CFrameCache** cache_ptr, const char* cache_dir, const char* source_path, int32_t width, int32_t height,
+    enum AVPixelFormat pix_fmt, AVRational time_base, enum EFrameCacheCompression compression)
+{
+    CFrameCache* cache = *cache_ptr;
+    CFrameCacheHeader* header = &cache->header;
+    const char* format_name = av_get_pix_fmt_name(pix_fmt);
+    int frame_size = av_image_get_buffer_size(pix_fmt, width, height, 1);
+    char path[1024];
+
+    if (!format_name || frame_size <= 0)
+    {
+        fprintf(stderr, "Invalid frame cache format\n");
+        return false;
+    }
+
+    header->magic = FRAME_CACHE_MAGIC;
+    header->version = FRAME_CACHE_VERSION;
+    header->width = width;
+    header->height = height;
+    header->pix_fmt = pix_fmt;
+    header->frame_size = (uint32_t)frame_size;
+    header->time_base = time_base;
+    header->end_pts = AV_NOPTS_VALUE;
+
+    #ifdef EVPL_WITH_LZ4
+    header->compression = compression;
+    #else
+    (void)compression;
+    header->compression = FRAME_CACHE_COMPRESSION_NONE;
+    #endif
+
+    if (!frame_cache_hash_file(source_path, &header->source_hash))
+    {
+        fprintf(stderr, "Couldn't read %s\n", source_path);
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 "_%dx%d_%s.evfc", cache_dir, header->source_hash, width, height, format_name);
+    cache->path = allocator_strdup(path);
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 "_%dx%d_%s.evfc.tmp", cache_dir, header->source_hash, width, height, format_name);
+    cache->temp_path = allocator_strdup(path);
+
+    if (frame_cache_open_reader(cache))
+        return true;
+
+    return frame_cache_open_writer(cache);
+}
+
+void frame_cache_set_max_size(CFrameCache** cache_ptr, uint64_t max_size)
+{
+    (*cache_ptr)->max_size = max_size;
+}
+
+bool frame_cache_is_readable(CFrameCache** cache_ptr)
+{
+    return *cache_ptr && (*cache_ptr)->mapping != NULL;
+}
+
+bool frame_cache_write_frame(CFrameCache** cache_ptr, const uint8_t* data, int64_t pts)
+{
+    CFrameCache* cache = *cache_ptr;
+    const uint8_t* stored_data = data;
+    uint32_t stored_size = cache->header.frame_size;
+
+    if (!cache->is_writer)
+        return false;
+
+    #ifdef EVPL_WITH_LZ4
+    if (cache->header.compression == FRAME_CACHE_COMPRESSION_LZ4)
+    {
+        int bound = LZ4_compressBound((int)cache->header.frame_size);
+        if (cache->compress_capacity < (size_t)bound)
+        {
+            allocator_free(cache->compress_buffer);
+            cache->compress_buffer = (uint8_t*)allocator_malloc(bound);
+            cache->compress_capacity = bound;
+        }
+
+        // Frames that do not shrink are stored as is and read without copying
+        int compressed_size = LZ4_compress_default((const char*)data, (char*)cache->compress_buffer, (int)cache->header.frame_size, bound);
+        if (compressed_size > 0 && (uint32_t)compressed_size < cache->header.frame_size)
+        {
+            stored_data = cache->compress_buffer;
+            stored_size = (uint32_t)compressed_size;
+        }
+    }
+    #endif
+
+    if (cache->header.frame_count == cache->entry_capacity)
+    {
+        cache->entry_capacity = cache->entry_capacity ? cache->entry_capacity * 2 : 256;
+        cache->entries = (CFrameCacheEntry*)allocator_realloc(cache->entries, sizeof(CFrameCacheEntry) * cache->entry_capacity);
+    }
+
+    if (!frame_cache_write_padding(cache) || cache->write_offset + stored_size > cache->max_size ||
+        fwrite(stored_data, 1, stored_size, cache->file_writer) != stored_size)
+    {
+        frame_cache_abort(cache_ptr);
+        return false;
+    }
+
+    CFrameCacheEntry* entry = &cache->entries[cache->header.frame_count++];
+    entry->offset = cache->write_offset;
+    entry->size = stored_size;
+    entry->reserved = 0;
+    entry->pts = pts;
+
+    cache->write_offset += stored_size;
+    return true;
+}
+
+bool frame_cache_finish(CFrameCache** cache_ptr, int64_t end_pts)
+{
+    CFrameCache* cache = *cache_ptr;
+    size_t index_size = sizeof(CFrameCacheEntry) * cache->header.frame_count;
+
+    if (!cache->is_writer)
+        return frame_cache_is_readable(cache_ptr);
+
+    if (!cache->header.frame_count || !frame_cache_write_padding(cache))
+    {
+        frame_cache_abort(cache_ptr);
+        return false;
+    }
+
+    cache->header.index_offset = cache->write_offset;
+    cache->header.end_pts = end_pts;
+
+    if (fwrite(cache->entries, 1, index_size, cache->file_writer) != index_size ||
+        fseek(cache->file_writer, 0, SEEK_SET) != 0 ||
+        fwrite(&cache->header, sizeof(CFrameCacheHeader), 1, cache->file_writer) != 1)
+    {
+        frame_cache_abort(cache_ptr);
+        return false;
+    }
+
+    int response = fclose(cache->file_writer);
+    cache->file_writer = NULL;
+    cache->is_writer = false;
+
+    // Replaces a stale cache of the same source
+    remove(cache->path);
+    if (response != 0 || rename(cache->temp_path, cache->path) != 0)
+    {
+        fprintf(stderr, "Couldn't store frame cache %s\n", cache->path);
+        remove(cache->temp_path);
+        return false;
+    }
+
+    allocator_free(cache->entries);
+    cache->entries = NULL;
+    cache->entry_capacity = 0;
+
+    return frame_cache_open_reader(cache);
+}
+
+void frame_cache_abort(CFrameCache** cache_ptr)
+{
+    CFrameCache* cache = *cache_ptr;
+
+    if (!cache->is_writer)
+        return;
+
+    if (cache->file_writer)
+        fclose(cache->file_writer);
+    remove(cache->temp_path);
+
+    cache->file_writer = NULL;
+    cache->is_writer = false;
+    cache->header.frame_count = 0;
+}
+
+const uint8_t* frame_cache_read_frame(CFrameCache** cache_ptr, int64_t* pts)
+{
+    CFrameCache* cache = *cache_ptr;
+
+    if (!cache->mapping || cache->read_index >= cache->header.frame_count)
+        return NULL;
+
+    const CFrameCacheEntry* entry = &cache->mapped_entries[cache->read_index++];
+    const uint8_t* data = cache->mapping + entry->offset;
+    *pts = entry->pts;
+
+    if (entry->size == cache->header.frame_size)
+        return data;
+
+    #ifdef EVPL_WITH_LZ4
+    if (LZ4_decompress_safe((const char*)data, (char*)cache->frame_buffer, (int)entry->size, (int)cache->header.frame_size) == (int)cache->header.frame_size)
+        return cache->frame_buffer;
+    #endif
+
+    fprintf(stderr, "Corrupted frame in cache %s\n", cache->path);
+    return NULL;
+}
+
+void frame_cache_rewind(CFrameCache** cache_ptr)
+{
+    (*cache_ptr)->read_index = 0;
+}
+
+void frame_cache_close(CFrameCache** cache_ptr)
+{
+    CFrameCache* cache = *cache_ptr;
+
+    if (!cache)
+        return;
+
+    frame_cache_abort(cache_ptr);
+    frame_cache_unmap(cache);
+
+    allocator_free(cache->path);
+    allocator_free(cache->temp_path);
+    allocator_free(cache->entries);
+    allocator_free(cache->compress_buffer);
+    allocator_free(cache->frame_buffer);
+    allocator_free(cache);
+    *cache_ptr = NULL;
+}
\ No newline at end of file
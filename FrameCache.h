@@ -0,0 +1,223 @@
+#ifndef AV_FRAMECACHE
+#define AV_FRAMECACHE
+
+#include <libavutil/avutil.h>
+#include <libavutil/pixfmt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define FRAME_CACHE_MAGIC 0x43465645u
+#define FRAME_CACHE_VERSION 1
+
+/**
+ * Default limit of the cache file size, longer clips are not cached.
+ */
+#define FRAME_CACHE_DEFAULT_MAX_SIZE (256ull * 1024 * 1024)
+
+enum EFrameCacheCompression
+{
+    FRAME_CACHE_COMPRESSION_NONE = 0,
+
+    /**
+     * Frames are compressed with LZ4, available when built with EVPL_WITH_LZ4.
+     */
+    FRAME_CACHE_COMPRESSION_LZ4
+};
+
+/**
+ * Header at the beginning of the cache file.
+ * The file is valid only for the source with the same hash and the same output format.
+ */
+typedef struct CFrameCacheHeader
+{
+    uint32_t                magic;
+    uint32_t                version;
+    uint64_t                source_hash;
+    int32_t                 width, height;
+    int32_t                 pix_fmt;
+    uint32_t                compression;
+    uint32_t                frame_count;
+    uint32_t                frame_size;
+    AVRational              time_base;
+
+    /**
+     * Timestamp where the last frame ends.
+     */
+    int64_t                 end_pts;
+    uint64_t                index_offset;
+} CFrameCacheHeader;
+
+/**
+ * Index entry of a single frame, the index is stored after the frame data.
+ */
+typedef struct CFrameCacheEntry
+{
+    uint64_t                offset;
+    uint32_t                size;
+    uint32_t                reserved;
+    int64_t                 pts;
+} CFrameCacheEntry;
+
+/**
+ * File with converted video frames of a single clip.
+ *
+ * On the first play frames are appended to a temporary file, which is renamed
+ * when the clip was decoded completely. Later plays map the finished file and read
+ * frames from it without decoding, uncompressed frames are not even copied.
+ */
+typedef struct CFrameCache
+{
+    char*                   path;
+    char*                   temp_path;
+    bool                    is_writer;
+    CFrameCacheHeader       header;
+
+    /**
+     * Writer state.
+     */
+    FILE*                   file_writer;
+    CFrameCacheEntry*       entries;
+    uint32_t                entry_capacity;
+    uint64_t                write_offset;
+    uint64_t                max_size;
+    uint8_t*                compress_buffer;
+    size_t                  compress_capacity;
+
+    /**
+     * Reader state. Mapped file, it's index and the buffer for decompressed frames.
+     */
+    const uint8_t*          mapping;
+    size_t                  mapped_size;
+    const CFrameCacheEntry* mapped_entries;
+    uint8_t*                frame_buffer;
+    uint32_t                read_index;
+
+    #ifdef _WIN32
+    void*                   file_handle;
+    void*                   mapping_handle;
+    #else
+    int                     fd;
+    #endif
+} CFrameCache;
+
+/**
+ * Allocate an CFrameCache and set its fields to default values.
+ *
+ * @return An CFrameCache filled with default values or NULL on failure.
+ */
+CFrameCache* frame_cache_alloc(void);
+
+/**
+ * Hashes the source file. Size and the data at the beginning and at the end
+ * of the file are hashed, so the whole file is not read.
+ *
+ * @param filepath Path to source file.
+ *
+ * @param hash Receives the hash.
+ *
+ * @return Returns true if the file could be read.
+ */
+bool frame_cache_hash_file(const char* filepath, uint64_t* hash);
+
+/**
+ * Opens the cache of source file converted to given output format.
+ *
+ * A valid finished cache is mapped for reading, otherwise the cache is opened as writer.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ *
+ * @param cache_dir Directory of cache files.
+ *
+ * @param source_path Path to source file.
+ *
+ * @param width Width of converted frames.
+ *
+ * @param height Height of converted frames.
+ *
+ * @param pix_fmt Pixel format of converted frames.
+ *
+ * @param time_base Time base of frame timestamps.
+ *
+ * @param compression Compression of frames written into a new cache.
+ *
+ * @return Returns true if the cache was opened for reading or writing.
+ */
+bool frame_cache_open(CFrameCache** cache_ptr, const char* cache_dir, const char* source_path, int32_t width, int32_t height,
+    enum AVPixelFormat pix_fmt, AVRational time_base, enum EFrameCacheCompression compression);
+
+/**
+ * Sets the largest size of the cache file, writing is aborted above it.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ *
+ * @param max_size Size in bytes.
+ */
+void frame_cache_set_max_size(CFrameCache** cache_ptr, uint64_t max_size);
+
+/**
+ * Whether finished frames can be read from the cache.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ *
+ * @return Returns true if the cache is mapped for reading.
+ */
+bool frame_cache_is_readable(CFrameCache** cache_ptr);
+
+/**
+ * Appends converted frame to the cache being written.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ *
+ * @param data Frame data of header.frame_size bytes.
+ *
+ * @param pts Timestamp of the frame.
+ *
+ * @return Returns false if writing failed and was aborted.
+ */
+bool frame_cache_write_frame(CFrameCache** cache_ptr, const uint8_t* data, int64_t pts);
+
+/**
+ * Writes the index, publishes the cache file and maps it for reading.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ *
+ * @param end_pts Timestamp where the last frame ends.
+ *
+ * @return Returns true if the cache can be read now.
+ */
+bool frame_cache_finish(CFrameCache** cache_ptr, int64_t end_pts);
+
+/**
+ * Stops writing and removes the unfinished file.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ */
+void frame_cache_abort(CFrameCache** cache_ptr);
+
+/**
+ * Reads the next frame of a readable cache.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ *
+ * @param pts Receives timestamp of the frame.
+ *
+ * @return Returns pointer to frame data valid until the next read, or NULL after the last frame.
+ */
+const uint8_t* frame_cache_read_frame(CFrameCache** cache_ptr, int64_t* pts);
+
+/**
+ * Moves reading back to the first frame.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ */
+void frame_cache_rewind(CFrameCache** cache_ptr);
+
+/**
+ * Aborts unfinished writing, unmaps the file and releases the cache.
+ *
+ * @param cache_ptr Pointer to pointer to CFrameCache structure.
+ */
+void frame_cache_close(CFrameCache** cache_ptr);
+
+#endif
\ No newline at end of file
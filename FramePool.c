@@ -0,0 +1,112 @@
+#include "FramePool.h"
+#include "Allocator.h"
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+static void frame_pool_buffer_free(void* opaque, uint8_t* data)
+{
+    (void)opaque;
+    allocator_free(data);
+}
+
+static AVBufferRef* frame_pool_buffer_alloc(void* opaque, int size)
+{
+    (void)opaque;
+    AVBufferRef* buffer = NULL;
+    uint8_t* data = (uint8_t*)allocator_aligned_malloc(size, ALLOCATOR_DEFAULT_ALIGNMENT);
+
+    if(!data)
+        return NULL;
+
+    if(!(buffer = av_buffer_create(data, size, frame_pool_buffer_free, NULL, 0)))
+        allocator_free(data);
+
+    return buffer;
+}
+
+CFramePool* frame_pool_alloc()
+{
+    CFramePool* pool = NULL;
+    pool = (CFramePool*)allocator_malloc(sizeof(CFramePool));
+
+    pool->av_buffer_pool = NULL;
+    pool->buffer_size = 0;
+    atomic_flag_clear(&pool->lock);
+
+    return pool;
+}
+
+void frame_pool_attach(CFramePool** pool_ptr, AVCodecContext* av_codec_ctx)
+{
+    av_codec_ctx->opaque = *pool_ptr;
+    av_codec_ctx->get_buffer2 = frame_pool_get_buffer2;
+}
+
+int frame_pool_get_buffer2(AVCodecContext* av_codec_ctx, AVFrame* av_frame, int flags)
+{
+    CFramePool* pool = (CFramePool*)av_codec_ctx->opaque;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)av_frame->format);
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int linesizes[4];
+    uint8_t* planes[4];
+    int unaligned;
+
+    if(!pool || !desc || av_codec_ctx->codec_type != AVMEDIA_TYPE_VIDEO || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)))
+        return avcodec_default_get_buffer2(av_codec_ctx, av_frame, flags);
+
+    int width = av_frame->width;
+    int height = av_frame->height;
+    avcodec_align_dimensions2(av_codec_ctx, &width, &height, linesize_align);
+
+    // Grow the width until every plane stride is aligned, same as ffmpeg does
+    do
+    {
+        if(av_image_fill_linesizes(linesizes, (enum AVPixelFormat)av_frame->format, width) < 0)
+            return avcodec_default_get_buffer2(av_codec_ctx, av_frame, flags);
+
+        width += width & ~(width - 1);
+        unaligned = 0;
+        for(int32_t i = 0; i < 4; i++)
+            unaligned |= linesizes[i] % ALLOCATOR_DEFAULT_ALIGNMENT;
+    } while(unaligned);
+
+    int size = av_image_fill_pointers(planes, (enum AVPixelFormat)av_frame->format, height, NULL, linesizes);
+    if(size < 0)
+        return size;
+    size += 16 + ALLOCATOR_DEFAULT_ALIGNMENT - 1;
+
+    while(atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire));
+
+    if(!pool->av_buffer_pool || pool->buffer_size != size)
+    {
+        av_buffer_pool_uninit(&pool->av_buffer_pool);
+        pool->av_buffer_pool = av_buffer_pool_init2(size, pool, frame_pool_buffer_alloc, NULL);
+        pool->buffer_size = size;
+    }
+
+    av_frame->buf[0] = pool->av_buffer_pool ? av_buffer_pool_get(pool->av_buffer_pool) : NULL;
+
+    atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+
+    if(!av_frame->buf[0])
+        return AVERROR(ENOMEM);
+
+    av_image_fill_pointers(av_frame->data, (enum AVPixelFormat)av_frame->format, height, av_frame->buf[0]->data, linesizes);
+    for(int32_t i = 0; i < 4; i++)
+        av_frame->linesize[i] = linesizes[i];
+    av_frame->extended_data = av_frame->data;
+
+    return 0;
+}
+
+void frame_pool_close(CFramePool** pool_ptr)
+{
+    CFramePool* pool = *pool_ptr;
+
+    if(!pool)
+        return;
+
+    av_buffer_pool_uninit(&pool->av_buffer_pool);
+    allocator_free(pool);
+    *pool_ptr = NULL;
+}
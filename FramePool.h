@@ -0,0 +1,67 @@
+#ifndef AV_FRAMEPOOL
+#define AV_FRAMEPOOL
+
+#include <libavcodec/avcodec.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * Pool of decoded frame buffers backed by the library allocator.
+ * 
+ * Installed as get_buffer2 callback of a decoder, so decoded surfaces come from 
+ * pooled memory instead of per-frame allocations. The pool is recreated when 
+ * the frame geometry changes, buffers of the old pool stay valid until released.
+ */
+typedef struct CFramePool
+{
+    AVBufferPool*       av_buffer_pool;
+
+    /**
+     * Size of a single buffer in the pool.
+     */
+    int                 buffer_size;
+
+    /**
+     * Guards recreation of the pool, decoder threads may request buffers concurrently.
+     */
+    atomic_flag         lock;
+} CFramePool;
+
+/**
+ * Allocate an CFramePool and set its fields to default values.
+ *
+ * @return An CFramePool filled with default values or NULL on failure.
+ */
+CFramePool* frame_pool_alloc(void);
+
+/**
+ * Installs the frame pool as buffer allocator of the decoder. Must be called before avcodec_open2.
+ *
+ * @param pool_ptr Pointer to pointer to CFramePool structure.
+ *
+ * @param av_codec_ctx Decoder context.
+ */
+void frame_pool_attach(CFramePool** pool_ptr, AVCodecContext* av_codec_ctx);
+
+/**
+ * Callback for AVCodecContext.get_buffer2. Falls back to the default implementation 
+ * for hardware, palettized and audio frames.
+ *
+ * @param av_codec_ctx Decoder context, opaque must point to CFramePool.
+ *
+ * @param av_frame Frame that receives the buffers.
+ *
+ * @param flags AV_GET_BUFFER_FLAG_* flags.
+ *
+ * @return Returns 0 on success or negative AVERROR code.
+ */
+int frame_pool_get_buffer2(AVCodecContext* av_codec_ctx, AVFrame* av_frame, int flags);
+
+/**
+ * Releases the pool. Buffers still referenced by frames are freed when they are unreferenced.
+ *
+ * @param pool_ptr Pointer to pointer to CFramePool structure.
+ */
+void frame_pool_close(CFramePool** pool_ptr);
+
+#endif
@@ -1,5 +1,6 @@
 #include "HWAccelerator.h"
 #include "helpers.h"
+#include "Allocator.h"
 
 #include <libswscale/swscale.h>
 
@@ -22,7 +23,7 @@ enum AVPixelFormat get_hw_format(AVCodecContext *av_codec_ctx, const enum AVPixe
 CHardwareAccelerator* hw_alloc()
 {
     CHardwareAccelerator* hwdec = NULL;
-    hwdec = (CHardwareAccelerator*)malloc(sizeof(CHardwareAccelerator));
+    hwdec = (CHardwareAccelerator*)allocator_malloc(sizeof(CHardwareAccelerator));
 
     hwdec->sw_frame = NULL;
     hwdec->hw_device_ctx = NULL;
@@ -134,5 +135,5 @@ bool hw_close(CHardwareAccelerator** hwdec_ptr)
 {
     av_frame_free(&(*hwdec_ptr)->sw_frame);
     av_buffer_unref(&(*hwdec_ptr)->hw_device_ctx);
-    free(*hwdec_ptr);
+    allocator_free(*hwdec_ptr);
 }
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include "MediaProbe.h"
+#include "Allocator.h"
+#include "ThreadPool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * Keyframes needed for the interval estimate, reading stops once they are found.
+ */
+#define MEDIA_PROBE_KEYFRAMES 5
+
+typedef struct CMediaProbeJob
+{
+    CMediaProbe*            probe;
+    const char*             path;
+    CMediaInfo*             info;
+    bool                    result;
+} CMediaProbeJob;
+
+static uint64_t media_probe_hash_path(const char* path)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const uint8_t* cursor = (const uint8_t*)path; *cursor; cursor++)
+    {
+        hash ^= *cursor;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool media_probe_stat(const char* path, int64_t* file_size, int64_t* modification_time)
+{
+    #ifdef _WIN32
+    struct _stat64 info;
+    if(_stat64(path, &info) != 0)
+        return false;
+    #else
+    struct stat info;
+    if(stat(path, &info) != 0)
+        return false;
+    #endif
+
+    *file_size = (int64_t)info.st_size;
+    *modification_time = (int64_t)info.st_mtime;
+    return true;
+}
+
+static int media_probe_compare_entries(const void* a, const void* b)
+{
+    uint64_t hash_a = ((const CMediaProbeCacheEntry*)a)->path_hash;
+    uint64_t hash_b = ((const CMediaProbeCacheEntry*)b)->path_hash;
+    return hash_a < hash_b ? -1 : hash_a > hash_b;
+}
+
+static void media_probe_sort_cache(CMediaProbe* probe)
+{
+    if (probe->sorted_count == probe->entry_count)
+        return;
+
+    qsort(probe->entries, probe->entry_count, sizeof(CMediaProbeCacheEntry), media_probe_compare_entries);
+    probe->sorted_count = probe->entry_count;
+}
+
+static bool media_probe_entry_matches(CMediaProbe* probe, const CMediaProbeCacheEntry* entry, uint64_t path_hash, const char* path, uint32_t path_length)
+{
+    return entry->path_hash == path_hash && entry->path_length == path_length &&
+        memcmp(probe->paths + entry->path_offset, path, path_length) == 0;
+}
+
+// Binary search over the sorted part, entries added since the last sort are scanned. Entries with an equal hash are compared by path
+static int32_t media_probe_find_entry(CMediaProbe* probe, uint64_t path_hash, const char* path, uint32_t path_length)
+{
+    int32_t low = 0, high = probe->sorted_count;
+
+    while (low < high)
+    {
+        int32_t middle = low + (high - low) / 2;
+
+        if (probe->entries[middle].path_hash < path_hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (; low < probe->sorted_count && probe->entries[low].path_hash == path_hash; low++)
+    {
+        if (media_probe_entry_matches(probe, &probe->entries[low], path_hash, path, path_length))
+            return low;
+    }
+
+    for (int32_t i = probe->sorted_count; i < probe->entry_count; i++)
+    {
+        if (media_probe_entry_matches(probe, &probe->entries[i], path_hash, path, path_length))
+            return i;
+    }
+
+    return -1;
+}
+
+static void media_probe_store_entry(CMediaProbe* probe, uint64_t path_hash, const char* path, const CMediaInfo* info)
+{
+    uint32_t path_length = (uint32_t)strlen(path);
+    int32_t index = media_probe_find_entry(probe, path_hash, path, path_length);
+
+    if (index < 0)
+    {
+        if (probe->entry_count == probe->entry_capacity)
+        {
+            int32_t capacity = probe->entry_capacity ? probe->entry_capacity * 2 : 256;
+            CMediaProbeCacheEntry* entries = (CMediaProbeCacheEntry*)allocator_realloc(probe->entries, sizeof(CMediaProbeCacheEntry) * capacity);
+            if (!entries)
+                return;
+
+            probe->entries = entries;
+            probe->entry_capacity = capacity;
+        }
+
+        if (probe->paths_size + path_length > probe->paths_capacity)
+        {
+            uint32_t capacity = probe->paths_capacity ? probe->paths_capacity : 16 * 1024;
+            while (probe->paths_size + path_length > capacity)
+                capacity *= 2;
+
+            char* paths = (char*)allocator_realloc(probe->paths, capacity);
+            if (!paths)
+                return;
+
+            probe->paths = paths;
+            probe->paths_capacity = capacity;
+        }
+
+        index = probe->entry_count++;
+        memcpy(probe->paths + probe->paths_size, path, path_length);
+        probe->entries[index].path_offset = probe->paths_size;
+        probe->entries[index].path_length = path_length;
+        probe->paths_size += path_length;
+    }
+
+    probe->entries[index].path_hash = path_hash;
+    probe->entries[index].info = *info;
+    probe->entries[index].info.from_cache = false;
+    probe->cache_dirty = true;
+}
+
+// Stream info is read from packets only when the header leaves parameters out, e.g. for MPEG-TS
+static bool media_probe_needs_stream_info(AVFormatContext* av_format_ctx)
+{
+    for (unsigned i = 0; i < av_format_ctx->nb_streams; i++)
+    {
+        AVCodecParameters* av_codec_params = av_format_ctx->streams[i]->codecpar;
+
+        if (av_codec_params->codec_id == AV_CODEC_ID_NONE ||
+            (av_codec_params->codec_type == AVMEDIA_TYPE_VIDEO && (av_codec_params->width <= 0 || av_codec_params->height <= 0)) ||
+            (av_codec_params->codec_type == AVMEDIA_TYPE_AUDIO && (av_codec_params->sample_rate <= 0 || av_codec_params->channels <= 0)))
+            return true;
+    }
+
+    return false;
+}
+
+static void media_probe_estimate_keyframes(CMediaProbe* probe, AVFormatContext* av_format_ctx, CMediaInfo* info)
+{
+    int index = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    AVPacket* av_packet = NULL;
+
+    if (index < 0 || index >= MEDIA_PROBE_MAX_STREAMS || !(av_packet = av_packet_alloc()))
+        return;
+
+    for (unsigned i = 0; i < av_format_ctx->nb_streams; i++)
+        av_format_ctx->streams[i]->discard = (int)i == index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+
+    int64_t first_pts = AV_NOPTS_VALUE, last_pts = AV_NOPTS_VALUE;
+    int32_t keyframes = 0;
+
+    for (int32_t packets = 0; packets < probe->keyframe_packets && keyframes < MEDIA_PROBE_KEYFRAMES && av_read_frame(av_format_ctx, av_packet) >= 0;)
+    {
+        if (av_packet->stream_index == index)
+        {
+            int64_t pts = av_packet->pts != AV_NOPTS_VALUE ? av_packet->pts : av_packet->dts;
+
+            packets++;
+            if ((av_packet->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE)
+            {
+                if (first_pts == AV_NOPTS_VALUE)
+                    first_pts = pts;
+                last_pts = pts;
+                keyframes++;
+            }
+        }
+        av_packet_unref(av_packet);
+    }
+    av_packet_free(&av_packet);
+
+    if (keyframes >= 2 && last_pts > first_pts)
+        info->streams[index].keyframe_interval = (last_pts - first_pts) * av_q2d(av_format_ctx->streams[index]->time_base) / (keyframes - 1);
+}
+
+static bool media_probe_read(CMediaProbe* probe, const char* path, CMediaInfo* info)
+{
+    AVFormatContext* av_format_ctx = avformat_alloc_context();
+
+    if (!av_format_ctx)
+        return false;
+
+    av_format_ctx->probesize = probe->probe_size;
+    av_format_ctx->max_analyze_duration = probe->analyze_duration_us;
+
+    // Frees the context on failure
+    if (avformat_open_input(&av_format_ctx, path, NULL, NULL) < 0)
+        return false;
+
+    if (media_probe_needs_stream_info(av_format_ctx) && avformat_find_stream_info(av_format_ctx, NULL) < 0)
+        fprintf(stderr, "Couldn't find stream info of %s.\n", path);
+
+    snprintf(info->format_name, sizeof(info->format_name), "%s", av_format_ctx->iformat->name);
+    info->duration_us = av_format_ctx->duration != AV_NOPTS_VALUE ? av_format_ctx->duration : 0;
+    info->bit_rate = av_format_ctx->bit_rate;
+    info->stream_count = (int32_t)av_format_ctx->nb_streams;
+
+    for (int32_t i = 0; i < info->stream_count && i < MEDIA_PROBE_MAX_STREAMS; i++)
+    {
+        AVStream* av_stream = av_format_ctx->streams[i];
+        AVCodecParameters* av_codec_params = av_stream->codecpar;
+        CMediaStreamInfo* stream = &info->streams[i];
+
+        stream->index = i;
+        stream->type = av_codec_params->codec_type;
+        stream->codec_id = av_codec_params->codec_id;
+        stream->width = av_codec_params->width;
+        stream->height = av_codec_params->height;
+        stream->frame_rate = av_stream->avg_frame_rate.num > 0 ? av_stream->avg_frame_rate : av_stream->r_frame_rate;
+        stream->sample_rate = av_codec_params->sample_rate;
+        stream->channels = av_codec_params->channels;
+        stream->bit_rate = av_codec_params->bit_rate;
+        stream->duration_us = av_stream->duration != AV_NOPTS_VALUE ? av_rescale_q(av_stream->duration, av_stream->time_base, AV_TIME_BASE_Q) : 0;
+        stream->keyframe_interval = 0.0;
+    }
+
+    if (probe->keyframe_packets > 0)
+        media_probe_estimate_keyframes(probe, av_format_ctx, info);
+
+    avformat_close_input(&av_format_ctx);
+    return true;
+}
+
+static void media_probe_job(void* arg)
+{
+    CMediaProbeJob* job = (CMediaProbeJob*)arg;
+    job->result = media_probe_file(&job->probe, job->path, job->info);
+}
+
+CMediaProbe* media_probe_alloc()
+{
+    CMediaProbe* probe = NULL;
+    probe = (CMediaProbe*)allocator_malloc(sizeof(CMediaProbe));
+
+    if (!probe)
+    {
+        fprintf(stderr, "Couldn't allocate media probe.\n");
+        return NULL;
+    }
+
+    probe->probe_size = MEDIA_PROBE_DEFAULT_PROBE_SIZE;
+    probe->analyze_duration_us = MEDIA_PROBE_DEFAULT_ANALYZE_DURATION;
+    probe->keyframe_packets = MEDIA_PROBE_DEFAULT_KEYFRAME_PACKETS;
+
+    probe->entries = NULL;
+    probe->entry_count = 0;
+    probe->entry_capacity = 0;
+    probe->sorted_count = 0;
+    probe->cache_dirty = false;
+    probe->paths = NULL;
+    probe->paths_size = 0;
+    probe->paths_capacity = 0;
+
+    mutex_init(&probe->mutex);
+
+    probe->cache_hits = 0;
+    probe->cache_misses = 0;
+
+    return probe;
+}
+
+void media_probe_set_limits(CMediaProbe** probe_ptr, int64_t probe_size, int64_t analyze_duration_us, int32_t keyframe_packets)
+{
+    (*probe_ptr)->probe_size = probe_size;
+    (*probe_ptr)->analyze_duration_us = analyze_duration_us;
+    (*probe_ptr)->keyframe_packets = keyframe_packets;
+}
+
+bool media_probe_file(CMediaProbe** probe_ptr, const char* path, CMediaInfo* info)
+{
+    CMediaProbe* probe = *probe_ptr;
+    int64_t file_size, modification_time;
+
+    memset(info, 0, sizeof(CMediaInfo));
+    if (!media_probe_stat(path, &file_size, &modification_time))
+        return false;
+
+    uint64_t path_hash = media_probe_hash_path(path);
+
+    mutex_lock(&probe->mutex);
+    int32_t index = media_probe_find_entry(probe, path_hash, path, (uint32_t)strlen(path));
+    if (index >= 0 && probe->entries[index].info.file_size == file_size && probe->entries[index].info.modification_time == modification_time)
+    {
+        *info = probe->entries[index].info;
+        info->from_cache = true;
+        probe->cache_hits++;
+        mutex_unlock(&probe->mutex);
+        return info->valid;
+    }
+    probe->cache_misses++;
+    mutex_unlock(&probe->mutex);
+
+    info->file_size = file_size;
+    info->modification_time = modification_time;
+    info->valid = media_probe_read(probe, path, info);
+
+    // Files that couldn't be opened are cached too, so they are not opened again until they change
+    mutex_lock(&probe->mutex);
+    media_probe_store_entry(probe, path_hash, path, info);
+    mutex_unlock(&probe->mutex);
+
+    return info->valid;
+}
+
+int32_t media_probe_files(CMediaProbe** probe_ptr, const char* const* paths, int32_t count, int32_t thread_count, CMediaInfo* infos)
+{
+    CMediaProbe* probe = *probe_ptr;
+    CMediaProbeJob* jobs = NULL;
+    CThreadPool* pool = NULL;
+    int32_t succeeded = 0;
+
+    if (count <= 0)
+        return 0;
+
+    if (!(jobs = (CMediaProbeJob*)allocator_malloc(sizeof(CMediaProbeJob) * count)))
+        return 0;
+
+    for (int32_t i = 0; i < count; i++)
+    {
+        jobs[i].probe = probe;
+        jobs[i].path = paths[i];
+        jobs[i].info = &infos[i];
+        jobs[i].result = false;
+    }
+
+    // Falls back to probing on the calling thread if workers couldn't be started
+    pool = thread_pool_alloc();
+    if (pool && thread_pool_start(&pool, thread_count, 0))
+    {
+        for (int32_t i = 0; i < count; i++)
+        {
+            if (!thread_pool_submit(&pool, media_probe_job, &jobs[i]))
+                media_probe_job(&jobs[i]);
+        }
+        thread_pool_wait(&pool);
+    }
+    else
+    {
+        for (int32_t i = 0; i < count; i++)
+            media_probe_job(&jobs[i]);
+    }
+    if (pool)
+        thread_pool_close(&pool);
+
+    for (int32_t i = 0; i < count; i++)
+        succeeded += jobs[i].result;
+    allocator_free(jobs);
+
+    mutex_lock(&probe->mutex);
+    media_probe_sort_cache(probe);
+    mutex_unlock(&probe->mutex);
+
+    return succeeded;
+}
+
+bool media_probe_load_cache(CMediaProbe** probe_ptr, const char* path)
+{
+    CMediaProbe* probe = *probe_ptr;
+    CMediaProbeCacheHeader header;
+    CMediaProbeCacheEntry* entries = NULL;
+    char* paths = NULL;
+    FILE* file = NULL;
+    bool result;
+
+    #ifdef _WIN32
+    if(fopen_s(&file, path, "rb") != 0)
+    #else
+    if(!(file = fopen(path, "rb")))
+    #endif
+        return false;
+
+    // Entries are stored as they are in memory, a different layout makes the cache invalid
+    result = fread(&header, sizeof(CMediaProbeCacheHeader), 1, file) == 1 &&
+        header.magic == MEDIA_PROBE_CACHE_MAGIC && header.version == MEDIA_PROBE_CACHE_VERSION &&
+        header.entry_size == sizeof(CMediaProbeCacheEntry) && header.entry_count > 0 &&
+        (entries = (CMediaProbeCacheEntry*)allocator_malloc(sizeof(CMediaProbeCacheEntry) * header.entry_count)) &&
+        fread(entries, sizeof(CMediaProbeCacheEntry), header.entry_count, file) == header.entry_count &&
+        header.paths_size > 0 && (paths = (char*)allocator_malloc(header.paths_size)) &&
+        fread(paths, 1, header.paths_size, file) == header.paths_size;
+    fclose(file);
+
+    for (uint32_t i = 0; result && i < header.entry_count; i++)
+        result = entries[i].path_offset <= header.paths_size && entries[i].path_length <= header.paths_size - entries[i].path_offset;
+
+    if (!result)
+    {
+        allocator_free(entries);
+        allocator_free(paths);
+        return false;
+    }
+
+    mutex_lock(&probe->mutex);
+    allocator_free(probe->entries);
+    allocator_free(probe->paths);
+    probe->entries = entries;
+    probe->entry_count = (int32_t)header.entry_count;
+    probe->entry_capacity = (int32_t)header.entry_count;
+    probe->paths = paths;
+    probe->paths_size = header.paths_size;
+    probe->paths_capacity = header.paths_size;
+    probe->sorted_count = 0;
+    media_probe_sort_cache(probe);
+    probe->cache_dirty = false;
+    mutex_unlock(&probe->mutex);
+
+    return true;
+}
+
+bool media_probe_save_cache(CMediaProbe** probe_ptr, const char* path)
+{
+    CMediaProbe* probe = *probe_ptr;
+    CMediaProbeCacheHeader header;
+    FILE* file = NULL;
+    bool result;
+
+    mutex_lock(&probe->mutex);
+    if (!probe->cache_dirty)
+    {
+        mutex_unlock(&probe->mutex);
+        return true;
+    }
+
+    media_probe_sort_cache(probe);
+
+    header.magic = MEDIA_PROBE_CACHE_MAGIC;
+    header.version = MEDIA_PROBE_CACHE_VERSION;
+    header.entry_size = sizeof(CMediaProbeCacheEntry);
+    header.entry_count = (uint32_t)probe->entry_count;
+    header.paths_size = probe->paths_size;
+
+    #ifdef _WIN32
+    if(fopen_s(&file, path, "wb") != 0)
+    #else
+    if(!(file = fopen(path, "wb")))
+    #endif
+    {
+        fprintf(stderr, "Cannot open probe cache file.\n");
+        mutex_unlock(&probe->mutex);
+        return false;
+    }
+
+    result = fwrite(&header, sizeof(CMediaProbeCacheHeader), 1, file) == 1 &&
+        fwrite(probe->entries, sizeof(CMediaProbeCacheEntry), probe->entry_count, file) == (size_t)probe->entry_count &&
+        fwrite(probe->paths, 1, probe->paths_size, file) == probe->paths_size;
+    result = fclose(file) == 0 && result;
+
+    if (result)
+        probe->cache_dirty = false;
+    else
+        fprintf(stderr, "Couldn't write probe cache file.\n");
+    mutex_unlock(&probe->mutex);
+
+    return result;
+}
+
+void media_probe_close(CMediaProbe** probe_ptr)
+{
+    CMediaProbe* probe = *probe_ptr;
+
+    if (!probe)
+        return;
+
+    allocator_free(probe->entries);
+    allocator_free(probe->paths);
+    mutex_destroy(&probe->mutex);
+    allocator_free(probe);
+    *probe_ptr = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,213 @@
+#ifndef AV_MEDIAPROBE
+#define AV_MEDIAPROBE
+
+#include <libavformat/avformat.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "Threading.h"
+
+#define MEDIA_PROBE_CACHE_MAGIC 0x43505645u
+#define MEDIA_PROBE_CACHE_VERSION 2
+
+/**
+ * Streams described per file, the rest are only counted.
+ */
+#define MEDIA_PROBE_MAX_STREAMS 8
+
+/**
+ * Default limits, probing reads at most this much of every file.
+ */
+#define MEDIA_PROBE_DEFAULT_PROBE_SIZE (1024 * 1024)
+#define MEDIA_PROBE_DEFAULT_ANALYZE_DURATION 500000
+#define MEDIA_PROBE_DEFAULT_KEYFRAME_PACKETS 300
+
+/**
+ * Metadata of a single container stream. Enums are stored as int32_t,
+ * so the structure keeps it's size in the cache file.
+ */
+typedef struct CMediaStreamInfo
+{
+    int32_t                 index;
+    int32_t                 type;
+    int32_t                 codec_id;
+    int32_t                 width, height;
+    AVRational              frame_rate;
+    int32_t                 sample_rate;
+    int32_t                 channels;
+    int64_t                 bit_rate;
+    int64_t                 duration_us;
+
+    /**
+     * Average distance between keyframes in seconds, 0 if fewer than two keyframes were found within the packet limit.
+     */
+    double                  keyframe_interval;
+} CMediaStreamInfo;
+
+/**
+ * Metadata of a media file. Cached copies are keyed by path, file size and modification time.
+ */
+typedef struct CMediaInfo
+{
+    int64_t                 file_size;
+    int64_t                 modification_time;
+
+    /**
+     * Short demuxer name, e.g. "mov,mp4,m4a,3gp,3g2,mj2".
+     */
+    char                    format_name[64];
+    int64_t                 duration_us;
+    int64_t                 bit_rate;
+
+    /**
+     * Number of streams in the container, only the first MEDIA_PROBE_MAX_STREAMS are described.
+     */
+    int32_t                 stream_count;
+    CMediaStreamInfo        streams[MEDIA_PROBE_MAX_STREAMS];
+
+    bool                    valid;
+    bool                    from_cache;
+} CMediaInfo;
+
+/**
+ * Cache record. Records are sorted by the path hash, the path itself is kept in the path table
+ * and compared on lookup, so colliding paths never share metadata.
+ */
+typedef struct CMediaProbeCacheEntry
+{
+    uint64_t                path_hash;
+    uint32_t                path_offset;
+    uint32_t                path_length;
+    CMediaInfo              info;
+} CMediaProbeCacheEntry;
+
+/**
+ * Header of the cache file, followed by entry_count records and paths_size bytes of the path table.
+ */
+typedef struct CMediaProbeCacheHeader
+{
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                entry_size;
+    uint32_t                entry_count;
+    uint32_t                paths_size;
+} CMediaProbeCacheHeader;
+
+/**
+ * Reads stream metadata of many files without opening decoders.
+ *
+ * Only the demuxer is opened with bounded probing, the keyframe interval is estimated
+ * from packet flags of the first video packets. Results are cached by path, size and
+ * modification time and the cache can be stored in a file, so probing a known set of
+ * files again takes a single stat per file.
+ */
+typedef struct CMediaProbe
+{
+    int64_t                 probe_size;
+    int64_t                 analyze_duration_us;
+    int32_t                 keyframe_packets;
+
+    /**
+     * Entries up to sorted_count are sorted by path_hash, entries added since are appended unsorted.
+     */
+    CMediaProbeCacheEntry*  entries;
+    int32_t                 entry_count;
+    int32_t                 entry_capacity;
+    int32_t                 sorted_count;
+    bool                    cache_dirty;
+
+    /**
+     * Paths of all entries without terminators, entries refer to them by offset.
+     */
+    char*                   paths;
+    uint32_t                paths_size;
+    uint32_t                paths_capacity;
+
+    /**
+     * Guards the cache, probing itself runs unlocked.
+     */
+    CMutex                  mutex;
+
+    int64_t                 cache_hits;
+    int64_t                 cache_misses;
+} CMediaProbe;
+
+/**
+ * Allocate an CMediaProbe and set its fields to default values.
+ *
+ * @return An CMediaProbe filled with default values or NULL on failure.
+ */
+CMediaProbe* media_probe_alloc(void);
+
+/**
+ * Sets how much of every file is read.
+ *
+ * @param probe_ptr Pointer to pointer to CMediaProbe structure.
+ *
+ * @param probe_size Bytes read to detect the format and streams.
+ *
+ * @param analyze_duration_us Media duration analyzed for stream parameters.
+ *
+ * @param keyframe_packets Video packets read to estimate the keyframe interval, 0 to skip the estimate.
+ */
+void media_probe_set_limits(CMediaProbe** probe_ptr, int64_t probe_size, int64_t analyze_duration_us, int32_t keyframe_packets);
+
+/**
+ * Reads metadata of a single file, from the cache if the file did not change. Safe to call from several threads.
+ *
+ * @param probe_ptr Pointer to pointer to CMediaProbe structure.
+ *
+ * @param path Path to the file.
+ *
+ * @param info Receives the metadata.
+ *
+ * @return Returns false if the file couldn't be opened.
+ */
+bool media_probe_file(CMediaProbe** probe_ptr, const char* path, CMediaInfo* info);
+
+/**
+ * Reads metadata of many files on a thread pool.
+ *
+ * @param probe_ptr Pointer to pointer to CMediaProbe structure.
+ *
+ * @param paths Paths to the files.
+ *
+ * @param count Number of files.
+ *
+ * @param thread_count Number of threads, 0 to use the number of logical processors.
+ *
+ * @param infos Receives metadata of every file, valid is false for files that couldn't be opened.
+ *
+ * @return Returns number of files probed successfully.
+ */
+int32_t media_probe_files(CMediaProbe** probe_ptr, const char* const* paths, int32_t count, int32_t thread_count, CMediaInfo* infos);
+
+/**
+ * Loads cached metadata stored by media_probe_save_cache.
+ *
+ * @param probe_ptr Pointer to pointer to CMediaProbe structure.
+ *
+ * @param path Path to the cache file.
+ *
+ * @return Returns false if the file is missing or was written by another version, the cache stays empty.
+ */
+bool media_probe_load_cache(CMediaProbe** probe_ptr, const char* path);
+
+/**
+ * Stores cached metadata, nothing is written if the cache did not change.
+ *
+ * @param probe_ptr Pointer to pointer to CMediaProbe structure.
+ *
+ * @param path Path to the cache file.
+ *
+ * @return Returns true if the cache is stored.
+ */
+bool media_probe_save_cache(CMediaProbe** probe_ptr, const char* path);
+
+/**
+ * Releases the cache and the probe.
+ *
+ * @param probe_ptr Pointer to pointer to CMediaProbe structure.
+ */
+void media_probe_close(CMediaProbe** probe_ptr);
+
+#endif
\ No newline at end of file
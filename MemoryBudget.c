@@ -0,0 +1,93 @@
+#include "MemoryBudget.h"
+#include <stdatomic.h>
+
+static atomic_size_t memory_limit = 0;
+static atomic_size_t memory_peak = 0;
+static atomic_size_t memory_total = 0;
+static atomic_size_t memory_usage[MEMORY_CATEGORY_COUNT];
+
+void memory_budget_set_limit(size_t limit_bytes)
+{
+    atomic_store(&memory_limit, limit_bytes);
+}
+
+size_t memory_budget_get_limit()
+{
+    return atomic_load(&memory_limit);
+}
+
+void memory_budget_acquire(enum EMemoryCategory category, size_t size)
+{
+    if(category >= MEMORY_CATEGORY_COUNT || size == 0)
+        return;
+
+    atomic_fetch_add(&memory_usage[category], size);
+    size_t total = atomic_fetch_add(&memory_total, size) + size;
+
+    size_t peak = atomic_load(&memory_peak);
+    while(total > peak && !atomic_compare_exchange_weak(&memory_peak, &peak, total));
+}
+
+void memory_budget_release(enum EMemoryCategory category, size_t size)
+{
+    if(category >= MEMORY_CATEGORY_COUNT || size == 0)
+        return;
+
+    atomic_fetch_sub(&memory_usage[category], size);
+    atomic_fetch_sub(&memory_total, size);
+}
+
+size_t memory_budget_get_usage(enum EMemoryCategory category)
+{
+    if(category >= MEMORY_CATEGORY_COUNT)
+        return 0;
+
+    return atomic_load(&memory_usage[category]);
+}
+
+size_t memory_budget_get_total_usage()
+{
+    return atomic_load(&memory_total);
+}
+
+void memory_budget_get_stats(CMemoryBudgetStats* stats)
+{
+    for(int32_t i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+        stats->usage[i] = atomic_load(&memory_usage[i]);
+
+    stats->total_usage = atomic_load(&memory_total);
+    stats->peak_usage = atomic_load(&memory_peak);
+    stats->limit = atomic_load(&memory_limit);
+}
+
+bool memory_budget_is_exceeded()
+{
+    size_t limit = atomic_load(&memory_limit);
+    return limit && atomic_load(&memory_total) > limit;
+}
+
+bool memory_budget_can_prefetch(size_t size)
+{
+    size_t limit = atomic_load(&memory_limit);
+    return !limit || atomic_load(&memory_total) + size <= limit;
+}
+
+int32_t memory_budget_queue_limit(int32_t nominal)
+{
+    size_t limit = atomic_load(&memory_limit);
+    if(!limit || nominal <= 1)
+        return nominal;
+
+    size_t total = atomic_load(&memory_total);
+    size_t soft_limit = limit - limit / 4;
+    if(total <= soft_limit)
+        return nominal;
+
+    if(total >= limit)
+        return 1;
+
+    // Shrink linearly between the soft limit and the budget
+    double headroom = (double)(limit - total) / (double)(limit - soft_limit);
+    int32_t capacity = (int32_t)(nominal * headroom);
+    return capacity < 1 ? 1 : capacity;
+}
@@ -0,0 +1,107 @@
+#ifndef AV_MEMORYBUDGET
+#define AV_MEMORYBUDGET
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Categories of memory tracked by the library.
+ * 
+ * Every allocation made for packets, decoded frames, converted frames or audio 
+ * samples is accounted in one of these categories, across all opened streams.
+ */
+enum EMemoryCategory
+{
+    MEMORY_CATEGORY_PACKETS = 0,
+    MEMORY_CATEGORY_DECODED_FRAMES,
+    MEMORY_CATEGORY_CONVERTED_FRAMES,
+    MEMORY_CATEGORY_AUDIO,
+    MEMORY_CATEGORY_COUNT
+};
+
+/**
+ * Snapshot of the process-wide memory accounting.
+ */
+typedef struct CMemoryBudgetStats
+{
+    size_t usage[MEMORY_CATEGORY_COUNT];
+    size_t total_usage;
+    size_t peak_usage;
+    size_t limit;
+} CMemoryBudgetStats;
+
+/**
+ * Sets the process-wide memory budget shared by all streams.
+ *
+ * @param limit_bytes Budget in bytes, 0 disables the limit.
+ */
+void memory_budget_set_limit(size_t limit_bytes);
+
+/**
+ * @return Returns the current process-wide budget in bytes, 0 if unlimited.
+ */
+size_t memory_budget_get_limit(void);
+
+/**
+ * Accounts newly allocated memory.
+ *
+ * @param category Category the memory belongs to.
+ *
+ * @param size Size of the allocation in bytes.
+ */
+void memory_budget_acquire(enum EMemoryCategory category, size_t size);
+
+/**
+ * Accounts released memory. Must mirror a previous memory_budget_acquire call.
+ *
+ * @param category Category the memory belongs to.
+ *
+ * @param size Size of the allocation in bytes.
+ */
+void memory_budget_release(enum EMemoryCategory category, size_t size);
+
+/**
+ * @return Returns the amount of memory currently accounted in category.
+ */
+size_t memory_budget_get_usage(enum EMemoryCategory category);
+
+/**
+ * @return Returns the amount of memory currently accounted in all categories.
+ */
+size_t memory_budget_get_total_usage(void);
+
+/**
+ * Fills a snapshot of the current accounting.
+ *
+ * @param stats Pointer to structure that receives the snapshot.
+ */
+void memory_budget_get_stats(CMemoryBudgetStats* stats);
+
+/**
+ * @return Returns true if the accounted memory is above the budget.
+ */
+bool memory_budget_is_exceeded(void);
+
+/**
+ * Checks whether an optional allocation (prefetching, read-ahead) fits into the budget.
+ *
+ * @param size Size of the planned allocation in bytes.
+ *
+ * @return Returns true if the allocation keeps usage below the budget.
+ */
+bool memory_budget_can_prefetch(size_t size);
+
+/**
+ * Scales the capacity of a queue with the current memory pressure.
+ * 
+ * Queues keep their nominal capacity while usage stays below three quarters 
+ * of the budget, then shrink linearly down to a single element.
+ *
+ * @param nominal Capacity of the queue when there is no memory pressure.
+ *
+ * @return Returns the capacity the queue should use right now.
+ */
+int32_t memory_budget_queue_limit(int32_t nominal);
+
+#endif
@@ -0,0 +1,386 @@
+#include "Playlist.h"
+#include "Allocator.h"
+#include "helpers.h"
+#include <libavutil/time.h>
+#include <string.h>
+
+#define PLAYLIST_DEFAULT_PREROLL_FRAMES 8
+
+static double playlist_file_start(CVideoFile* vfile)
+{
+    int64_t start_time = vfile->av_format_ctx->start_time;
+    return start_time != AV_NOPTS_VALUE ? start_time / (double)AV_TIME_BASE : 0.0;
+}
+
+static double playlist_frame_end(CDataStream* stream)
+{
+    double end = stream->pts * av_q2d(stream->time_base);
+
+    if (stream->stream_type == AVMEDIA_TYPE_VIDEO)
+        end += stream->frame_budget_us / 1000000.0;
+    else if (stream->av_codec_ctx->sample_rate > 0)
+        end += stream->nb_samples / (double)stream->av_codec_ctx->sample_rate;
+
+    return end;
+}
+
+static void playlist_deliver_frame(CPlaylist* playlist, CDataStream** stream_ptr, video_file_frame_callback_t callback)
+{
+    double end = playlist_frame_end(*stream_ptr) - playlist->item_start;
+    if (end > playlist->item_end)
+        playlist->item_end = end;
+
+    if (callback)
+        callback(stream_ptr, playlist->callback_user_data);
+}
+
+static void playlist_on_video_frame(CDataStream** stream_ptr, void* user_data)
+{
+    CPlaylist* playlist = (CPlaylist*)user_data;
+    playlist_deliver_frame(playlist, stream_ptr, playlist->on_video_frame);
+}
+
+static void playlist_on_audio_frame(CDataStream** stream_ptr, void* user_data)
+{
+    CPlaylist* playlist = (CPlaylist*)user_data;
+    playlist_deliver_frame(playlist, stream_ptr, playlist->on_audio_frame);
+}
+
+static bool playlist_open_item(CPlaylist* playlist, int32_t index, CVideoFile** vfile_ptr)
+{
+    *vfile_ptr = video_file_alloc();
+    if (!video_file_open_decode(vfile_ptr, playlist->items[index]))
+        return false;
+
+    CDataStream* vstream = (*vfile_ptr)->vstream;
+    if (vstream->av_codec_ctx)
+    {
+        vstream->av_output_pix_fmt = playlist->output_pix_fmt;
+        data_stream_set_frame_size(&(*vfile_ptr)->vstream,
+            playlist->output_width > 0 ? playlist->output_width : vstream->fwidth,
+            playlist->output_height > 0 ? playlist->output_height : vstream->fheight);
+    }
+
+    video_file_set_callbacks(vfile_ptr, playlist_on_video_frame, playlist_on_audio_frame, playlist);
+    return true;
+}
+
+static void playlist_free_preroll(CPlaylist* playlist)
+{
+    for (int32_t i = 0; i < playlist->preroll_count; i++)
+    {
+        memory_budget_release(MEMORY_CATEGORY_DECODED_FRAMES, playlist->preroll_frames[i].size);
+        av_frame_free(&playlist->preroll_frames[i].av_frame);
+    }
+    playlist->preroll_count = 0;
+}
+
+// Receives every frame the decoder has ready into the preroll queue, returns end time of the last one
+static double playlist_preroll_receive(CPlaylist* playlist, CDataStream** stream_ptr, int32_t* frame_count)
+{
+    CDataStream* stream = *stream_ptr;
+    double end = 0.0;
+
+    while (true)
+    {
+        AVFrame* av_frame = av_frame_alloc();
+        if (!av_frame || data_stream_receive_raw_frame(stream_ptr, av_frame) < 0)
+        {
+            av_frame_free(&av_frame);
+            break;
+        }
+
+        if (playlist->preroll_count == playlist->preroll_capacity)
+        {
+            playlist->preroll_capacity = playlist->preroll_capacity ? playlist->preroll_capacity * 2 : 32;
+            playlist->preroll_frames = (CPrerollFrame*)allocator_realloc(playlist->preroll_frames, sizeof(CPrerollFrame) * playlist->preroll_capacity);
+        }
+
+        CPrerollFrame* preroll_frame = &playlist->preroll_frames[playlist->preroll_count++];
+        preroll_frame->av_frame = av_frame;
+        preroll_frame->is_video = stream->stream_type == AVMEDIA_TYPE_VIDEO;
+        preroll_frame->size = frame_buffer_size(av_frame);
+        memory_budget_acquire(MEMORY_CATEGORY_DECODED_FRAMES, preroll_frame->size);
+
+        end = av_frame->pts * av_q2d(stream->time_base);
+        if (preroll_frame->is_video)
+            end += stream->frame_budget_us / 1000000.0;
+        else if (av_frame->sample_rate > 0)
+            end += av_frame->nb_samples / (double)av_frame->sample_rate;
+
+        (*frame_count)++;
+    }
+
+    return end;
+}
+
+static void playlist_preroll_routine(void* arg)
+{
+    CPlaylist* playlist = (CPlaylist*)arg;
+    int32_t video_frames = 0, audio_frames = 0;
+    double video_end = 0.0, audio_end = 0.0;
+
+    if (!playlist_open_item(playlist, playlist->next_index, &playlist->next))
+    {
+        playlist->preroll_failed = true;
+        return;
+    }
+
+    CVideoFile* vfile = playlist->next;
+    bool has_video = vfile->vstream->av_codec_ctx != NULL;
+    bool has_audio = vfile->astream->av_codec_ctx != NULL;
+    int32_t target_frames = memory_budget_queue_limit(playlist->preroll_video_frames);
+
+    while (true)
+    {
+        bool enough_video = !has_video || video_frames >= target_frames;
+        bool enough_audio = !has_audio || (has_video ? audio_end >= video_end : audio_frames >= target_frames);
+        if (enough_video && enough_audio)
+            break;
+
+        if (av_read_frame(vfile->av_format_ctx, vfile->av_packet) < 0)
+        {
+            // Short file, the whole item is decoded ahead
+            vfile->demuxer_eof = true;
+            if (has_video && data_stream_send_packet(&vfile->vstream, NULL) >= 0)
+                playlist_preroll_receive(playlist, &vfile->vstream, &video_frames);
+            if (has_audio && data_stream_send_packet(&vfile->astream, NULL) >= 0)
+                playlist_preroll_receive(playlist, &vfile->astream, &audio_frames);
+            break;
+        }
+
+        CDataStream** stream_ptr = video_file_get_stream(&vfile, vfile->av_packet->stream_index);
+        if (stream_ptr)
+        {
+            bool is_video = stream_ptr == &vfile->vstream;
+            int32_t* frame_count = is_video ? &video_frames : &audio_frames;
+            double* end = is_video ? &video_end : &audio_end;
+            double received_end;
+
+            while (data_stream_send_packet(stream_ptr, vfile->av_packet) == AVERROR(EAGAIN))
+            {
+                if ((received_end = playlist_preroll_receive(playlist, stream_ptr, frame_count)) > *end)
+                    *end = received_end;
+            }
+
+            if ((received_end = playlist_preroll_receive(playlist, stream_ptr, frame_count)) > *end)
+                *end = received_end;
+        }
+
+        av_packet_unref(vfile->av_packet);
+    }
+}
+
+static void playlist_start_preroll(CPlaylist* playlist)
+{
+    if (playlist->current_index + 1 >= playlist->item_count)
+        return;
+
+    playlist->next_index = playlist->current_index + 1;
+    playlist->next = NULL;
+    playlist->preroll_failed = false;
+
+    if (!(playlist->preroll_running = thread_start(&playlist->preroll_thread, playlist_preroll_routine, playlist)))
+        playlist_preroll_routine(playlist);
+}
+
+static void playlist_wait_preroll(CPlaylist* playlist)
+{
+    if (playlist->preroll_running)
+    {
+        thread_join(&playlist->preroll_thread);
+        playlist->preroll_running = false;
+    }
+}
+
+static bool playlist_switch(CPlaylist* playlist)
+{
+    CVideoFile* previous = playlist->current;
+
+    playlist_wait_preroll(playlist);
+
+    // Items that fail to open are skipped
+    while (playlist->next_index > playlist->current_index && playlist->preroll_failed)
+    {
+        fprintf(stderr, "Couldn't open playlist item %s\n", playlist->items[playlist->next_index]);
+        playlist_free_preroll(playlist);
+        if (playlist->next)
+            video_file_close(&playlist->next);
+
+        playlist->current_index = playlist->next_index;
+        playlist_start_preroll(playlist);
+        playlist_wait_preroll(playlist);
+    }
+
+    if (!playlist->next)
+        return false;
+
+    playlist->item_offset += playlist->item_end;
+    playlist->current = playlist->next;
+    playlist->current_index = playlist->next_index;
+    playlist->next = NULL;
+    playlist->item_start = playlist_file_start(playlist->current);
+    playlist->item_end = 0.0;
+
+    data_stream_adopt_converters(&playlist->current->vstream, &previous->vstream);
+    data_stream_adopt_converters(&playlist->current->astream, &previous->astream);
+    video_file_close(&previous);
+
+    // Pre-decoded frames go out right after the last frames of the previous item
+    for (int32_t i = 0; i < playlist->preroll_count; i++)
+    {
+        CPrerollFrame* preroll_frame = &playlist->preroll_frames[i];
+        CDataStream** stream_ptr = preroll_frame->is_video ? &playlist->current->vstream : &playlist->current->astream;
+
+        if (data_stream_convert_frame(stream_ptr, preroll_frame->av_frame))
+        {
+            if (preroll_frame->is_video)
+                playlist_on_video_frame(stream_ptr, playlist);
+            else
+                playlist_on_audio_frame(stream_ptr, playlist);
+        }
+    }
+    playlist_free_preroll(playlist);
+
+    playlist_start_preroll(playlist);
+    return true;
+}
+
+CPlaylist* playlist_alloc()
+{
+    CPlaylist* playlist = NULL;
+    playlist = (CPlaylist*)allocator_malloc(sizeof(CPlaylist));
+
+    playlist->items = NULL;
+    playlist->item_count = 0;
+    playlist->item_capacity = 0;
+    playlist->current_index = -1;
+    playlist->current = NULL;
+    playlist->next_index = -1;
+    playlist->next = NULL;
+    playlist->preroll_running = false;
+    playlist->preroll_failed = false;
+    playlist->preroll_frames = NULL;
+    playlist->preroll_count = 0;
+    playlist->preroll_capacity = 0;
+    playlist->preroll_video_frames = PLAYLIST_DEFAULT_PREROLL_FRAMES;
+    playlist->output_width = 0;
+    playlist->output_height = 0;
+    playlist->output_pix_fmt = AV_PIX_FMT_RGB0;
+    playlist->item_offset = 0.0;
+    playlist->item_start = 0.0;
+    playlist->item_end = 0.0;
+    playlist->on_video_frame = NULL;
+    playlist->on_audio_frame = NULL;
+    playlist->callback_user_data = NULL;
+
+    return playlist;
+}
+
+void playlist_add(CPlaylist** playlist_ptr, const char* filepath)
+{
+    CPlaylist* playlist = *playlist_ptr;
+
+    if (playlist->item_count == playlist->item_capacity)
+    {
+        playlist->item_capacity = playlist->item_capacity ? playlist->item_capacity * 2 : 8;
+        playlist->items = (char**)allocator_realloc(playlist->items, sizeof(char*) * playlist->item_capacity);
+    }
+
+    playlist->items[playlist->item_count++] = allocator_strdup(filepath);
+}
+
+void playlist_set_output(CPlaylist** playlist_ptr, int32_t width, int32_t height, enum AVPixelFormat pix_fmt)
+{
+    CPlaylist* playlist = *playlist_ptr;
+    playlist->output_width = width;
+    playlist->output_height = height;
+    playlist->output_pix_fmt = pix_fmt;
+}
+
+void playlist_set_preroll(CPlaylist** playlist_ptr, int32_t video_frames)
+{
+    (*playlist_ptr)->preroll_video_frames = video_frames > 0 ? video_frames : 1;
+}
+
+void playlist_set_callbacks(CPlaylist** playlist_ptr, video_file_frame_callback_t on_video_frame, video_file_frame_callback_t on_audio_frame, void* user_data)
+{
+    CPlaylist* playlist = *playlist_ptr;
+    playlist->on_video_frame = on_video_frame;
+    playlist->on_audio_frame = on_audio_frame;
+    playlist->callback_user_data = user_data;
+}
+
+bool playlist_start(CPlaylist** playlist_ptr)
+{
+    CPlaylist* playlist = *playlist_ptr;
+
+    for (int32_t i = 0; i < playlist->item_count; i++)
+    {
+        if (playlist_open_item(playlist, i, &playlist->current))
+        {
+            playlist->current_index = i;
+            playlist->item_start = playlist_file_start(playlist->current);
+            playlist_start_preroll(playlist);
+            return true;
+        }
+
+        fprintf(stderr, "Couldn't open playlist item %s\n", playlist->items[i]);
+        video_file_close(&playlist->current);
+    }
+
+    return false;
+}
+
+enum EPumpStatus playlist_pump(CPlaylist** playlist_ptr, int64_t budget_us)
+{
+    CPlaylist* playlist = *playlist_ptr;
+    int64_t deadline = av_gettime_relative() + budget_us;
+
+    if (!playlist->current)
+        return PUMP_STATUS_ERROR;
+
+    while (true)
+    {
+        int64_t remaining = deadline - av_gettime_relative();
+        enum EPumpStatus status = video_file_pump(&playlist->current, remaining > 0 ? remaining : 0);
+        if (status != PUMP_STATUS_END_OF_FILE)
+            return status;
+
+        if (!playlist_switch(playlist))
+            return PUMP_STATUS_END_OF_FILE;
+
+        if (av_gettime_relative() >= deadline)
+            return PUMP_STATUS_PENDING;
+    }
+}
+
+double playlist_get_time(CPlaylist** playlist_ptr, CDataStream** stream_ptr)
+{
+    CPlaylist* playlist = *playlist_ptr;
+    return playlist->item_offset + data_stream_get_pt_seconds(stream_ptr) - playlist->item_start;
+}
+
+void playlist_close(CPlaylist** playlist_ptr)
+{
+    CPlaylist* playlist = *playlist_ptr;
+
+    if (!playlist)
+        return;
+
+    playlist_wait_preroll(playlist);
+    playlist_free_preroll(playlist);
+
+    if (playlist->next)
+        video_file_close(&playlist->next);
+    if (playlist->current)
+        video_file_close(&playlist->current);
+
+    for (int32_t i = 0; i < playlist->item_count; i++)
+        allocator_free(playlist->items[i]);
+
+    allocator_free(playlist->items);
+    allocator_free(playlist->preroll_frames);
+    allocator_free(playlist);
+    *playlist_ptr = NULL;
+}
\ No newline at end of file
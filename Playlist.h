@@ -0,0 +1,162 @@
+#ifndef AV_PLAYLIST
+#define AV_PLAYLIST
+
+#include "VideoFile.h"
+#include "Threading.h"
+
+/**
+ * Decoded but not converted frame of the next playlist item.
+ */
+typedef struct CPrerollFrame
+{
+    AVFrame*                av_frame;
+    bool                    is_video;
+    size_t                  size;
+} CPrerollFrame;
+
+/**
+ * Queue of video files played one after another without gaps.
+ * 
+ * While the current item plays, the next one is opened and it's first frames 
+ * are decoded on a background thread. At the boundary the pre-decoded frames 
+ * are delivered right after the last frames of the current item, and the scaler, 
+ * resampler and output buffers are handed over when formats match.
+ */
+typedef struct CPlaylist
+{
+    char**                  items;
+    int32_t                 item_count;
+    int32_t                 item_capacity;
+
+    int32_t                 current_index;
+    CVideoFile*             current;
+
+    /**
+     * Next item, owned by the preroll thread while preroll_running is set.
+     */
+    int32_t                 next_index;
+    CVideoFile*             next;
+    CThread                 preroll_thread;
+    bool                    preroll_running;
+    bool                    preroll_failed;
+
+    /**
+     * Frames decoded ahead for the next item, in decoding order.
+     */
+    CPrerollFrame*          preroll_frames;
+    int32_t                 preroll_count;
+    int32_t                 preroll_capacity;
+
+    /**
+     * Number of video frames decoded ahead, reduced under memory pressure.
+     */
+    int32_t                 preroll_video_frames;
+
+    /**
+     * Output settings applied to every item.
+     */
+    int32_t                 output_width, output_height;
+    enum AVPixelFormat      output_pix_fmt;
+
+    /**
+     * Timeline position where the current item starts, and the end of it's last delivered frame, in seconds.
+     */
+    double                  item_offset;
+    double                  item_start;
+    double                  item_end;
+
+    video_file_frame_callback_t on_video_frame;
+    video_file_frame_callback_t on_audio_frame;
+    void*                   callback_user_data;
+} CPlaylist;
+
+/**
+ * Allocate an CPlaylist and set its fields to default values.
+ *
+ * @return An CPlaylist filled with default values or NULL on failure.
+ */
+CPlaylist* playlist_alloc(void);
+
+/**
+ * Appends a file to the end of the playlist.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @param filepath Path to video file.
+ */
+void playlist_add(CPlaylist** playlist_ptr, const char* filepath);
+
+/**
+ * Sets output size and pixel format of converted video frames for every item.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @param width Output width.
+ *
+ * @param height Output height.
+ *
+ * @param pix_fmt Output pixel format.
+ */
+void playlist_set_output(CPlaylist** playlist_ptr, int32_t width, int32_t height, enum AVPixelFormat pix_fmt);
+
+/**
+ * Sets number of video frames decoded ahead for the next item.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @param video_frames Number of frames, audio is decoded ahead for the same duration.
+ */
+void playlist_set_preroll(CPlaylist** playlist_ptr, int32_t video_frames);
+
+/**
+ * Sets callbacks called for every converted frame of every item.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @param on_video_frame Called for every video frame, may be NULL.
+ *
+ * @param on_audio_frame Called for every audio frame, may be NULL.
+ *
+ * @param user_data Pointer passed to callbacks.
+ */
+void playlist_set_callbacks(CPlaylist** playlist_ptr, video_file_frame_callback_t on_video_frame, video_file_frame_callback_t on_audio_frame, void* user_data);
+
+/**
+ * Opens the first item and starts pre-rolling the second one.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @return Returns true if the first item was opened.
+ */
+bool playlist_start(CPlaylist** playlist_ptr);
+
+/**
+ * Decodes the current item within the time budget and switches to the next one at it's end.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @param budget_us Time budget in microseconds.
+ *
+ * @return Returns PUMP_STATUS_END_OF_FILE after the last item.
+ */
+enum EPumpStatus playlist_pump(CPlaylist** playlist_ptr, int64_t budget_us);
+
+/**
+ * Converts timestamp of the last frame of stream into continuous playlist time.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ *
+ * @param stream_ptr Stream passed to frame callback.
+ *
+ * @return Returns time in seconds since the beginning of the first item.
+ */
+double playlist_get_time(CPlaylist** playlist_ptr, CDataStream** stream_ptr);
+
+/**
+ * Stops preroll, closes opened items and releases the playlist.
+ *
+ * @param playlist_ptr Pointer to pointer to CPlaylist structure.
+ */
+void playlist_close(CPlaylist** playlist_ptr);
+
+#endif
@@ -0,0 +1,494 @@
+#include "Recorder.h"
+#include "Allocator.h"
+#include "MemoryBudget.h"
+#include <libswscale/swscale.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RECORDER_ROW_ALIGNMENT 64
+
+static size_t recorder_slot_memory(CRecorder* recorder, CRecorderSlot* slot)
+{
+    return (size_t)slot->source_linesize * recorder->height + slot->buffer_size;
+}
+
+static void recorder_convert_job(void* arg)
+{
+    CRecorderSlot* slot = (CRecorderSlot*)arg;
+    CRecorder* recorder = slot->recorder;
+    int64_t start_time = av_gettime_relative();
+
+    // Bottom-up frames are read from the last row with negative stride
+    const uint8_t* source[4] = { slot->source, NULL, NULL, NULL };
+    int source_linesize[4] = { slot->source_linesize, 0, 0, 0 };
+    if (recorder->flip_vertical)
+    {
+        source[0] = slot->source + (size_t)slot->source_linesize * (recorder->height - 1);
+        source_linesize[0] = -slot->source_linesize;
+    }
+
+    sws_scale(slot->sws_ctx, source, source_linesize, 0, recorder->height, slot->av_frame->data, slot->av_frame->linesize);
+
+    mutex_lock(&recorder->mutex);
+    slot->state = RECORDER_SLOT_CONVERTED;
+    recorder->convert_time_us += av_gettime_relative() - start_time;
+    condition_broadcast(&recorder->frame_converted);
+    mutex_unlock(&recorder->mutex);
+}
+
+static bool recorder_encode(CRecorder* recorder, AVFrame* av_frame)
+{
+    int64_t start_time = av_gettime_relative();
+    bool result = data_stream_encode(&recorder->encoder, av_frame) >= 0;
+
+    mutex_lock(&recorder->mutex);
+    recorder->encode_time_us += av_gettime_relative() - start_time;
+    recorder->stats.frames_encoded++;
+    mutex_unlock(&recorder->mutex);
+
+    return result;
+}
+
+// Slots are encoded strictly in submission order, conversions may finish in any order
+static CRecorderSlot* recorder_wait_next_slot(CRecorder* recorder)
+{
+    mutex_lock(&recorder->mutex);
+    while (true)
+    {
+        for (int32_t i = 0; i < recorder->slot_count; i++)
+        {
+            CRecorderSlot* slot = &recorder->slots[i];
+            if (slot->state == RECORDER_SLOT_CONVERTED && slot->sequence == recorder->encode_sequence)
+            {
+                mutex_unlock(&recorder->mutex);
+                return slot;
+            }
+        }
+
+        if (recorder->stopping && recorder->encode_sequence == recorder->submit_sequence)
+        {
+            mutex_unlock(&recorder->mutex);
+            return NULL;
+        }
+
+        condition_wait(&recorder->frame_converted, &recorder->mutex);
+    }
+}
+
+static void recorder_encode_thread(void* arg)
+{
+    CRecorder* recorder = (CRecorder*)arg;
+    CRecorderSlot* slot;
+
+    while ((slot = recorder_wait_next_slot(recorder)))
+    {
+        bool result = true;
+
+        if (recorder->policy == RECORDER_POLICY_DUPLICATE && recorder->repeat_valid)
+        {
+            for (int64_t pts = recorder->last_encoded_pts + 1; result && pts < slot->pts; pts++)
+            {
+                recorder->repeat_frame->pts = pts;
+                result = recorder_encode(recorder, recorder->repeat_frame);
+
+                mutex_lock(&recorder->mutex);
+                recorder->stats.frames_duplicated++;
+                mutex_unlock(&recorder->mutex);
+            }
+        }
+
+        slot->av_frame->pts = slot->pts;
+        if (result)
+            result = recorder_encode(recorder, slot->av_frame);
+        recorder->last_encoded_pts = slot->pts;
+
+        // The slot is handed back right after encoding, keep a copy for the gaps
+        if (result && recorder->policy == RECORDER_POLICY_DUPLICATE)
+            recorder->repeat_valid = av_frame_copy(recorder->repeat_frame, slot->av_frame) >= 0;
+
+        mutex_lock(&recorder->mutex);
+        if (!result)
+            recorder->failed = true;
+        slot->state = RECORDER_SLOT_FREE;
+        recorder->encode_sequence++;
+        recorder->stats.queue_depth--;
+        mutex_unlock(&recorder->mutex);
+    }
+}
+
+static bool recorder_alloc_frame(CRecorder* recorder, AVFrame** av_frame_ptr, uint8_t** buffer_ptr, size_t* size_ptr)
+{
+    enum AVPixelFormat pix_fmt = recorder->encoder->av_output_pix_fmt;
+    int size = av_image_get_buffer_size(pix_fmt, recorder->width, recorder->height, RECORDER_ROW_ALIGNMENT);
+    AVFrame* av_frame = av_frame_alloc();
+
+    *av_frame_ptr = av_frame;
+    if (!av_frame || size <= 0 || !(*buffer_ptr = (uint8_t*)allocator_aligned_malloc(size, ALLOCATOR_DEFAULT_ALIGNMENT)))
+        return false;
+
+    av_frame->format = pix_fmt;
+    av_frame->width = recorder->width;
+    av_frame->height = recorder->height;
+    av_image_fill_arrays(av_frame->data, av_frame->linesize, *buffer_ptr, pix_fmt, recorder->width, recorder->height, RECORDER_ROW_ALIGNMENT);
+    if (size_ptr)
+        *size_ptr = (size_t)size;
+
+    return true;
+}
+
+static bool recorder_init_slot(CRecorder* recorder, CRecorderSlot* slot)
+{
+    slot->recorder = recorder;
+    slot->source_linesize = FFALIGN(av_image_get_linesize(recorder->source_pix_fmt, recorder->width, 0), RECORDER_ROW_ALIGNMENT);
+    slot->source = (uint8_t*)allocator_aligned_malloc((size_t)slot->source_linesize * recorder->height, ALLOCATOR_DEFAULT_ALIGNMENT);
+    if (!slot->source || !recorder_alloc_frame(recorder, &slot->av_frame, &slot->buffer, &slot->buffer_size))
+        return false;
+
+    slot->sws_ctx = sws_getContext(
+        recorder->width, recorder->height, recorder->source_pix_fmt,
+        recorder->width, recorder->height, recorder->encoder->av_output_pix_fmt,
+        SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (!slot->sws_ctx)
+        return false;
+
+    memory_budget_acquire(MEMORY_CATEGORY_CONVERTED_FRAMES, recorder_slot_memory(recorder, slot));
+    return true;
+}
+
+static void recorder_free_slots(CRecorder* recorder)
+{
+    for (int32_t i = 0; i < recorder->slot_count; i++)
+    {
+        CRecorderSlot* slot = &recorder->slots[i];
+
+        if (slot->sws_ctx)
+            memory_budget_release(MEMORY_CATEGORY_CONVERTED_FRAMES, recorder_slot_memory(recorder, slot));
+        sws_freeContext(slot->sws_ctx);
+        av_frame_free(&slot->av_frame);
+        allocator_free(slot->buffer);
+        allocator_free(slot->source);
+    }
+
+    allocator_free(recorder->slots);
+    recorder->slots = NULL;
+    recorder->slot_count = 0;
+
+    av_frame_free(&recorder->repeat_frame);
+    allocator_free(recorder->repeat_buffer);
+    recorder->repeat_buffer = NULL;
+}
+
+CRecorder* recorder_alloc()
+{
+    CRecorder* recorder = NULL;
+    recorder = (CRecorder*)allocator_malloc(sizeof(CRecorder));
+
+    if (!recorder)
+    {
+        fprintf(stderr, "Couldn't allocate recorder.\n");
+        return NULL;
+    }
+
+    recorder->encoder = NULL;
+    recorder->width = 0;
+    recorder->height = 0;
+    recorder->frame_rate = av_make_q(0, 1);
+    recorder->bit_rate = 0;
+    recorder->fragment_duration_us = 0;
+    recorder->source_pix_fmt = AV_PIX_FMT_RGBA;
+    recorder->flip_vertical = false;
+    recorder->policy = RECORDER_POLICY_DROP;
+
+    recorder->slots = NULL;
+    recorder->slot_count = 0;
+    recorder->acquired_slot = -1;
+
+    recorder->convert_pool = NULL;
+    recorder->running = false;
+    recorder->stopping = false;
+    recorder->failed = false;
+
+    mutex_init(&recorder->mutex);
+    condition_init(&recorder->frame_converted);
+
+    recorder->submit_sequence = 0;
+    recorder->encode_sequence = 0;
+    recorder->start_time_us = AV_NOPTS_VALUE;
+    recorder->last_submitted_pts = AV_NOPTS_VALUE;
+    recorder->last_encoded_pts = AV_NOPTS_VALUE;
+
+    recorder->repeat_frame = NULL;
+    recorder->repeat_buffer = NULL;
+    recorder->repeat_valid = false;
+
+    memset(&recorder->stats, 0, sizeof(CRecorderStats));
+    recorder->convert_time_us = 0;
+    recorder->encode_time_us = 0;
+
+    return recorder;
+}
+
+void recorder_set_source_format(CRecorder** recorder_ptr, enum AVPixelFormat pix_fmt, bool flip_vertical)
+{
+    (*recorder_ptr)->source_pix_fmt = pix_fmt;
+    (*recorder_ptr)->flip_vertical = flip_vertical;
+}
+
+void recorder_set_policy(CRecorder** recorder_ptr, enum ERecorderPolicy policy)
+{
+    (*recorder_ptr)->policy = policy;
+}
+
+void recorder_set_bit_rate(CRecorder** recorder_ptr, int64_t bit_rate)
+{
+    (*recorder_ptr)->bit_rate = bit_rate;
+}
+
+void recorder_set_fragmented_output(CRecorder** recorder_ptr, int64_t fragment_duration_us)
+{
+    (*recorder_ptr)->fragment_duration_us = fragment_duration_us;
+}
+
+bool recorder_start(CRecorder** recorder_ptr, const char* filename, enum AVCodecID codec_id, int32_t width, int32_t height,
+    AVRational frame_rate, int32_t slot_count, int32_t convert_threads)
+{
+    CRecorder* recorder = *recorder_ptr;
+
+    if (recorder->running || width < 2 || height < 2 || frame_rate.num <= 0 || frame_rate.den <= 0)
+    {
+        fprintf(stderr, "Invalid recorder settings.\n");
+        return false;
+    }
+
+    if (convert_threads <= 0)
+        convert_threads = FFMAX(thread_hardware_concurrency() / 2, 1);
+    if (slot_count <= 0)
+        slot_count = convert_threads * 2 + 2;
+
+    recorder->width = width & ~1;
+    recorder->height = height & ~1;
+    recorder->frame_rate = frame_rate;
+
+    recorder->encoder = data_stream_alloc();
+    if (!recorder->encoder)
+        return false;
+
+    data_stream_set_frame_size(&recorder->encoder, recorder->width, recorder->height);
+    data_stream_set_time_base(&recorder->encoder, av_inv_q(frame_rate));
+    data_stream_set_bit_rate(&recorder->encoder, recorder->bit_rate);
+    data_stream_set_encoder_preset(&recorder->encoder, RECORDER_ENCODER_PRESET);
+    data_stream_set_fragmented_output(&recorder->encoder, recorder->fragment_duration_us);
+
+    if (!data_stream_initialize_encode(&recorder->encoder, filename, codec_id, AVMEDIA_TYPE_VIDEO, false))
+        goto fail;
+
+    recorder->slots = (CRecorderSlot*)allocator_malloc(sizeof(CRecorderSlot) * slot_count);
+    if (!recorder->slots)
+        goto fail;
+    memset(recorder->slots, 0, sizeof(CRecorderSlot) * slot_count);
+    recorder->slot_count = slot_count;
+
+    for (int32_t i = 0; i < slot_count; i++)
+    {
+        if (!recorder_init_slot(recorder, &recorder->slots[i]))
+        {
+            fprintf(stderr, "Couldn't allocate recorder slot.\n");
+            goto fail;
+        }
+    }
+
+    if (recorder->policy == RECORDER_POLICY_DUPLICATE && !recorder_alloc_frame(recorder, &recorder->repeat_frame, &recorder->repeat_buffer, NULL))
+        goto fail;
+
+    // Every slot is queued at most once, so the queue never fills and submitting never blocks
+    recorder->convert_pool = thread_pool_alloc();
+    if (!recorder->convert_pool || !thread_pool_start(&recorder->convert_pool, convert_threads, slot_count))
+        goto fail;
+
+    recorder->stopping = false;
+    recorder->failed = false;
+    recorder->submit_sequence = 0;
+    recorder->encode_sequence = 0;
+    recorder->start_time_us = AV_NOPTS_VALUE;
+    recorder->last_submitted_pts = AV_NOPTS_VALUE;
+    recorder->last_encoded_pts = AV_NOPTS_VALUE;
+    recorder->repeat_valid = false;
+    if (!thread_start(&recorder->encode_thread, recorder_encode_thread, recorder))
+    {
+        fprintf(stderr, "Couldn't start encoder thread.\n");
+        goto fail;
+    }
+
+    recorder->running = true;
+    return true;
+
+    fail:
+        if (recorder->convert_pool)
+            thread_pool_close(&recorder->convert_pool);
+        recorder_free_slots(recorder);
+        data_stream_close(&recorder->encoder);
+
+    return false;
+}
+
+bool recorder_acquire_frame(CRecorder** recorder_ptr, uint8_t** data, int* linesize)
+{
+    CRecorder* recorder = *recorder_ptr;
+    CRecorderSlot* slot = NULL;
+
+    if (!recorder->running || recorder->acquired_slot >= 0)
+        return false;
+
+    mutex_lock(&recorder->mutex);
+    for (int32_t i = 0; i < recorder->slot_count && !recorder->failed; i++)
+    {
+        if (recorder->slots[i].state == RECORDER_SLOT_FREE)
+        {
+            slot = &recorder->slots[i];
+            slot->state = RECORDER_SLOT_WRITING;
+            recorder->acquired_slot = i;
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        recorder->stats.frames_submitted++;
+        recorder->stats.frames_dropped++;
+    }
+    mutex_unlock(&recorder->mutex);
+
+    if (!slot)
+        return false;
+
+    *data = slot->source;
+    *linesize = slot->source_linesize;
+    return true;
+}
+
+bool recorder_submit_frame(CRecorder** recorder_ptr, int64_t timestamp_us)
+{
+    CRecorder* recorder = *recorder_ptr;
+
+    if (recorder->acquired_slot < 0)
+        return false;
+
+    CRecorderSlot* slot = &recorder->slots[recorder->acquired_slot];
+    recorder->acquired_slot = -1;
+
+    if (recorder->start_time_us == AV_NOPTS_VALUE)
+        recorder->start_time_us = timestamp_us;
+    int64_t pts = av_rescale_q(timestamp_us - recorder->start_time_us, AV_TIME_BASE_Q, av_inv_q(recorder->frame_rate));
+
+    mutex_lock(&recorder->mutex);
+    recorder->stats.frames_submitted++;
+
+    // Encoder timestamps must grow, a frame rendered faster than the recording rate is not needed
+    if (recorder->last_submitted_pts != AV_NOPTS_VALUE && pts <= recorder->last_submitted_pts)
+    {
+        slot->state = RECORDER_SLOT_FREE;
+        recorder->stats.frames_dropped++;
+        mutex_unlock(&recorder->mutex);
+        return false;
+    }
+
+    slot->pts = pts;
+    slot->sequence = recorder->submit_sequence;
+    slot->state = RECORDER_SLOT_CONVERTING;
+
+    if (!thread_pool_try_submit(&recorder->convert_pool, recorder_convert_job, slot))
+    {
+        slot->state = RECORDER_SLOT_FREE;
+        recorder->stats.frames_dropped++;
+        mutex_unlock(&recorder->mutex);
+        return false;
+    }
+
+    recorder->submit_sequence++;
+    recorder->last_submitted_pts = pts;
+    recorder->stats.queue_depth++;
+    recorder->stats.max_queue_depth = FFMAX(recorder->stats.max_queue_depth, recorder->stats.queue_depth);
+    mutex_unlock(&recorder->mutex);
+
+    return true;
+}
+
+bool recorder_write_frame(CRecorder** recorder_ptr, const uint8_t* data, int linesize, int64_t timestamp_us)
+{
+    CRecorder* recorder = *recorder_ptr;
+    uint8_t* slot_data;
+    int slot_linesize;
+
+    if (!recorder_acquire_frame(recorder_ptr, &slot_data, &slot_linesize))
+        return false;
+
+    av_image_copy_plane(slot_data, slot_linesize, data, linesize,
+        av_image_get_linesize(recorder->source_pix_fmt, recorder->width, 0), recorder->height);
+
+    return recorder_submit_frame(recorder_ptr, timestamp_us);
+}
+
+void recorder_get_stats(CRecorder** recorder_ptr, CRecorderStats* stats)
+{
+    CRecorder* recorder = *recorder_ptr;
+
+    mutex_lock(&recorder->mutex);
+    *stats = recorder->stats;
+    int64_t converted = recorder->stats.frames_encoded - recorder->stats.frames_duplicated + recorder->stats.queue_depth;
+    stats->average_convert_time_us = converted > 0 ? recorder->convert_time_us / converted : 0;
+    stats->average_encode_time_us = recorder->stats.frames_encoded > 0 ? recorder->encode_time_us / recorder->stats.frames_encoded : 0;
+    mutex_unlock(&recorder->mutex);
+}
+
+bool recorder_stop(CRecorder** recorder_ptr)
+{
+    CRecorder* recorder = *recorder_ptr;
+
+    if (!recorder->running)
+        return !recorder->failed;
+
+    // A frame acquired and never submitted is dropped
+    if (recorder->acquired_slot >= 0)
+    {
+        mutex_lock(&recorder->mutex);
+        recorder->slots[recorder->acquired_slot].state = RECORDER_SLOT_FREE;
+        recorder->acquired_slot = -1;
+        mutex_unlock(&recorder->mutex);
+    }
+
+    mutex_lock(&recorder->mutex);
+    recorder->stopping = true;
+    condition_broadcast(&recorder->frame_converted);
+    mutex_unlock(&recorder->mutex);
+
+    // Encoder thread leaves once every submitted frame was converted and encoded
+    thread_join(&recorder->encode_thread);
+    thread_pool_close(&recorder->convert_pool);
+    recorder->running = false;
+
+    if (!recorder->failed && data_stream_encode(&recorder->encoder, NULL) < 0)
+        recorder->failed = true;
+
+    recorder_free_slots(recorder);
+    data_stream_close(&recorder->encoder);
+
+    return !recorder->failed;
+}
+
+void recorder_close(CRecorder** recorder_ptr)
+{
+    CRecorder* recorder = *recorder_ptr;
+
+    if (!recorder)
+        return;
+
+    recorder_stop(recorder_ptr);
+
+    condition_destroy(&recorder->frame_converted);
+    mutex_destroy(&recorder->mutex);
+
+    allocator_free(recorder);
+    *recorder_ptr = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,291 @@
+#ifndef AV_RECORDER
+#define AV_RECORDER
+
+#include "DataStream.h"
+#include "ThreadPool.h"
+#include "Threading.h"
+
+/**
+ * H.264 preset used by the recorder, slower presets can't keep up with real time.
+ */
+#define RECORDER_ENCODER_PRESET "veryfast"
+
+/**
+ * What happens with time the recorder had to drop frames for.
+ *
+ * Frames are dropped in both cases when every slot is busy, the render thread never waits.
+ */
+enum ERecorderPolicy
+{
+    /**
+     * Dropped frames are left out, the recording gets shorter than the session.
+     */
+    RECORDER_POLICY_DROP = 0,
+
+    /**
+     * The last encoded frame is repeated until the next one, the recording keeps wall clock duration.
+     */
+    RECORDER_POLICY_DUPLICATE
+};
+
+/**
+ * Slot states. The render thread moves slots FREE -> WRITING -> CONVERTING,
+ * a worker moves them to CONVERTED and the encoder thread back to FREE.
+ */
+enum ERecorderSlotState
+{
+    RECORDER_SLOT_FREE = 0,
+    RECORDER_SLOT_WRITING,
+    RECORDER_SLOT_CONVERTING,
+    RECORDER_SLOT_CONVERTED
+};
+
+struct CRecorder;
+
+/**
+ * Single frame travelling from the render thread to the encoder.
+ */
+typedef struct CRecorderSlot
+{
+    struct CRecorder*       recorder;
+
+    /**
+     * Source frame written by the render thread.
+     */
+    uint8_t*                source;
+    int                     source_linesize;
+
+    /**
+     * Frame in the encoder pixel format, converted by a worker.
+     */
+    AVFrame*                av_frame;
+    uint8_t*                buffer;
+    size_t                  buffer_size;
+
+    /**
+     * Every slot has it's own scaler, workers convert several slots at once.
+     */
+    struct SwsContext*      sws_ctx;
+
+    enum ERecorderSlotState state;
+    int64_t                 pts;
+    uint64_t                sequence;
+} CRecorderSlot;
+
+typedef struct CRecorderStats
+{
+    int64_t                 frames_submitted;
+    int64_t                 frames_encoded;
+    int64_t                 frames_dropped;
+    int64_t                 frames_duplicated;
+
+    /**
+     * Frames submitted and not encoded yet.
+     */
+    int32_t                 queue_depth;
+    int32_t                 max_queue_depth;
+
+    int64_t                 average_convert_time_us;
+    int64_t                 average_encode_time_us;
+} CRecorderStats;
+
+/**
+ * Records frames rendered by the engine into a video file.
+ *
+ * The render thread copies or reads back a frame into a free slot and returns at once,
+ * workers convert slots into the encoder pixel format in parallel and a dedicated
+ * thread encodes them in submission order. The number of slots bounds the memory
+ * and the latency, a frame without a free slot is dropped.
+ */
+typedef struct CRecorder
+{
+    CDataStream*            encoder;
+    int32_t                 width, height;
+    AVRational              frame_rate;
+    int64_t                 bit_rate;
+    int64_t                 fragment_duration_us;
+    enum AVPixelFormat      source_pix_fmt;
+    bool                    flip_vertical;
+    enum ERecorderPolicy    policy;
+
+    CRecorderSlot*          slots;
+    int32_t                 slot_count;
+
+    /**
+     * Slot returned by recorder_acquire_frame and not submitted yet, -1 if none.
+     */
+    int32_t                 acquired_slot;
+
+    CThreadPool*            convert_pool;
+    CThread                 encode_thread;
+    bool                    running;
+    bool                    stopping;
+    bool                    failed;
+
+    /**
+     * Guards slot states, sequences and stats.
+     */
+    CMutex                  mutex;
+    CCondition              frame_converted;
+
+    /**
+     * Sequence of the next submitted frame and of the next frame to encode.
+     */
+    uint64_t                submit_sequence;
+    uint64_t                encode_sequence;
+
+    /**
+     * Timestamp of the first frame, frame timestamps are relative to it.
+     */
+    int64_t                 start_time_us;
+    int64_t                 last_submitted_pts;
+    int64_t                 last_encoded_pts;
+
+    /**
+     * Copy of the last encoded frame, repeated by RECORDER_POLICY_DUPLICATE.
+     */
+    AVFrame*                repeat_frame;
+    uint8_t*                repeat_buffer;
+    bool                    repeat_valid;
+
+    CRecorderStats          stats;
+    int64_t                 convert_time_us;
+    int64_t                 encode_time_us;
+} CRecorder;
+
+/**
+ * Allocate an CRecorder and set its fields to default values.
+ *
+ * @return An CRecorder filled with default values or NULL on failure.
+ */
+CRecorder* recorder_alloc(void);
+
+/**
+ * Sets pixel format of frames passed by the engine. Must be called before recorder_start.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param pix_fmt Packed source format, AV_PIX_FMT_RGBA by default.
+ *
+ * @param flip_vertical Set for bottom-up frames read back from OpenGL render targets.
+ */
+void recorder_set_source_format(CRecorder** recorder_ptr, enum AVPixelFormat pix_fmt, bool flip_vertical);
+
+/**
+ * Sets what happens with dropped frames. Must be called before recorder_start.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param policy Drop policy, RECORDER_POLICY_DROP by default.
+ */
+void recorder_set_policy(CRecorder** recorder_ptr, enum ERecorderPolicy policy);
+
+/**
+ * Sets target bit rate of the encoder. Must be called before recorder_start.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param bit_rate Bit rate in bits per second, 0 to use the codec default.
+ */
+void recorder_set_bit_rate(CRecorder** recorder_ptr, int64_t bit_rate);
+
+/**
+ * Writes the recording as fragmented MP4 a player can open while recording goes on. Must be called before recorder_start.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param fragment_duration_us Longest fragment in microseconds, 0 to write raw codec output.
+ */
+void recorder_set_fragmented_output(CRecorder** recorder_ptr, int64_t fragment_duration_us);
+
+/**
+ * Opens the encoder and starts conversion and encoder threads.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param filename Output file, the encoded elementary stream or fragmented MP4 is written into it.
+ *
+ * @param codec_id Encoder codec.
+ *
+ * @param width Frame width, rounded down to even number.
+ *
+ * @param height Frame height, rounded down to even number.
+ *
+ * @param frame_rate Frame rate of the recording.
+ *
+ * @param slot_count Number of frames in flight, 0 to use twice the number of workers plus two.
+ *
+ * @param convert_threads Number of conversion workers, 0 to use half of the logical processors.
+ *
+ * @return Returns true if recording was started.
+ */
+bool recorder_start(CRecorder** recorder_ptr, const char* filename, enum AVCodecID codec_id, int32_t width, int32_t height,
+    AVRational frame_rate, int32_t slot_count, int32_t convert_threads);
+
+/**
+ * Reserves a free slot the engine reads the next frame back into.
+ * Only one frame may be acquired at a time.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param data Receives pointer to the slot buffer.
+ *
+ * @param linesize Receives stride of the slot buffer.
+ *
+ * @return Returns false if every slot is busy and the frame must be dropped.
+ */
+bool recorder_acquire_frame(CRecorder** recorder_ptr, uint8_t** data, int* linesize);
+
+/**
+ * Queues the acquired frame for conversion and encoding.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param timestamp_us Time the frame was rendered at in microseconds, frames falling into
+ * the same frame interval as the previous one are dropped.
+ *
+ * @return Returns false if the frame was dropped.
+ */
+bool recorder_submit_frame(CRecorder** recorder_ptr, int64_t timestamp_us);
+
+/**
+ * Copies a frame into a free slot and queues it, same as recorder_acquire_frame and recorder_submit_frame.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param data Frame in the source format.
+ *
+ * @param linesize Frame stride.
+ *
+ * @param timestamp_us Time the frame was rendered at in microseconds.
+ *
+ * @return Returns false if the frame was dropped.
+ */
+bool recorder_write_frame(CRecorder** recorder_ptr, const uint8_t* data, int linesize, int64_t timestamp_us);
+
+/**
+ * Copies recording statistics.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @param stats Receives statistics.
+ */
+void recorder_get_stats(CRecorder** recorder_ptr, CRecorderStats* stats);
+
+/**
+ * Encodes every submitted frame, flushes the encoder and stops the threads.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ *
+ * @return Returns false if encoding failed.
+ */
+bool recorder_stop(CRecorder** recorder_ptr);
+
+/**
+ * Stops recording and releases the recorder.
+ *
+ * @param recorder_ptr Pointer to pointer to CRecorder structure.
+ */
+void recorder_close(CRecorder** recorder_ptr);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,377 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "SharedFrameRing.h"
+#include "Allocator.h"
+#include <libavutil/imgutils.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#define SHARED_RING_SUPPORTED 1
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHARED_RING_SUPPORTED 1
+#else
+#define SHARED_RING_SUPPORTED 0
+#endif
+
+#define SHARED_RING_ALIGNMENT 64
+
+static size_t shared_ring_header_size(uint32_t slot_count)
+{
+    size_t header_size = sizeof(CSharedRingHeader) + slot_count * sizeof(CSharedSlotHeader);
+    return FFALIGN(header_size, SHARED_RING_ALIGNMENT);
+}
+
+static bool shared_ring_map(CSharedFrameRing* ring, size_t size, bool create)
+{
+    #if defined(_WIN32)
+    if(create)
+        ring->mapping_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), ring->name);
+    else
+        ring->mapping_handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, ring->name);
+
+    if(!ring->mapping_handle)
+    {
+        fprintf(stderr, "Couldn't open shared memory mapping.\n");
+        return false;
+    }
+
+    ring->header = (CSharedRingHeader*)MapViewOfFile(ring->mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(!ring->header)
+    {
+        fprintf(stderr, "Couldn't map shared memory.\n");
+        return false;
+    }
+
+    if(!size)
+    {
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(ring->header, &info, sizeof(info));
+        size = info.RegionSize;
+    }
+    #elif SHARED_RING_SUPPORTED
+    if(ring->fd < 0)
+    {
+        if(ring->name)
+            ring->fd = shm_open(ring->name, create ? O_CREAT | O_RDWR : O_RDWR, 0600);
+        #ifdef MFD_CLOEXEC
+        else if(create)
+            ring->fd = memfd_create("evpl_frame_ring", MFD_CLOEXEC);
+        #endif
+    }
+
+    if(ring->fd < 0)
+    {
+        fprintf(stderr, "Couldn't open shared memory object.\n");
+        return false;
+    }
+
+    if(create && ftruncate(ring->fd, (off_t)size) < 0)
+    {
+        fprintf(stderr, "Couldn't resize shared memory object.\n");
+        return false;
+    }
+
+    if(!size)
+    {
+        struct stat info;
+        if(fstat(ring->fd, &info) < 0 || info.st_size < (off_t)sizeof(CSharedRingHeader))
+        {
+            fprintf(stderr, "Invalid shared memory object.\n");
+            return false;
+        }
+        size = (size_t)info.st_size;
+    }
+
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Couldn't map shared memory.\n");
+        return false;
+    }
+    ring->header = (CSharedRingHeader*)mapping;
+    #else
+    (void)create;
+    fprintf(stderr, "Shared memory is not supported on this platform.\n");
+    return false;
+    #endif
+
+    ring->mapped_size = size;
+    return true;
+}
+
+static bool shared_ring_validate(CSharedFrameRing* ring)
+{
+    CSharedRingHeader* header = ring->header;
+
+    if(atomic_load_explicit(&header->magic, memory_order_acquire) != SHARED_RING_MAGIC || header->version != SHARED_RING_VERSION)
+    {
+        fprintf(stderr, "Shared memory does not contain frame ring.\n");
+        return false;
+    }
+
+    if(header->data_offset + (uint64_t)header->slot_count * header->slot_size > ring->mapped_size)
+    {
+        fprintf(stderr, "Shared frame ring is truncated.\n");
+        return false;
+    }
+
+    ring->data = (uint8_t*)header + header->data_offset;
+    return true;
+}
+
+CSharedFrameRing* shared_ring_alloc()
+{
+    CSharedFrameRing* ring = NULL;
+    ring = (CSharedFrameRing*)allocator_malloc(sizeof(CSharedFrameRing));
+
+    ring->header = NULL;
+    ring->data = NULL;
+    ring->mapped_size = 0;
+    ring->is_writer = false;
+    ring->name = NULL;
+    #ifdef _WIN32
+    ring->mapping_handle = NULL;
+    #else
+    ring->fd = -1;
+    #endif
+    ring->next_slot = 0;
+    ring->sequence = 0;
+
+    return ring;
+}
+
+bool shared_ring_create(CSharedFrameRing** ring_ptr, const char* name, int32_t slot_count, int32_t width, int32_t height, enum AVPixelFormat pix_fmt, AVRational time_base)
+{
+    CSharedFrameRing* ring = *ring_ptr;
+    int linesize[4] = {0};
+    uint8_t* planes[4] = {NULL};
+
+    if(slot_count < 2 || width <= 0 || height <= 0)
+    {
+        fprintf(stderr, "Invalid shared frame ring parameters.\n");
+        return false;
+    }
+
+    if(av_image_fill_linesizes(linesize, pix_fmt, width) < 0)
+    {
+        fprintf(stderr, "Unsupported shared frame ring pixel format.\n");
+        return false;
+    }
+
+    for(int32_t i = 0; i < 4; i++)
+        linesize[i] = FFALIGN(linesize[i], SHARED_RING_ALIGNMENT);
+
+    int frame_size = av_image_fill_pointers(planes, pix_fmt, height, NULL, linesize);
+    if(frame_size < 0)
+        return false;
+
+    size_t slot_size = FFALIGN((size_t)frame_size, SHARED_RING_ALIGNMENT);
+    size_t header_size = shared_ring_header_size(slot_count);
+
+    if(name)
+        ring->name = allocator_strdup(name);
+    ring->is_writer = true;
+
+    if(!shared_ring_map(ring, header_size + slot_size * slot_count, true))
+        return false;
+
+    CSharedRingHeader* header = ring->header;
+    memset(header, 0, header_size);
+    header->version = SHARED_RING_VERSION;
+    header->slot_count = slot_count;
+    header->slot_size = (uint32_t)slot_size;
+    header->data_offset = header_size;
+    header->width = width;
+    header->height = height;
+    header->pix_fmt = pix_fmt;
+    header->time_base = time_base;
+    ring->data = (uint8_t*)header + header_size;
+
+    av_image_fill_pointers(planes, pix_fmt, height, ring->data, linesize);
+    for(int32_t i = 0; i < 4; i++)
+    {
+        header->linesize[i] = linesize[i];
+        header->plane_offset[i] = planes[i] ? (int32_t)(planes[i] - ring->data) : -1;
+    }
+
+    for(int32_t i = 0; i < slot_count; i++)
+        atomic_init(&header->slots[i].state, SHARED_SLOT_EMPTY);
+    atomic_init(&header->write_sequence, 0);
+
+    // Readers treat the ring as valid only after magic is published
+    atomic_store_explicit(&header->magic, SHARED_RING_MAGIC, memory_order_release);
+    return true;
+}
+
+bool shared_ring_open(CSharedFrameRing** ring_ptr, const char* name)
+{
+    CSharedFrameRing* ring = *ring_ptr;
+
+    ring->name = allocator_strdup(name);
+    ring->is_writer = false;
+
+    return shared_ring_map(ring, 0, false) && shared_ring_validate(ring);
+}
+
+#ifndef _WIN32
+bool shared_ring_open_fd(CSharedFrameRing** ring_ptr, int fd)
+{
+    CSharedFrameRing* ring = *ring_ptr;
+
+    ring->fd = fd;
+    ring->is_writer = false;
+
+    return shared_ring_map(ring, 0, false) && shared_ring_validate(ring);
+}
+
+int shared_ring_get_fd(CSharedFrameRing** ring_ptr)
+{
+    return (*ring_ptr)->fd;
+}
+#endif
+
+bool shared_ring_begin_write(CSharedFrameRing** ring_ptr, int32_t* slot, uint8_t* data[4], int linesize[4])
+{
+    CSharedFrameRing* ring = *ring_ptr;
+    CSharedRingHeader* header = ring->header;
+    uint32_t slot_count = header->slot_count;
+
+    // Prefer free slots, then overwrite the oldest frame the reader did not take
+    static const uint32_t writable_states[] = { SHARED_SLOT_EMPTY, SHARED_SLOT_READY };
+
+    for(int32_t s = 0; s < 2; s++)
+    {
+        for(uint32_t i = 0; i < slot_count; i++)
+        {
+            uint32_t index = (ring->next_slot + i) % slot_count;
+            uint32_t expected = writable_states[s];
+
+            if(!atomic_compare_exchange_strong_explicit(&header->slots[index].state, &expected, SHARED_SLOT_WRITING, memory_order_acquire, memory_order_relaxed))
+                continue;
+
+            uint8_t* slot_data = ring->data + (size_t)index * header->slot_size;
+            for(int32_t p = 0; p < 4; p++)
+            {
+                data[p] = header->plane_offset[p] >= 0 ? slot_data + header->plane_offset[p] : NULL;
+                linesize[p] = header->linesize[p];
+            }
+
+            *slot = (int32_t)index;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void shared_ring_end_write(CSharedFrameRing** ring_ptr, int32_t slot, int64_t pts)
+{
+    CSharedFrameRing* ring = *ring_ptr;
+    CSharedRingHeader* header = ring->header;
+    CSharedSlotHeader* slot_header = &header->slots[slot];
+
+    slot_header->pts = pts;
+    slot_header->sequence = ++ring->sequence;
+    atomic_store_explicit(&slot_header->state, SHARED_SLOT_READY, memory_order_release);
+    atomic_store_explicit(&header->write_sequence, ring->sequence, memory_order_release);
+
+    ring->next_slot = (slot + 1) % header->slot_count;
+}
+
+bool shared_ring_acquire_frame(CSharedFrameRing** ring_ptr, CSharedFrame* frame)
+{
+    CSharedFrameRing* ring = *ring_ptr;
+    CSharedRingHeader* header = ring->header;
+
+    if(atomic_load_explicit(&header->write_sequence, memory_order_acquire) <= ring->sequence)
+        return false;
+
+    while(true)
+    {
+        int32_t newest = -1;
+        uint64_t newest_sequence = ring->sequence;
+
+        for(uint32_t i = 0; i < header->slot_count; i++)
+        {
+            CSharedSlotHeader* slot_header = &header->slots[i];
+            if(atomic_load_explicit(&slot_header->state, memory_order_acquire) == SHARED_SLOT_READY && slot_header->sequence > newest_sequence)
+            {
+                newest = (int32_t)i;
+                newest_sequence = slot_header->sequence;
+            }
+        }
+
+        if(newest < 0)
+            return false;
+
+        uint32_t expected = SHARED_SLOT_READY;
+        if(!atomic_compare_exchange_strong_explicit(&header->slots[newest].state, &expected, SHARED_SLOT_READING, memory_order_acquire, memory_order_relaxed))
+            continue;
+
+        // The writer could have replaced the frame between the scan and the exchange
+        CSharedSlotHeader* slot_header = &header->slots[newest];
+        if(slot_header->sequence <= ring->sequence)
+        {
+            atomic_store_explicit(&slot_header->state, SHARED_SLOT_READY, memory_order_release);
+            return false;
+        }
+
+        const uint8_t* slot_data = ring->data + (size_t)newest * header->slot_size;
+        for(int32_t p = 0; p < 4; p++)
+        {
+            frame->data[p] = header->plane_offset[p] >= 0 ? slot_data + header->plane_offset[p] : NULL;
+            frame->linesize[p] = header->linesize[p];
+        }
+        frame->width = header->width;
+        frame->height = header->height;
+        frame->format = (enum AVPixelFormat)header->pix_fmt;
+        frame->time_base = header->time_base;
+        frame->pts = slot_header->pts;
+        frame->sequence = slot_header->sequence;
+        frame->slot = newest;
+
+        ring->sequence = slot_header->sequence;
+        return true;
+    }
+}
+
+void shared_ring_release_frame(CSharedFrameRing** ring_ptr, const CSharedFrame* frame)
+{
+    CSharedRingHeader* header = (*ring_ptr)->header;
+    atomic_store_explicit(&header->slots[frame->slot].state, SHARED_SLOT_EMPTY, memory_order_release);
+}
+
+void shared_ring_close(CSharedFrameRing** ring_ptr)
+{
+    CSharedFrameRing* ring = *ring_ptr;
+
+    if(!ring)
+        return;
+
+    #if defined(_WIN32)
+    if(ring->header)
+        UnmapViewOfFile(ring->header);
+    if(ring->mapping_handle)
+        CloseHandle(ring->mapping_handle);
+    #elif SHARED_RING_SUPPORTED
+    if(ring->header)
+        munmap(ring->header, ring->mapped_size);
+    if(ring->fd >= 0)
+        close(ring->fd);
+    if(ring->is_writer && ring->name)
+        shm_unlink(ring->name);
+    #endif
+
+    if(ring->name)
+        allocator_free(ring->name);
+    allocator_free(ring);
+    *ring_ptr = NULL;
+}
@@ -0,0 +1,217 @@
+#ifndef AV_SHAREDFRAMERING
+#define AV_SHAREDFRAMERING
+
+#include <libavutil/avutil.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHARED_RING_MAGIC 0x52465645u
+#define SHARED_RING_VERSION 1
+
+/**
+ * Slot states. A writer moves slots EMPTY/READY -> WRITING -> READY, 
+ * a reader moves them READY -> READING -> EMPTY.
+ */
+enum ESharedSlotState
+{
+    SHARED_SLOT_EMPTY = 0,
+    SHARED_SLOT_WRITING,
+    SHARED_SLOT_READY,
+    SHARED_SLOT_READING
+};
+
+/**
+ * Per slot header stored in shared memory.
+ */
+typedef struct CSharedSlotHeader
+{
+    _Atomic uint32_t        state;
+    uint32_t                reserved;
+    int64_t                 pts;
+    uint64_t                sequence;
+} CSharedSlotHeader;
+
+/**
+ * Header placed at the beginning of the shared memory block. 
+ * Describes the frame format and the state of every slot.
+ */
+typedef struct CSharedRingHeader
+{
+    _Atomic uint32_t        magic;
+    uint32_t                version;
+    uint32_t                slot_count;
+    uint32_t                slot_size;
+    uint64_t                data_offset;
+    int32_t                 width, height;
+    int32_t                 pix_fmt;
+    int32_t                 linesize[4];
+    int32_t                 plane_offset[4];
+    AVRational              time_base;
+
+    /**
+     * Sequence number of the last published frame.
+     */
+    _Atomic uint64_t        write_sequence;
+
+    CSharedSlotHeader       slots[];
+} CSharedRingHeader;
+
+/**
+ * Frame acquired by a reader. Data points directly into shared memory 
+ * and stays valid until shared_ring_release_frame.
+ */
+typedef struct CSharedFrame
+{
+    const uint8_t*          data[4];
+    int32_t                 linesize[4];
+    int32_t                 width, height;
+    enum AVPixelFormat      format;
+    int64_t                 pts;
+    AVRational              time_base;
+    uint64_t                sequence;
+    int32_t                 slot;
+} CSharedFrame;
+
+/**
+ * Ring of converted frames in memory shared between processes.
+ * 
+ * The decoding process converts frames straight into ring slots, the rendering 
+ * process maps the same memory and reads them without any extra copies. 
+ * The writer never waits for the reader: if there is no free slot, the oldest 
+ * unread frame is overwritten or the new frame is dropped.
+ */
+typedef struct CSharedFrameRing
+{
+    CSharedRingHeader*      header;
+    uint8_t*                data;
+    size_t                  mapped_size;
+    bool                    is_writer;
+
+    /**
+     * Name of shared memory object, NULL for anonymous memory.
+     */
+    char*                   name;
+
+    #ifdef _WIN32
+    void*                   mapping_handle;
+    #else
+    int                     fd;
+    #endif
+
+    uint32_t                next_slot;
+    uint64_t                sequence;
+} CSharedFrameRing;
+
+/**
+ * Allocate an CSharedFrameRing and set its fields to default values.
+ *
+ * @return An CSharedFrameRing filled with default values or NULL on failure.
+ */
+CSharedFrameRing* shared_ring_alloc(void);
+
+/**
+ * Creates shared memory and initializes the ring as writer.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param name Name of shared memory object. NULL creates anonymous memfd on linux, 
+ * it's descriptor can be passed to another process with shared_ring_get_fd.
+ *
+ * @param slot_count Number of frames in the ring, at least 2.
+ *
+ * @param width Width of the converted frame.
+ *
+ * @param height Height of the converted frame.
+ *
+ * @param pix_fmt Pixel format of the converted frame.
+ *
+ * @param time_base Time base of frame timestamps.
+ *
+ * @return Returns true if initialization was successful.
+ */
+bool shared_ring_create(CSharedFrameRing** ring_ptr, const char* name, int32_t slot_count, int32_t width, int32_t height, enum AVPixelFormat pix_fmt, AVRational time_base);
+
+/**
+ * Maps shared memory created by another process and initializes the ring as reader.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param name Name of shared memory object.
+ *
+ * @return Returns true if initialization was successful.
+ */
+bool shared_ring_open(CSharedFrameRing** ring_ptr, const char* name);
+
+#ifndef _WIN32
+/**
+ * Maps shared memory received as file descriptor and initializes the ring as reader.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param fd File descriptor of shared memory. The ring takes ownership of it.
+ *
+ * @return Returns true if initialization was successful.
+ */
+bool shared_ring_open_fd(CSharedFrameRing** ring_ptr, int fd);
+
+/**
+ * @return Returns file descriptor of shared memory for passing to another process.
+ */
+int shared_ring_get_fd(CSharedFrameRing** ring_ptr);
+#endif
+
+/**
+ * Reserves a slot for the next frame.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param slot Receives index of reserved slot.
+ *
+ * @param data Receives plane pointers inside the slot.
+ *
+ * @param linesize Receives plane strides.
+ *
+ * @return Returns false if every slot is being read and the frame must be dropped.
+ */
+bool shared_ring_begin_write(CSharedFrameRing** ring_ptr, int32_t* slot, uint8_t* data[4], int linesize[4]);
+
+/**
+ * Publishes the frame written into reserved slot.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param slot Index of slot returned by shared_ring_begin_write.
+ *
+ * @param pts Presentation timestamp of the frame.
+ */
+void shared_ring_end_write(CSharedFrameRing** ring_ptr, int32_t slot, int64_t pts);
+
+/**
+ * Acquires the newest frame that was not read yet.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param frame Receives the frame description.
+ *
+ * @return Returns false if there is no new frame.
+ */
+bool shared_ring_acquire_frame(CSharedFrameRing** ring_ptr, CSharedFrame* frame);
+
+/**
+ * Returns the slot of acquired frame back to the writer.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ *
+ * @param frame Frame returned by shared_ring_acquire_frame.
+ */
+void shared_ring_release_frame(CSharedFrameRing** ring_ptr, const CSharedFrame* frame);
+
+/**
+ * Unmaps shared memory and releases the ring. The writer also removes the named object.
+ *
+ * @param ring_ptr Pointer to pointer to CSharedFrameRing structure.
+ */
+void shared_ring_close(CSharedFrameRing** ring_ptr);
+
+#endif
@@ -0,0 +1,458 @@
+#include "TextureEncoder.h"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_ENCODER_SSE2 1
+#else
+#define TEXTURE_ENCODER_SSE2 0
+#endif
+
+/**
+ * YUV to RGB coefficients in 16.16 fixed point.
+ */
+typedef struct CTextureColorMatrix
+{
+    int32_t                 y_offset;
+    int32_t                 y_scale;
+    int32_t                 v_r, u_g, v_g, u_b;
+} CTextureColorMatrix;
+
+/**
+ * Pixels of a single 4x4 block, luma in rows and 2x2 chroma samples.
+ */
+typedef struct CTextureBlock
+{
+    uint8_t                 y[16];
+    uint8_t                 u[4], v[4];
+    uint8_t                 y_min, y_max;
+    int32_t                 min_index, max_index;
+} CTextureBlock;
+
+typedef void (*texture_encode_block_t)(const CTextureBlock* block, const CTextureColorMatrix* matrix, uint8_t* output);
+
+static const int32_t texture_etc_modifiers[8][2] =
+{
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+static CTextureColorMatrix texture_color_matrix(enum AVColorSpace colorspace, enum AVColorRange color_range)
+{
+    bool bt709 = colorspace == AVCOL_SPC_BT709;
+    CTextureColorMatrix matrix;
+
+    if (color_range == AVCOL_RANGE_JPEG)
+    {
+        matrix.y_offset = 0;
+        matrix.y_scale = 65536;
+        matrix.v_r = bt709 ? 103206 : 91881;
+        matrix.u_g = bt709 ? 12276 : 22553;
+        matrix.v_g = bt709 ? 30679 : 46802;
+        matrix.u_b = bt709 ? 121609 : 116130;
+    }
+    else
+    {
+        matrix.y_offset = 16;
+        matrix.y_scale = 76309;
+        matrix.v_r = bt709 ? 117489 : 104597;
+        matrix.u_g = bt709 ? 13975 : 25675;
+        matrix.v_g = bt709 ? 34925 : 53279;
+        matrix.u_b = bt709 ? 138438 : 132201;
+    }
+
+    return matrix;
+}
+
+static int32_t texture_clamp(int32_t value)
+{
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static void texture_yuv_to_rgb(const CTextureColorMatrix* matrix, int32_t y, int32_t u, int32_t v, int32_t rgb[3])
+{
+    int32_t luma = (y - matrix->y_offset) * matrix->y_scale + 32768;
+
+    u -= 128;
+    v -= 128;
+    rgb[0] = texture_clamp((luma + matrix->v_r * v) >> 16);
+    rgb[1] = texture_clamp((luma - matrix->u_g * u - matrix->v_g * v) >> 16);
+    rgb[2] = texture_clamp((luma + matrix->u_b * u) >> 16);
+}
+
+// Chroma sample covering pixel of the block
+static int32_t texture_chroma_index(int32_t pixel)
+{
+    return ((pixel >> 3) << 1) | ((pixel & 3) >> 1);
+}
+
+static int32_t texture_lowest_bit(uint32_t mask)
+{
+    #if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+    #else
+    int32_t index = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+    #endif
+}
+
+// Moves bit i of the 16 bit mask to bit 2i
+static uint32_t texture_spread_bits(uint32_t mask)
+{
+    mask = (mask | (mask << 8)) & 0x00FF00FFu;
+    mask = (mask | (mask << 4)) & 0x0F0F0F0Fu;
+    mask = (mask | (mask << 2)) & 0x33333333u;
+    mask = (mask | (mask << 1)) & 0x55555555u;
+    return mask;
+}
+
+static void texture_load_block(CTextureBlock* block, uint8_t* const planes[3], const int linesize[3], int32_t width, int32_t height, int32_t block_x, int32_t block_y)
+{
+    int32_t x0 = block_x * 4, y0 = block_y * 4;
+
+    if (x0 + 4 <= width && y0 + 4 <= height)
+    {
+        for (int32_t row = 0; row < 4; row++)
+            memcpy(&block->y[row * 4], planes[0] + (ptrdiff_t)(y0 + row) * linesize[0] + x0, 4);
+
+        for (int32_t row = 0; row < 2; row++)
+        {
+            memcpy(&block->u[row * 2], planes[1] + (ptrdiff_t)(y0 / 2 + row) * linesize[1] + x0 / 2, 2);
+            memcpy(&block->v[row * 2], planes[2] + (ptrdiff_t)(y0 / 2 + row) * linesize[2] + x0 / 2, 2);
+        }
+        return;
+    }
+
+    // Blocks over the edge repeat the last row and column
+    int32_t chroma_width = (width + 1) >> 1, chroma_height = (height + 1) >> 1;
+
+    for (int32_t row = 0; row < 4; row++)
+    {
+        for (int32_t column = 0; column < 4; column++)
+            block->y[row * 4 + column] = planes[0][(ptrdiff_t)FFMIN(y0 + row, height - 1) * linesize[0] + FFMIN(x0 + column, width - 1)];
+    }
+
+    for (int32_t row = 0; row < 2; row++)
+    {
+        for (int32_t column = 0; column < 2; column++)
+        {
+            ptrdiff_t chroma_y = FFMIN(y0 / 2 + row, chroma_height - 1), chroma_x = FFMIN(x0 / 2 + column, chroma_width - 1);
+            block->u[row * 2 + column] = planes[1][chroma_y * linesize[1] + chroma_x];
+            block->v[row * 2 + column] = planes[2][chroma_y * linesize[2] + chroma_x];
+        }
+    }
+}
+
+static void texture_block_luma_range(CTextureBlock* block)
+{
+    #if TEXTURE_ENCODER_SSE2
+    __m128i luma = _mm_loadu_si128((const __m128i*)block->y);
+    __m128i low = _mm_min_epu8(luma, _mm_srli_si128(luma, 8));
+    __m128i high = _mm_max_epu8(luma, _mm_srli_si128(luma, 8));
+
+    low = _mm_min_epu8(low, _mm_srli_si128(low, 4));
+    high = _mm_max_epu8(high, _mm_srli_si128(high, 4));
+    low = _mm_min_epu8(low, _mm_srli_si128(low, 2));
+    high = _mm_max_epu8(high, _mm_srli_si128(high, 2));
+    low = _mm_min_epu8(low, _mm_srli_si128(low, 1));
+    high = _mm_max_epu8(high, _mm_srli_si128(high, 1));
+
+    block->y_min = (uint8_t)_mm_cvtsi128_si32(low);
+    block->y_max = (uint8_t)_mm_cvtsi128_si32(high);
+    block->min_index = texture_lowest_bit((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(luma, _mm_set1_epi8((char)block->y_min))));
+    block->max_index = texture_lowest_bit((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(luma, _mm_set1_epi8((char)block->y_max))));
+    #else
+    block->min_index = block->max_index = 0;
+    for (int32_t i = 1; i < 16; i++)
+    {
+        if (block->y[i] < block->y[block->min_index])
+            block->min_index = i;
+        if (block->y[i] > block->y[block->max_index])
+            block->max_index = i;
+    }
+    block->y_min = block->y[block->min_index];
+    block->y_max = block->y[block->max_index];
+    #endif
+}
+
+static uint16_t texture_pack_565(const int32_t rgb[3])
+{
+    return (uint16_t)((((rgb[0] * 31 + 127) / 255) << 11) | (((rgb[1] * 63 + 127) / 255) << 5) | ((rgb[2] * 31 + 127) / 255));
+}
+
+#if TEXTURE_ENCODER_SSE2
+static uint32_t texture_level_mask(__m128i scaled_low, __m128i scaled_high, int32_t threshold)
+{
+    __m128i limit = _mm_set1_epi16((short)(threshold - 1));
+    return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(scaled_low, limit), _mm_cmpgt_epi16(scaled_high, limit)));
+}
+#endif
+
+// BC1 indices from luma, index 0 is the brightest color and 1 the darkest
+static uint32_t texture_bc1_indices(const CTextureBlock* block)
+{
+    int32_t range = block->y_max - block->y_min;
+    uint32_t above_sixth = 0, above_half = 0, above_five_sixths = 0;
+
+    #if TEXTURE_ENCODER_SSE2
+    __m128i zero = _mm_setzero_si128();
+    __m128i six = _mm_set1_epi16(6);
+    __m128i distance = _mm_subs_epu8(_mm_loadu_si128((const __m128i*)block->y), _mm_set1_epi8((char)block->y_min));
+    __m128i scaled_low = _mm_mullo_epi16(_mm_unpacklo_epi8(distance, zero), six);
+    __m128i scaled_high = _mm_mullo_epi16(_mm_unpackhi_epi8(distance, zero), six);
+
+    above_sixth = texture_level_mask(scaled_low, scaled_high, range);
+    above_half = texture_level_mask(scaled_low, scaled_high, 3 * range);
+    above_five_sixths = texture_level_mask(scaled_low, scaled_high, 5 * range);
+    #else
+    for (int32_t i = 0; i < 16; i++)
+    {
+        int32_t scaled = 6 * (block->y[i] - block->y_min);
+        above_sixth |= (uint32_t)(scaled >= range) << i;
+        above_half |= (uint32_t)(scaled >= 3 * range) << i;
+        above_five_sixths |= (uint32_t)(scaled >= 5 * range) << i;
+    }
+    #endif
+
+    // Levels from dark to bright map to indices 1, 3, 2, 0
+    return texture_spread_bits(~above_half & 0xFFFFu) | (texture_spread_bits(above_sixth & ~above_five_sixths) << 1);
+}
+
+static void texture_encode_bc1_block(const CTextureBlock* block, const CTextureColorMatrix* matrix, uint8_t* output)
+{
+    int32_t bright[3], dark[3];
+    int32_t bright_chroma = texture_chroma_index(block->max_index), dark_chroma = texture_chroma_index(block->min_index);
+    uint32_t indices = 0;
+
+    texture_yuv_to_rgb(matrix, block->y_max, block->u[bright_chroma], block->v[bright_chroma], bright);
+    texture_yuv_to_rgb(matrix, block->y_min, block->u[dark_chroma], block->v[dark_chroma], dark);
+
+    uint16_t color0 = texture_pack_565(bright), color1 = texture_pack_565(dark);
+
+    // Four color mode needs color0 > color1, equal colors use index 0 only
+    if (color0 != color1)
+    {
+        indices = texture_bc1_indices(block);
+        if (color0 < color1)
+        {
+            uint16_t swap = color0;
+            color0 = color1;
+            color1 = swap;
+            indices ^= 0x55555555u;
+        }
+    }
+
+    output[0] = (uint8_t)color0;
+    output[1] = (uint8_t)(color0 >> 8);
+    output[2] = (uint8_t)color1;
+    output[3] = (uint8_t)(color1 >> 8);
+    output[4] = (uint8_t)indices;
+    output[5] = (uint8_t)(indices >> 8);
+    output[6] = (uint8_t)(indices >> 16);
+    output[7] = (uint8_t)(indices >> 24);
+}
+
+static void texture_encode_bc7_block(const CTextureBlock* block, const CTextureColorMatrix* matrix, uint8_t* output)
+{
+    int32_t endpoints[2][3];
+    int32_t dark_chroma = texture_chroma_index(block->min_index), bright_chroma = texture_chroma_index(block->max_index);
+    int32_t range = block->y_max - block->y_min;
+    int32_t scale = range ? ((15 << 16) + range / 2) / range : 0;
+    uint64_t indices = 0;
+
+    texture_yuv_to_rgb(matrix, block->y_min, block->u[dark_chroma], block->v[dark_chroma], endpoints[0]);
+    texture_yuv_to_rgb(matrix, block->y_max, block->u[bright_chroma], block->v[bright_chroma], endpoints[1]);
+
+    for (int32_t i = 0; i < 16; i++)
+    {
+        int32_t index = ((block->y[i] - block->y_min) * scale + 32768) >> 16;
+        indices |= (uint64_t)(index > 15 ? 15 : index) << (i * 4);
+    }
+
+    // The anchor index is stored without it's highest bit
+    bool swap = indices & 8;
+    if (swap)
+        indices = ~indices;
+
+    // Mode 6: single subset, 7 bit RGBA endpoints with shared p-bits, 4 bit indices.
+    // Mode, endpoints and the first p-bit fill the low word, the second p-bit and indices the high one
+    uint64_t low = 1u << 6;
+    for (int32_t channel = 0; channel < 3; channel++)
+    {
+        low |= (uint64_t)(endpoints[swap ? 1 : 0][channel] >> 1) << (7 + channel * 14);
+        low |= (uint64_t)(endpoints[swap ? 0 : 1][channel] >> 1) << (14 + channel * 14);
+    }
+    low |= (uint64_t)0x3FFF << 49;
+    low |= (uint64_t)1 << 63;
+
+    uint64_t high = 1 | ((indices & 7) << 1) | (indices & ~(uint64_t)15);
+
+    for (int32_t i = 0; i < 8; i++)
+    {
+        output[i] = (uint8_t)(low >> (i * 8));
+        output[i + 8] = (uint8_t)(high >> (i * 8));
+    }
+}
+
+// Picks the modifier table and per pixel modifiers of one 2x4 ETC subblock
+static uint32_t texture_etc_subblock(const CTextureBlock* block, const CTextureColorMatrix* matrix, const int32_t base[3], int32_t column, uint32_t* pixel_bits)
+{
+    int32_t base_luma = (77 * base[0] + 150 * base[1] + 29 * base[2] + 128) >> 8;
+    int32_t deltas[8];
+    int32_t max_delta = 0;
+    uint32_t table = 0;
+
+    for (int32_t i = 0; i < 8; i++)
+    {
+        int32_t x = column + (i >> 2), y = i & 3;
+        int32_t luma = texture_clamp(((block->y[y * 4 + x] - matrix->y_offset) * matrix->y_scale + 32768) >> 16);
+        deltas[i] = luma - base_luma;
+        max_delta = FFMAX(max_delta, FFABS(deltas[i]));
+    }
+
+    // The large modifier of the table should reach the farthest pixel
+    for (uint32_t t = 1; t < 8; t++)
+    {
+        if (FFABS(texture_etc_modifiers[t][1] - max_delta) < FFABS(texture_etc_modifiers[table][1] - max_delta))
+            table = t;
+    }
+
+    // Pixels closer to the large modifier than to the small one use the large one
+    int32_t midpoint = (texture_etc_modifiers[table][0] + texture_etc_modifiers[table][1] + 1) >> 1;
+
+    for (int32_t i = 0; i < 8; i++)
+    {
+        // Index bits are the sign and whether the large modifier is closer
+        uint32_t negative = deltas[i] < 0, large = FFABS(deltas[i]) >= midpoint;
+
+        // Pixels are stored column by column, most significant bits in the upper half
+        int32_t pixel = (column + (i >> 2)) * 4 + (i & 3);
+        *pixel_bits |= (negative << (16 + pixel)) | (large << pixel);
+    }
+
+    return table;
+}
+
+static void texture_encode_etc_block(const CTextureBlock* block, const CTextureColorMatrix* matrix, uint8_t* output)
+{
+    int32_t average[2][3], quantized[2][3], decoded[2][3];
+    bool differential = true;
+    uint32_t high = 0, low = 0;
+
+    // Left and right 2x4 subblocks, each covers one column of chroma samples
+    for (int32_t side = 0; side < 2; side++)
+    {
+        int32_t sum = 0;
+        for (int32_t row = 0; row < 4; row++)
+            sum += block->y[row * 4 + side * 2] + block->y[row * 4 + side * 2 + 1];
+
+        texture_yuv_to_rgb(matrix, (sum + 4) >> 3, (block->u[side] + block->u[side + 2] + 1) >> 1, (block->v[side] + block->v[side + 2] + 1) >> 1, average[side]);
+
+        for (int32_t channel = 0; channel < 3; channel++)
+            quantized[side][channel] = (average[side][channel] * 31 + 127) / 255;
+    }
+
+    for (int32_t channel = 0; channel < 3; channel++)
+    {
+        int32_t delta = quantized[1][channel] - quantized[0][channel];
+        if (delta < -4 || delta > 3)
+            differential = false;
+    }
+
+    if (differential)
+    {
+        for (int32_t channel = 0; channel < 3; channel++)
+        {
+            high |= (uint32_t)quantized[0][channel] << (27 - channel * 8);
+            high |= (uint32_t)((quantized[1][channel] - quantized[0][channel]) & 7) << (24 - channel * 8);
+
+            for (int32_t side = 0; side < 2; side++)
+                decoded[side][channel] = (quantized[side][channel] << 3) | (quantized[side][channel] >> 2);
+        }
+        high |= 1u << 1;
+    }
+    else
+    {
+        for (int32_t channel = 0; channel < 3; channel++)
+        {
+            for (int32_t side = 0; side < 2; side++)
+            {
+                int32_t value = (average[side][channel] * 15 + 127) / 255;
+                high |= (uint32_t)value << (28 - channel * 8 - side * 4);
+                decoded[side][channel] = value * 17;
+            }
+        }
+    }
+
+    high |= texture_etc_subblock(block, matrix, decoded[0], 0, &low) << 5;
+    high |= texture_etc_subblock(block, matrix, decoded[1], 2, &low) << 2;
+
+    for (int32_t i = 0; i < 4; i++)
+    {
+        output[i] = (uint8_t)(high >> (24 - i * 8));
+        output[i + 4] = (uint8_t)(low >> (24 - i * 8));
+    }
+}
+
+int32_t texture_format_get_block_size(enum ETextureFormat format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1:
+    case TEXTURE_FORMAT_ETC2_RGB8:
+        return 8;
+    case TEXTURE_FORMAT_BC7:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+size_t texture_format_get_size(enum ETextureFormat format, int32_t width, int32_t height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * texture_format_get_block_size(format);
+}
+
+bool texture_encode_yuv420p(enum ETextureFormat format, uint8_t* const planes[3], const int linesize[3], int32_t width, int32_t height,
+    enum AVColorSpace colorspace, enum AVColorRange color_range, uint8_t* output)
+{
+    CTextureColorMatrix matrix = texture_color_matrix(colorspace, color_range);
+    int32_t block_size = texture_format_get_block_size(format);
+    texture_encode_block_t encode_block;
+    CTextureBlock block;
+
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1:
+        encode_block = texture_encode_bc1_block;
+        break;
+    case TEXTURE_FORMAT_BC7:
+        encode_block = texture_encode_bc7_block;
+        break;
+    case TEXTURE_FORMAT_ETC2_RGB8:
+        encode_block = texture_encode_etc_block;
+        break;
+    default:
+        return false;
+    }
+
+    if (width <= 0 || height <= 0)
+        return false;
+
+    for (int32_t block_y = 0; block_y < (height + 3) / 4; block_y++)
+    {
+        for (int32_t block_x = 0; block_x < (width + 3) / 4; block_x++)
+        {
+            texture_load_block(&block, planes, linesize, width, height, block_x, block_y);
+            texture_block_luma_range(&block);
+            encode_block(&block, &matrix, output);
+            output += block_size;
+        }
+    }
+
+    return true;
+}
\ No newline at end of file
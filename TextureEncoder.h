@@ -0,0 +1,87 @@
+#ifndef AV_TEXTUREENCODER
+#define AV_TEXTUREENCODER
+
+#include <libavutil/avutil.h>
+#include <libavutil/pixfmt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * GPU block-compressed formats of converted video frames.
+ *
+ * Encoders work straight from YUV 4:2:0 planes and favour speed over quality:
+ * endpoints are taken from the darkest and the brightest pixel of every 4x4 block
+ * and pixels are assigned by their luma only.
+ */
+enum ETextureFormat
+{
+    TEXTURE_FORMAT_NONE = 0,
+
+    /**
+     * BC1 (DXT1), 8 bytes per block, 4 bits per pixel.
+     */
+    TEXTURE_FORMAT_BC1,
+
+    /**
+     * BC7 mode 6, 16 bytes per block, 8 bits per pixel.
+     */
+    TEXTURE_FORMAT_BC7,
+
+    /**
+     * ETC2 RGB8 using the ETC1 compatible modes, 8 bytes per block, 4 bits per pixel.
+     */
+    TEXTURE_FORMAT_ETC2_RGB8,
+
+    TEXTURE_FORMAT_COUNT
+};
+
+/**
+ * Returns size of a single 4x4 block in bytes.
+ *
+ * @param format Texture format.
+ *
+ * @return Returns block size or 0 for TEXTURE_FORMAT_NONE.
+ */
+int32_t texture_format_get_block_size(enum ETextureFormat format);
+
+/**
+ * Returns size of encoded image, width and height are rounded up to whole blocks.
+ *
+ * @param format Texture format.
+ *
+ * @param width Image width.
+ *
+ * @param height Image height.
+ *
+ * @return Returns size in bytes.
+ */
+size_t texture_format_get_size(enum ETextureFormat format, int32_t width, int32_t height);
+
+/**
+ * Encodes YUV 4:2:0 image into block-compressed texture.
+ *
+ * Blocks are written row by row, blocks over the image edge repeat the edge pixels.
+ *
+ * @param format Texture format.
+ *
+ * @param planes Y, U and V planes.
+ *
+ * @param linesize Line sizes of planes.
+ *
+ * @param width Image width.
+ *
+ * @param height Image height.
+ *
+ * @param colorspace Color matrix of the image, BT.601 is used unless BT.709 is set.
+ *
+ * @param color_range Color range of the image, limited unless AVCOL_RANGE_JPEG is set.
+ *
+ * @param output Buffer of texture_format_get_size bytes.
+ *
+ * @return Returns false if the format is not supported.
+ */
+bool texture_encode_yuv420p(enum ETextureFormat format, uint8_t* const planes[3], const int linesize[3], int32_t width, int32_t height,
+    enum AVColorSpace colorspace, enum AVColorRange color_range, uint8_t* output);
+
+#endif
\ No newline at end of file
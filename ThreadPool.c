@@ -0,0 +1,159 @@
+#include "ThreadPool.h"
+#include "Allocator.h"
+#include <stdio.h>
+
+static void thread_pool_worker(void* arg)
+{
+    CThreadPool* pool = (CThreadPool*)arg;
+
+    mutex_lock(&pool->lock);
+    while(true)
+    {
+        while(!pool->queue_size && !pool->stopping)
+            condition_wait(&pool->job_available, &pool->lock);
+
+        if(!pool->queue_size && pool->stopping)
+            break;
+
+        CThreadPoolJob job = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % pool->queue_capacity;
+        pool->queue_size--;
+        pool->active_jobs++;
+        condition_signal(&pool->space_available);
+        mutex_unlock(&pool->lock);
+
+        job.routine(job.arg);
+
+        mutex_lock(&pool->lock);
+        pool->active_jobs--;
+        if(!pool->queue_size && !pool->active_jobs)
+            condition_broadcast(&pool->idle);
+    }
+    mutex_unlock(&pool->lock);
+}
+
+static void thread_pool_push(CThreadPool* pool, thread_pool_job_t routine, void* arg)
+{
+    int32_t tail = (pool->queue_head + pool->queue_size) % pool->queue_capacity;
+    pool->queue[tail].routine = routine;
+    pool->queue[tail].arg = arg;
+    pool->queue_size++;
+    condition_signal(&pool->job_available);
+}
+
+CThreadPool* thread_pool_alloc()
+{
+    CThreadPool* pool = NULL;
+    pool = (CThreadPool*)allocator_malloc(sizeof(CThreadPool));
+
+    pool->threads = NULL;
+    pool->thread_count = 0;
+    pool->queue = NULL;
+    pool->queue_capacity = 0;
+    pool->queue_head = 0;
+    pool->queue_size = 0;
+    pool->active_jobs = 0;
+    pool->stopping = false;
+    mutex_init(&pool->lock);
+    condition_init(&pool->job_available);
+    condition_init(&pool->space_available);
+    condition_init(&pool->idle);
+
+    return pool;
+}
+
+bool thread_pool_start(CThreadPool** pool_ptr, int32_t thread_count, int32_t queue_capacity)
+{
+    CThreadPool* pool = *pool_ptr;
+
+    if(thread_count <= 0)
+        thread_count = thread_hardware_concurrency();
+    if(queue_capacity <= 0)
+        queue_capacity = thread_count * 2;
+
+    pool->queue = (CThreadPoolJob*)allocator_malloc(sizeof(CThreadPoolJob) * queue_capacity);
+    pool->threads = (CThread*)allocator_malloc(sizeof(CThread) * thread_count);
+    if(!pool->queue || !pool->threads)
+    {
+        fprintf(stderr, "Couldn't allocate thread pool.\n");
+        return false;
+    }
+    pool->queue_capacity = queue_capacity;
+
+    for(int32_t i = 0; i < thread_count; i++)
+    {
+        if(!thread_start(&pool->threads[i], thread_pool_worker, pool))
+        {
+            fprintf(stderr, "Couldn't start worker thread.\n");
+            return false;
+        }
+        pool->thread_count++;
+    }
+
+    return true;
+}
+
+bool thread_pool_submit(CThreadPool** pool_ptr, thread_pool_job_t routine, void* arg)
+{
+    CThreadPool* pool = *pool_ptr;
+
+    mutex_lock(&pool->lock);
+    while(pool->queue_size == pool->queue_capacity && !pool->stopping)
+        condition_wait(&pool->space_available, &pool->lock);
+
+    bool accepted = !pool->stopping;
+    if(accepted)
+        thread_pool_push(pool, routine, arg);
+    mutex_unlock(&pool->lock);
+
+    return accepted;
+}
+
+bool thread_pool_try_submit(CThreadPool** pool_ptr, thread_pool_job_t routine, void* arg)
+{
+    CThreadPool* pool = *pool_ptr;
+
+    mutex_lock(&pool->lock);
+    bool accepted = !pool->stopping && pool->queue_size < pool->queue_capacity;
+    if(accepted)
+        thread_pool_push(pool, routine, arg);
+    mutex_unlock(&pool->lock);
+
+    return accepted;
+}
+
+void thread_pool_wait(CThreadPool** pool_ptr)
+{
+    CThreadPool* pool = *pool_ptr;
+
+    mutex_lock(&pool->lock);
+    while(pool->queue_size || pool->active_jobs)
+        condition_wait(&pool->idle, &pool->lock);
+    mutex_unlock(&pool->lock);
+}
+
+void thread_pool_close(CThreadPool** pool_ptr)
+{
+    CThreadPool* pool = *pool_ptr;
+
+    if(!pool)
+        return;
+
+    mutex_lock(&pool->lock);
+    pool->stopping = true;
+    condition_broadcast(&pool->job_available);
+    condition_broadcast(&pool->space_available);
+    mutex_unlock(&pool->lock);
+
+    for(int32_t i = 0; i < pool->thread_count; i++)
+        thread_join(&pool->threads[i]);
+
+    condition_destroy(&pool->job_available);
+    condition_destroy(&pool->space_available);
+    condition_destroy(&pool->idle);
+    mutex_destroy(&pool->lock);
+    allocator_free(pool->threads);
+    allocator_free(pool->queue);
+    allocator_free(pool);
+    *pool_ptr = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef AV_THREADPOOL
+#define AV_THREADPOOL
+
+#include "Threading.h"
+
+typedef void (*thread_pool_job_t)(void* arg);
+
+typedef struct CThreadPoolJob
+{
+    thread_pool_job_t       routine;
+    void*                   arg;
+} CThreadPoolJob;
+
+/**
+ * Fixed set of worker threads fed from a bounded job queue.
+ * 
+ * Submitting into a full queue blocks the caller, which keeps the amount of 
+ * work in flight (and memory held by it) under control.
+ */
+typedef struct CThreadPool
+{
+    CThread*                threads;
+    int32_t                 thread_count;
+
+    /**
+     * Ring buffer of queued jobs.
+     */
+    CThreadPoolJob*         queue;
+    int32_t                 queue_capacity;
+    int32_t                 queue_head;
+    int32_t                 queue_size;
+
+    /**
+     * Jobs taken by workers and not finished yet.
+     */
+    int32_t                 active_jobs;
+
+    bool                    stopping;
+
+    CMutex                  lock;
+    CCondition              job_available;
+    CCondition              space_available;
+    CCondition              idle;
+} CThreadPool;
+
+/**
+ * Allocate an CThreadPool and set its fields to default values.
+ *
+ * @return An CThreadPool filled with default values or NULL on failure.
+ */
+CThreadPool* thread_pool_alloc(void);
+
+/**
+ * Starts worker threads.
+ *
+ * @param pool_ptr Pointer to pointer to CThreadPool structure.
+ *
+ * @param thread_count Number of workers, 0 to use the number of logical processors.
+ *
+ * @param queue_capacity Maximum number of queued jobs, 0 to use twice the number of workers.
+ *
+ * @return Returns true if all workers were started.
+ */
+bool thread_pool_start(CThreadPool** pool_ptr, int32_t thread_count, int32_t queue_capacity);
+
+/**
+ * Queues a job, blocks while the queue is full.
+ *
+ * @param pool_ptr Pointer to pointer to CThreadPool structure.
+ *
+ * @param routine Function executed on a worker thread.
+ *
+ * @param arg Argument passed to routine.
+ *
+ * @return Returns false if the pool is stopping.
+ */
+bool thread_pool_submit(CThreadPool** pool_ptr, thread_pool_job_t routine, void* arg);
+
+/**
+ * Queues a job without blocking.
+ *
+ * @param pool_ptr Pointer to pointer to CThreadPool structure.
+ *
+ * @param routine Function executed on a worker thread.
+ *
+ * @param arg Argument passed to routine.
+ *
+ * @return Returns false if the queue is full or the pool is stopping.
+ */
+bool thread_pool_try_submit(CThreadPool** pool_ptr, thread_pool_job_t routine, void* arg);
+
+/**
+ * Waits until every queued job is finished.
+ *
+ * @param pool_ptr Pointer to pointer to CThreadPool structure.
+ */
+void thread_pool_wait(CThreadPool** pool_ptr);
+
+/**
+ * Finishes queued jobs, stops workers and releases the pool.
+ *
+ * @param pool_ptr Pointer to pointer to CThreadPool structure.
+ */
+void thread_pool_close(CThreadPool** pool_ptr);
+
+#endif
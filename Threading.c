@@ -0,0 +1,174 @@
+#include "Threading.h"
+#include "Allocator.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+typedef struct CThreadStartup
+{
+    thread_routine_t        routine;
+    void*                   arg;
+} CThreadStartup;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID param)
+#else
+static void* thread_entry(void* param)
+#endif
+{
+    CThreadStartup startup = *(CThreadStartup*)param;
+    allocator_free(param);
+
+    startup.routine(startup.arg);
+    return 0;
+}
+
+void mutex_init(CMutex* mutex)
+{
+    #ifdef _WIN32
+    InitializeSRWLock(&mutex->handle);
+    #else
+    pthread_mutex_init(&mutex->handle, NULL);
+    #endif
+}
+
+void mutex_destroy(CMutex* mutex)
+{
+    #ifndef _WIN32
+    pthread_mutex_destroy(&mutex->handle);
+    #else
+    (void)mutex;
+    #endif
+}
+
+void mutex_lock(CMutex* mutex)
+{
+    #ifdef _WIN32
+    AcquireSRWLockExclusive(&mutex->handle);
+    #else
+    pthread_mutex_lock(&mutex->handle);
+    #endif
+}
+
+void mutex_unlock(CMutex* mutex)
+{
+    #ifdef _WIN32
+    ReleaseSRWLockExclusive(&mutex->handle);
+    #else
+    pthread_mutex_unlock(&mutex->handle);
+    #endif
+}
+
+void condition_init(CCondition* condition)
+{
+    #ifdef _WIN32
+    InitializeConditionVariable(&condition->handle);
+    #else
+    pthread_cond_init(&condition->handle, NULL);
+    #endif
+}
+
+void condition_destroy(CCondition* condition)
+{
+    #ifndef _WIN32
+    pthread_cond_destroy(&condition->handle);
+    #else
+    (void)condition;
+    #endif
+}
+
+void condition_signal(CCondition* condition)
+{
+    #ifdef _WIN32
+    WakeConditionVariable(&condition->handle);
+    #else
+    pthread_cond_signal(&condition->handle);
+    #endif
+}
+
+void condition_broadcast(CCondition* condition)
+{
+    #ifdef _WIN32
+    WakeAllConditionVariable(&condition->handle);
+    #else
+    pthread_cond_broadcast(&condition->handle);
+    #endif
+}
+
+void condition_wait(CCondition* condition, CMutex* mutex)
+{
+    #ifdef _WIN32
+    SleepConditionVariableSRW(&condition->handle, &mutex->handle, INFINITE, 0);
+    #else
+    pthread_cond_wait(&condition->handle, &mutex->handle);
+    #endif
+}
+
+bool condition_timed_wait(CCondition* condition, CMutex* mutex, int64_t timeout_us)
+{
+    #ifdef _WIN32
+    DWORD timeout_ms = (DWORD)((timeout_us + 999) / 1000);
+    return SleepConditionVariableSRW(&condition->handle, &mutex->handle, timeout_ms, 0) != 0;
+    #else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_us / 1000000;
+    deadline.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+    if(deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(&condition->handle, &mutex->handle, &deadline) != ETIMEDOUT;
+    #endif
+}
+
+bool thread_start(CThread* thread, thread_routine_t routine, void* arg)
+{
+    CThreadStartup* startup = (CThreadStartup*)allocator_malloc(sizeof(CThreadStartup));
+    if(!startup)
+        return false;
+
+    startup->routine = routine;
+    startup->arg = arg;
+
+    #ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, thread_entry, startup, 0, NULL);
+    if(!thread->handle)
+    #else
+    if(pthread_create(&thread->handle, NULL, thread_entry, startup) != 0)
+    #endif
+    {
+        allocator_free(startup);
+        return false;
+    }
+
+    return true;
+}
+
+void thread_join(CThread* thread)
+{
+    #ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    #else
+    pthread_join(thread->handle, NULL);
+    #endif
+}
+
+int32_t thread_hardware_concurrency()
+{
+    #if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int32_t)info.dwNumberOfProcessors : 1;
+    #elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int32_t)count : 1;
+    #else
+    return 1;
+    #endif
+}
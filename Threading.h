@@ -0,0 +1,104 @@
+#ifndef AV_THREADING
+#define AV_THREADING
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/**
+ * Thin portable wrappers over platform threading primitives.
+ * 
+ * Uses SRW locks and condition variables on windows and pthreads everywhere else.
+ */
+typedef struct CMutex
+{
+    #ifdef _WIN32
+    SRWLOCK                 handle;
+    #else
+    pthread_mutex_t         handle;
+    #endif
+} CMutex;
+
+typedef struct CCondition
+{
+    #ifdef _WIN32
+    CONDITION_VARIABLE      handle;
+    #else
+    pthread_cond_t          handle;
+    #endif
+} CCondition;
+
+typedef struct CThread
+{
+    #ifdef _WIN32
+    HANDLE                  handle;
+    #else
+    pthread_t               handle;
+    #endif
+} CThread;
+
+typedef void (*thread_routine_t)(void* arg);
+
+void mutex_init(CMutex* mutex);
+void mutex_destroy(CMutex* mutex);
+void mutex_lock(CMutex* mutex);
+void mutex_unlock(CMutex* mutex);
+
+void condition_init(CCondition* condition);
+void condition_destroy(CCondition* condition);
+void condition_signal(CCondition* condition);
+void condition_broadcast(CCondition* condition);
+
+/**
+ * Atomically releases the mutex and waits for the condition.
+ *
+ * @param condition Condition to wait for.
+ *
+ * @param mutex Locked mutex.
+ */
+void condition_wait(CCondition* condition, CMutex* mutex);
+
+/**
+ * Same as condition_wait, but gives up after timeout.
+ *
+ * @param condition Condition to wait for.
+ *
+ * @param mutex Locked mutex.
+ *
+ * @param timeout_us Timeout in microseconds.
+ *
+ * @return Returns false if the wait timed out.
+ */
+bool condition_timed_wait(CCondition* condition, CMutex* mutex, int64_t timeout_us);
+
+/**
+ * Starts a new thread.
+ *
+ * @param thread Pointer to CThread structure that receives the thread handle.
+ *
+ * @param routine Function executed by the thread.
+ *
+ * @param arg Argument passed to routine.
+ *
+ * @return Returns true if the thread was started.
+ */
+bool thread_start(CThread* thread, thread_routine_t routine, void* arg);
+
+/**
+ * Waits until the thread finishes and releases it's handle.
+ *
+ * @param thread Thread started with thread_start.
+ */
+void thread_join(CThread* thread);
+
+/**
+ * @return Returns the number of logical processors, at least 1.
+ */
+int32_t thread_hardware_concurrency(void);
+
+#endif
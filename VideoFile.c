@@ -1,20 +1,323 @@
 #include "VideoFile.h"
 #include "helpers.h"
+#include "Allocator.h"
+#include <libavutil/time.h>
+#include <string.h>
 
 //TODO: add threaded decoding
 
+#define VIDEO_FILE_LOOP_PREFETCH_PACKETS 64
+
+static void video_file_unref_packet(CVideoFile* vfile)
+{
+    memory_budget_release(MEMORY_CATEGORY_PACKETS, vfile->av_packet->size);
+    av_packet_unref(vfile->av_packet);
+}
+
+// Keeps a reference to the packet for replay at the loop point
+static void video_file_loop_keep_packet(CVideoFile* vfile, CDataStream* stream)
+{
+    AVPacket* av_packet = vfile->av_packet;
+    AVPacket* kept_packet = NULL;
+
+    if (vfile->loop_packet_count >= VIDEO_FILE_LOOP_PREFETCH_PACKETS || !memory_budget_can_prefetch(av_packet->size)
+        || !(kept_packet = av_packet_alloc()) || av_packet_ref(kept_packet, av_packet) < 0)
+    {
+        av_packet_free(&kept_packet);
+        vfile->loop_prefetching = false;
+        return;
+    }
+
+    memory_budget_acquire(MEMORY_CATEGORY_PACKETS, kept_packet->size);
+    vfile->loop_packets[vfile->loop_packet_count++] = kept_packet;
+    stream->loop_cached_dts = av_packet->dts != AV_NOPTS_VALUE ? av_packet->dts : av_packet->pts;
+}
+
+// Extends the timestamp range of the current iteration
+static void video_file_loop_track(CDataStream* stream, int64_t pts, int64_t duration)
+{
+    if (duration <= 0 && stream->stream_type == AVMEDIA_TYPE_VIDEO)
+        duration = av_rescale_q(stream->frame_budget_us, AV_TIME_BASE_Q, stream->time_base);
+
+    if (stream->loop_first_pts == AV_NOPTS_VALUE || pts < stream->loop_first_pts)
+        stream->loop_first_pts = pts;
+    if (stream->loop_end_pts == AV_NOPTS_VALUE || pts + duration > stream->loop_end_pts)
+        stream->loop_end_pts = pts + duration;
+}
+
+// Tracks the timestamp range of one iteration and moves the packet onto the looped timeline
+static void video_file_loop_rebase(CDataStream* stream, AVPacket* av_packet)
+{
+    if (av_packet->pts != AV_NOPTS_VALUE)
+    {
+        video_file_loop_track(stream, av_packet->pts, av_packet->duration);
+        av_packet->pts += stream->pts_offset;
+    }
+
+    if (av_packet->dts != AV_NOPTS_VALUE)
+        av_packet->dts += stream->pts_offset;
+}
+
+// Every decoding stream, video first
+static int32_t video_file_collect_streams(CVideoFile* vfile, CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1])
+{
+    int32_t count = 0;
+
+    streams[count++] = &vfile->vstream;
+    streams[count++] = &vfile->astream;
+    for (int32_t i = 0; i < vfile->extra_astream_count; i++)
+        streams[count++] = &vfile->extra_astreams[i];
+
+    return count;
+}
+
+// Reads the next packet into av_packet, in loop mode the kept packets go first after every restart
+static int video_file_next_packet(CVideoFile* vfile)
+{
+    int response;
+    AVPacket* av_packet = vfile->av_packet;
+
+    while (true)
+    {
+        bool replayed = vfile->loop_replaying && vfile->loop_replay_index < vfile->loop_packet_count;
+
+        if (replayed)
+        {
+            if ((response = av_packet_ref(av_packet, vfile->loop_packets[vfile->loop_replay_index++])) < 0)
+                return response;
+        }
+        else if (vfile->loop_replaying && vfile->loop_cache_complete)
+        {
+            vfile->loop_replaying = false;
+            return AVERROR_EOF;
+        }
+        else if ((response = av_read_frame(vfile->av_format_ctx, av_packet)) < 0)
+        {
+            if (response == AVERROR_EOF && vfile->loop_prefetching && vfile->loop_packet_count > 0)
+                vfile->loop_cache_complete = true;
+            return response;
+        }
+        else
+            vfile->loop_replaying = false;
+
+        CDataStream** stream_ptr = video_file_get_stream(&vfile, av_packet->stream_index);
+
+        if (stream_ptr && vfile->looping)
+        {
+            if (!replayed)
+            {
+                int64_t dts = av_packet->dts != AV_NOPTS_VALUE ? av_packet->dts : av_packet->pts;
+
+                // After seeking back the demuxer continues behind the replayed packets
+                if (vfile->loop_count > 0 && (*stream_ptr)->loop_cached_dts != AV_NOPTS_VALUE 
+                    && dts != AV_NOPTS_VALUE && dts <= (*stream_ptr)->loop_cached_dts)
+                {
+                    av_packet_unref(av_packet);
+                    continue;
+                }
+
+                if (vfile->loop_prefetching)
+                    video_file_loop_keep_packet(vfile, *stream_ptr);
+            }
+
+            video_file_loop_rebase(*stream_ptr, av_packet);
+        }
+
+        // Keyframe-only fast playback does not even send the other video packets
+        if (stream_ptr && !data_stream_wants_packet(stream_ptr, av_packet))
+        {
+            av_packet_unref(av_packet);
+            continue;
+        }
+
+        memory_budget_acquire(MEMORY_CATEGORY_PACKETS, av_packet->size);
+        return 0;
+    }
+}
+
+// Length of the current iteration in microseconds, taken from the longest stream
+static int64_t video_file_loop_duration(CVideoFile* vfile)
+{
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+    int64_t duration = 0;
+
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        CDataStream* stream = *streams[i];
+        if (!stream->av_codec_ctx || stream->loop_end_pts == AV_NOPTS_VALUE)
+            continue;
+
+        int64_t stream_duration = av_rescale_q(stream->loop_end_pts - stream->loop_first_pts, stream->time_base, AV_TIME_BASE_Q);
+        if (stream_duration > duration)
+            duration = stream_duration;
+    }
+
+    return duration;
+}
+
+static bool video_file_loop_seek(CVideoFile* vfile)
+{
+    int64_t start_time = vfile->av_format_ctx->start_time != AV_NOPTS_VALUE ? vfile->av_format_ctx->start_time : 0;
+    int response = av_seek_frame(vfile->av_format_ctx, -1, start_time, AVSEEK_FLAG_BACKWARD);
+
+    if (response < 0)
+    {
+        fprintf(stderr, "Couldn't seek to the loop start\n");
+        print_error(response);
+        return false;
+    }
+
+    vfile->loop_seeked = true;
+    return true;
+}
+
+// Starts the next iteration, decoders are flushed and timestamps shifted by the iteration length
+static bool video_file_loop_restart(CVideoFile* vfile)
+{
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+    int64_t duration = video_file_loop_duration(vfile);
+
+    if (duration <= 0)
+        return false;
+
+    // Normally done when end of file was reached, see video_file_start_drain
+    if (!vfile->loop_cache_complete && !vfile->loop_seeked && !video_file_loop_seek(vfile))
+        return false;
+
+    // Every stream advances by the same duration, so audio and video stay in sync
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        CDataStream* stream = *streams[i];
+        if (!stream->av_codec_ctx)
+            continue;
+
+        avcodec_flush_buffers(stream->av_codec_ctx);
+        stream->frames_pending = false;
+        stream->end_of_stream = false;
+        stream->pts_offset += av_rescale_q(duration, AV_TIME_BASE_Q, stream->time_base);
+        stream->loop_first_pts = AV_NOPTS_VALUE;
+        stream->loop_end_pts = AV_NOPTS_VALUE;
+    }
+
+    // A cache finished during this iteration replaces decoding from now on
+    if (frame_cache_is_readable(&vfile->frame_cache))
+    {
+        frame_cache_rewind(&vfile->frame_cache);
+        vfile->av_format_ctx->streams[vfile->vstream->data_stream_index]->discard = AVDISCARD_ALL;
+    }
+
+    vfile->loop_prefetching = false;
+    vfile->loop_replaying = true;
+    vfile->loop_replay_index = 0;
+    vfile->packet_pending = false;
+    vfile->demuxer_eof = false;
+    vfile->loop_seeked = false;
+    vfile->loop_count++;
+    return true;
+}
+
+// Releases the kept packets, prefetching starts again with the next packets read
+static void video_file_loop_reset(CVideoFile* vfile)
+{
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+
+    for (int32_t i = 0; i < vfile->loop_packet_count; i++)
+    {
+        memory_budget_release(MEMORY_CATEGORY_PACKETS, vfile->loop_packets[i]->size);
+        av_packet_free(&vfile->loop_packets[i]);
+    }
+
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        (*streams[i])->loop_first_pts = AV_NOPTS_VALUE;
+        (*streams[i])->loop_end_pts = AV_NOPTS_VALUE;
+        (*streams[i])->loop_cached_dts = AV_NOPTS_VALUE;
+    }
+
+    vfile->loop_packet_count = 0;
+    vfile->loop_replay_index = 0;
+    vfile->loop_replaying = false;
+    vfile->loop_cache_complete = false;
+    vfile->loop_seeked = false;
+    vfile->loop_prefetching = vfile->looping;
+}
+
+// Start draining, decoders return their delayed frames
+static void video_file_start_drain(CVideoFile* vfile)
+{
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+
+    vfile->demuxer_eof = true;
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        if ((*streams[i])->av_codec_ctx)
+            data_stream_send_packet(streams[i], NULL);
+    }
+
+    // The demuxer is idle while the decoders drain, so the seek back does not wait for the loop point
+    if (vfile->looping && !vfile->loop_cache_complete && video_file_loop_duration(vfile) > 0)
+        video_file_loop_seek(vfile);
+}
+
+// Receives one delayed frame of a draining decoder, returns false once every decoder is empty
+static bool video_file_drain_frame(CVideoFile* vfile)
+{
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        CDataStream** stream_ptr = streams[i];
+
+        while ((*stream_ptr)->av_codec_ctx && (*stream_ptr)->frames_pending)
+        {
+            int response = data_stream_receive_frame(stream_ptr);
+            if (response == 0)
+                return true;
+            if (response < 0)
+                (*stream_ptr)->frames_pending = false;
+        }
+    }
+
+    return false;
+}
+
 CVideoFile* video_file_alloc()
 {
     CVideoFile* vfile = NULL;
     
-    vfile = (CVideoFile*)malloc(sizeof(CVideoFile));
+    vfile = (CVideoFile*)allocator_malloc(sizeof(CVideoFile));
     vfile->vstream = data_stream_alloc();
     vfile->astream = data_stream_alloc();
+    vfile->audio_language = NULL;
+    vfile->audio_track_count = -1;
+    vfile->extra_astream_count = 0;
 
     vfile->av_format_ctx = NULL;
     vfile->av_packet = NULL;
     vfile->hwdecoding_video = false;
     vfile->hwdecoding_audio = false;
+    vfile->packet_pending = false;
+    vfile->demuxer_eof = false;
+    vfile->on_video_frame = NULL;
+    vfile->on_audio_frame = NULL;
+    vfile->callback_user_data = NULL;
+    vfile->looping = false;
+    vfile->loop_count = 0;
+    vfile->loop_packets = NULL;
+    vfile->loop_packet_count = 0;
+    vfile->loop_replay_index = 0;
+    vfile->loop_replaying = false;
+    vfile->loop_prefetching = false;
+    vfile->loop_cache_complete = false;
+    vfile->loop_seeked = false;
+    vfile->frame_cache = NULL;
+    vfile->atlas = NULL;
+    vfile->atlas_rect = -1;
 
     #ifdef VENC_DEBUG
     av_log_set_level(AV_LOG_DEBUG);
@@ -23,6 +326,36 @@ CVideoFile* video_file_alloc()
     return vfile;
 }
 
+// Explicitly selected track first, then the first track with the wanted language
+static int32_t video_file_find_audio_track(CVideoFile* vfile)
+{
+    AVFormatContext* av_format_ctx = vfile->av_format_ctx;
+
+    if (vfile->audio_track_count > 0)
+        return vfile->audio_tracks[0];
+
+    if (!vfile->audio_language)
+        return -1;
+
+    for (unsigned i = 0; i < av_format_ctx->nb_streams; i++)
+    {
+        AVStream* av_stream = av_format_ctx->streams[i];
+        AVDictionaryEntry* language = av_dict_get(av_stream->metadata, "language", NULL, 0);
+
+        if (av_stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && language && !strcmp(language->value, vfile->audio_language))
+            return (int32_t)i;
+    }
+
+    return -1;
+}
+
+// Packets of streams nobody decodes are skipped by the demuxer instead of being read and thrown away
+static void video_file_discard_unused_streams(CVideoFile* vfile)
+{
+    for (unsigned i = 0; i < vfile->av_format_ctx->nb_streams; i++)
+        vfile->av_format_ctx->streams[i]->discard = video_file_get_stream(&vfile, (int32_t)i) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+}
+
 bool video_file_open_decode(CVideoFile** vfile_ptr, const char* filepath)
 {
     CVideoFile* vfile = *vfile_ptr;
@@ -32,18 +365,42 @@ bool video_file_open_decode(CVideoFile** vfile_ptr, const char* filepath)
         "Couldn't created AVFormatContext\n"
         );
 
-    ffmpeg_call_m(avformat_open_input(&vfile->av_format_ctx, filepath, NULL, NULL), "Couldn't open video file\n");
+    if (avformat_open_input(&vfile->av_format_ctx, filepath, NULL, NULL) < 0)
+    {
+        fprintf(stderr, "Couldn't open video file %s\n", filepath);
+        return false;
+    }
 
     if(!data_stream_initialize_decode(&vfile->vstream, vfile->av_format_ctx, AVMEDIA_TYPE_VIDEO, vfile->hwdecoding_video))
     {
         printf("Couldn't open video stream\n");
     }
 
-    if(!data_stream_initialize_decode(&vfile->astream, vfile->av_format_ctx, AVMEDIA_TYPE_AUDIO, vfile->hwdecoding_audio))
+    if(vfile->audio_track_count != 0)
+    {
+        data_stream_set_wanted_stream(&vfile->astream, video_file_find_audio_track(vfile));
+        if(!data_stream_initialize_decode(&vfile->astream, vfile->av_format_ctx, AVMEDIA_TYPE_AUDIO, vfile->hwdecoding_audio))
+        {
+            printf("Couldn't open audio stream\n");
+        }
+    }
+
+    for(int32_t i = 1; i < vfile->audio_track_count; i++)
     {
-        printf("Couldn't open audio stream\n");
+        CDataStream* astream = data_stream_alloc();
+
+        data_stream_set_wanted_stream(&astream, vfile->audio_tracks[i]);
+        if(!data_stream_initialize_decode(&astream, vfile->av_format_ctx, AVMEDIA_TYPE_AUDIO, vfile->hwdecoding_audio))
+        {
+            printf("Couldn't open audio stream %d\n", vfile->audio_tracks[i]);
+            data_stream_close(&astream);
+            continue;
+        }
+        vfile->extra_astreams[vfile->extra_astream_count++] = astream;
     }
 
+    video_file_discard_unused_streams(vfile);
+
     ffmpeg_call_m((void*)(
         vfile->av_packet = av_packet_alloc()), 
         "Couldn't allocate AVPacket\n"
@@ -57,34 +414,39 @@ bool video_file_read_frame(CVideoFile** vfile_ptr)
     int response;
     CVideoFile* vfile = *vfile_ptr;
 
-    while ((response = av_read_frame(vfile->av_format_ctx, vfile->av_packet)) >= 0)
+    // At the loop point delayed frames are returned one per call, then the next iteration starts
+    if (vfile->looping && vfile->demuxer_eof)
     {
-        if (vfile->av_packet->stream_index == vfile->vstream->data_stream_index)
-        {
-            if(data_stream_decode(&vfile->vstream, vfile->av_format_ctx, vfile->av_packet) < 0)
-            {
-                av_packet_unref(vfile->av_packet);
-                continue;
-            }
-        }
-        else if(vfile->av_packet->stream_index == vfile->astream->data_stream_index)
+        if (video_file_drain_frame(vfile))
+            return true;
+
+        if (!video_file_loop_restart(vfile))
         {
-            if(data_stream_decode(&vfile->astream, vfile->av_format_ctx, vfile->av_packet) < 0)
-            {
-                av_packet_unref(vfile->av_packet);
-                continue;
-            }
+            print_error(AVERROR_EOF);
+            return false;
         }
-        else
+    }
+
+    while ((response = video_file_next_packet(vfile)) >= 0)
+    {
+        CDataStream** stream_ptr = video_file_get_stream(vfile_ptr, vfile->av_packet->stream_index);
+
+        if (!stream_ptr || data_stream_decode(stream_ptr, vfile->av_format_ctx, vfile->av_packet) < 0)
         {
-            av_packet_unref(vfile->av_packet);
+            video_file_unref_packet(vfile);
             continue;
         }
 
-        av_packet_unref(vfile->av_packet);
+        video_file_unref_packet(vfile);
         break;
     }
 
+    if (response == AVERROR_EOF && vfile->looping)
+    {
+        video_file_start_drain(vfile);
+        return video_file_read_frame(vfile_ptr);
+    }
+
     if(response < 0)
     {
         print_error(response);
@@ -94,6 +456,193 @@ bool video_file_read_frame(CVideoFile** vfile_ptr)
     return true;
 }
 
+void video_file_set_callbacks(CVideoFile** vfile_ptr, video_file_frame_callback_t on_video_frame, video_file_frame_callback_t on_audio_frame, void* user_data)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    vfile->on_video_frame = on_video_frame;
+    vfile->on_audio_frame = on_audio_frame;
+    vfile->callback_user_data = user_data;
+}
+
+CDataStream** video_file_get_stream(CVideoFile** vfile_ptr, int32_t stream_index)
+{
+    CVideoFile* vfile = *vfile_ptr;
+
+    if (vfile->vstream->av_codec_ctx && stream_index == vfile->vstream->data_stream_index && !frame_cache_is_readable(&vfile->frame_cache))
+        return &vfile->vstream;
+    if (vfile->astream->av_codec_ctx && stream_index == vfile->astream->data_stream_index)
+        return &vfile->astream;
+    for (int32_t i = 0; i < vfile->extra_astream_count; i++)
+    {
+        if (stream_index == vfile->extra_astreams[i]->data_stream_index)
+            return &vfile->extra_astreams[i];
+    }
+    return NULL;
+}
+
+// Delivers the next cached video frame once audio caught up with video
+static bool video_file_pump_cached(CVideoFile* vfile)
+{
+    CDataStream** stream_ptr = &vfile->vstream;
+    CDataStream* astream = vfile->astream;
+
+    if (!frame_cache_is_readable(&vfile->frame_cache) || (*stream_ptr)->end_of_stream)
+        return false;
+
+    if (astream->av_codec_ctx && !astream->end_of_stream && data_stream_get_pt_seconds(stream_ptr) > data_stream_get_pt_seconds(&vfile->astream))
+        return false;
+
+    if (data_stream_read_cached_frame(stream_ptr) < 0)
+        return true;
+
+    video_file_loop_track(*stream_ptr, (*stream_ptr)->pts - (*stream_ptr)->pts_offset, 0);
+    if (vfile->on_video_frame)
+        vfile->on_video_frame(stream_ptr, vfile->callback_user_data);
+
+    return true;
+}
+
+// Receives one frame from the first decoder that has frames, returns true if any work was done
+static bool video_file_pump_receive(CVideoFile* vfile)
+{
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        CDataStream** stream_ptr = streams[i];
+        if (!(*stream_ptr)->av_codec_ctx || !(*stream_ptr)->frames_pending)
+            continue;
+
+        int response = data_stream_receive_frame(stream_ptr);
+        if (response == 0)
+        {
+            video_file_frame_callback_t callback = i == 0 ? vfile->on_video_frame : vfile->on_audio_frame;
+            if (callback)
+                callback(stream_ptr, vfile->callback_user_data);
+        }
+        else if (response != DATA_STREAM_FRAME_DROPPED && response != AVERROR(EAGAIN) && response != AVERROR_EOF)
+        {
+            // Broken frame, decoding continues from the next packet
+            (*stream_ptr)->frames_pending = false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+static bool video_file_pump_send(CVideoFile* vfile)
+{
+    CDataStream** stream_ptr = video_file_get_stream(&vfile, vfile->av_packet->stream_index);
+
+    if (stream_ptr && data_stream_send_packet(stream_ptr, vfile->av_packet) == AVERROR(EAGAIN))
+        return false;
+
+    video_file_unref_packet(vfile);
+    vfile->packet_pending = false;
+    return true;
+}
+
+static void video_file_pump_read(CVideoFile* vfile)
+{
+    int response = video_file_next_packet(vfile);
+
+    if (response < 0)
+    {
+        if (response != AVERROR_EOF)
+            print_error(response);
+
+        video_file_start_drain(vfile);
+        return;
+    }
+
+    if (video_file_get_stream(&vfile, vfile->av_packet->stream_index))
+        vfile->packet_pending = true;
+    else
+        video_file_unref_packet(vfile);
+}
+
+enum EPumpStatus video_file_pump(CVideoFile** vfile_ptr, int64_t budget_us)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    int64_t deadline = av_gettime_relative() + budget_us;
+
+    if (!vfile->av_format_ctx || !vfile->av_packet)
+        return PUMP_STATUS_ERROR;
+
+    do
+    {
+        if (video_file_pump_cached(vfile))
+            continue;
+
+        // Frames already decoded are taken first, so decoded data does not pile up
+        if (video_file_pump_receive(vfile))
+            continue;
+
+        if (vfile->packet_pending)
+        {
+            // The decoder refused the packet, it will be retried after receiving frames
+            video_file_pump_send(vfile);
+            continue;
+        }
+
+        if (!vfile->demuxer_eof)
+        {
+            video_file_pump_read(vfile);
+            continue;
+        }
+
+        if (vfile->looping && video_file_loop_restart(vfile))
+            continue;
+
+        return PUMP_STATUS_END_OF_FILE;
+    } while (av_gettime_relative() < deadline);
+
+    return PUMP_STATUS_PENDING;
+}
+
+void video_file_set_looping(CVideoFile** vfile_ptr, bool looping)
+{
+    CVideoFile* vfile = *vfile_ptr;
+
+    if (looping && !vfile->loop_packets)
+        vfile->loop_packets = (AVPacket**)allocator_malloc(sizeof(AVPacket*) * VIDEO_FILE_LOOP_PREFETCH_PACKETS);
+
+    vfile->looping = looping;
+    vfile->loop_prefetching = looping && vfile->loop_count == 0 && vfile->loop_packet_count == 0;
+}
+
+bool video_file_enable_frame_cache(CVideoFile** vfile_ptr, const char* cache_dir, enum EFrameCacheCompression compression)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    CDataStream* vstream = vfile->vstream;
+
+    if (!vstream->av_codec_ctx || vstream->shared_ring || vstream->atlas || vstream->texture_format != TEXTURE_FORMAT_NONE ||
+        vfile->frame_cache || !vfile->av_format_ctx->url)
+        return false;
+
+    if (vstream->swidth <= 0 || vstream->sheight <= 0)
+        data_stream_set_frame_size(&vfile->vstream, vstream->fwidth, vstream->fheight);
+
+    vfile->frame_cache = frame_cache_alloc();
+    if (!frame_cache_open(&vfile->frame_cache, cache_dir, vfile->av_format_ctx->url, vstream->swidth, vstream->sheight,
+        vstream->av_output_pix_fmt, vstream->time_base, compression))
+    {
+        frame_cache_close(&vfile->frame_cache);
+        return false;
+    }
+
+    data_stream_set_frame_cache(&vfile->vstream, vfile->frame_cache);
+
+    // Video packets are not even demuxed when frames come from the cache
+    if (frame_cache_is_readable(&vfile->frame_cache))
+        vfile->av_format_ctx->streams[vstream->data_stream_index]->discard = AVDISCARD_ALL;
+
+    return true;
+}
+
 bool video_file_allow_hwdecoding_video(CVideoFile** vfile_ptr)
 {
     CVideoFile* vfile = *vfile_ptr;
@@ -108,6 +657,139 @@ bool video_file_allow_hwdecoding_audio(CVideoFile** vfile_ptr)
     return true;
 }
 
+void video_file_set_playback_rate(CVideoFile** vfile_ptr, double rate, double display_fps)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+
+    if (rate <= 0.0)
+        return;
+
+    for (int32_t i = 0; i < stream_count; i++)
+        data_stream_set_playback_rate(streams[i], rate);
+
+    // Source time between two displayed frames, frames in between are not converted
+    data_stream_set_min_frame_interval(&vfile->vstream, display_fps > 0.0 ? (int64_t)(rate * 1000000.0 / display_fps) : 0);
+}
+
+void video_file_select_video_track(CVideoFile** vfile_ptr, int32_t stream_index)
+{
+    data_stream_set_wanted_stream(&(*vfile_ptr)->vstream, stream_index);
+}
+
+void video_file_select_audio_language(CVideoFile** vfile_ptr, const char* language)
+{
+    CVideoFile* vfile = *vfile_ptr;
+
+    allocator_free(vfile->audio_language);
+    vfile->audio_language = language ? allocator_strdup(language) : NULL;
+}
+
+bool video_file_select_audio_tracks(CVideoFile** vfile_ptr, const int32_t* stream_indices, int32_t count)
+{
+    CVideoFile* vfile = *vfile_ptr;
+
+    if (count > VIDEO_FILE_MAX_AUDIO_TRACKS)
+        return false;
+
+    vfile->audio_track_count = count < 0 ? -1 : count;
+    for (int32_t i = 0; i < count; i++)
+        vfile->audio_tracks[i] = stream_indices[i];
+    return true;
+}
+
+int32_t video_file_get_track_count(CVideoFile** vfile_ptr)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    return vfile->av_format_ctx ? (int32_t)vfile->av_format_ctx->nb_streams : 0;
+}
+
+bool video_file_get_track_info(CVideoFile** vfile_ptr, int32_t stream_index, CTrackInfo* info)
+{
+    CVideoFile* vfile = *vfile_ptr;
+
+    if (stream_index < 0 || stream_index >= video_file_get_track_count(vfile_ptr))
+        return false;
+
+    AVStream* av_stream = vfile->av_format_ctx->streams[stream_index];
+    AVCodecParameters* av_codec_params = av_stream->codecpar;
+    AVDictionaryEntry* language = av_dict_get(av_stream->metadata, "language", NULL, 0);
+
+    info->stream_index = stream_index;
+    info->type = av_codec_params->codec_type;
+    info->codec_id = av_codec_params->codec_id;
+    info->language = language ? language->value : NULL;
+    info->width = av_codec_params->width;
+    info->height = av_codec_params->height;
+    info->channels = av_codec_params->channels;
+    info->sample_rate = av_codec_params->sample_rate;
+    info->is_default = (av_stream->disposition & AV_DISPOSITION_DEFAULT) != 0;
+    info->is_selected = av_stream->discard != AVDISCARD_ALL;
+    return true;
+}
+
+bool video_file_attach_atlas(CVideoFile** vfile_ptr, CFrameAtlas* atlas, int32_t width, int32_t height)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    CDataStream* vstream = vfile->vstream;
+
+    if (!vstream || vfile->atlas)
+        return false;
+
+    if (width <= 0 || height <= 0)
+    {
+        width = vstream->swidth > 0 ? vstream->swidth : vstream->fwidth;
+        height = vstream->sheight > 0 ? vstream->sheight : vstream->fheight;
+    }
+
+    int32_t rect = frame_atlas_add_rect(&atlas, width, height);
+    if (rect < 0)
+    {
+        fprintf(stderr, "No room for %dx%d frames in the atlas.\n", width, height);
+        return false;
+    }
+
+    vfile->atlas = atlas;
+    vfile->atlas_rect = rect;
+    data_stream_set_atlas(&vfile->vstream, atlas, rect);
+    return true;
+}
+
+bool video_file_build_waveform(CVideoFile** vfile_ptr, CWaveform** waveform_ptr, int32_t samples_per_bucket)
+{
+    CVideoFile* vfile = *vfile_ptr;
+    CDataStream** streams[VIDEO_FILE_MAX_AUDIO_TRACKS + 1];
+
+    if (!vfile->astream || !vfile->astream->av_codec_ctx || vfile->loop_count > 0)
+        return false;
+
+    bool result = data_stream_build_waveform(&vfile->astream, vfile->av_format_ctx, waveform_ptr, samples_per_bucket);
+
+    // The demuxer was moved back to the start, playback begins from there
+    int32_t stream_count = video_file_collect_streams(vfile, streams);
+    for (int32_t i = 0; i < stream_count; i++)
+    {
+        CDataStream* stream = *streams[i];
+        if (!stream->av_codec_ctx)
+            continue;
+
+        avcodec_flush_buffers(stream->av_codec_ctx);
+        stream->frames_pending = false;
+        stream->end_of_stream = false;
+    }
+
+    if (vfile->packet_pending)
+        video_file_unref_packet(vfile);
+    vfile->packet_pending = false;
+    vfile->demuxer_eof = false;
+
+    // Packets kept for the loop point were read before the seek
+    video_file_loop_reset(vfile);
+
+    return result;
+}
+
 void video_file_close(CVideoFile** vfile_ptr)
 {
     avformat_close_input(&(*vfile_ptr)->av_format_ctx);
@@ -115,4 +797,20 @@ void video_file_close(CVideoFile** vfile_ptr)
     av_packet_free(&(*vfile_ptr)->av_packet);
     data_stream_close(&(*vfile_ptr)->vstream);
     data_stream_close(&(*vfile_ptr)->astream);
+    for (int32_t i = 0; i < (*vfile_ptr)->extra_astream_count; i++)
+        data_stream_close(&(*vfile_ptr)->extra_astreams[i]);
+    allocator_free((*vfile_ptr)->audio_language);
+
+    for (int32_t i = 0; i < (*vfile_ptr)->loop_packet_count; i++)
+    {
+        memory_budget_release(MEMORY_CATEGORY_PACKETS, (*vfile_ptr)->loop_packets[i]->size);
+        av_packet_free(&(*vfile_ptr)->loop_packets[i]);
+    }
+    allocator_free((*vfile_ptr)->loop_packets);
+    frame_cache_close(&(*vfile_ptr)->frame_cache);
+    if ((*vfile_ptr)->atlas)
+        frame_atlas_remove_rect(&(*vfile_ptr)->atlas, (*vfile_ptr)->atlas_rect);
+
+    allocator_free(*vfile_ptr);
+    *vfile_ptr = NULL;
 }
\ No newline at end of file
@@ -3,6 +3,54 @@
 
 #include "DataStream.h"
 
+/**
+ * Largest number of audio tracks decoded at once.
+ */
+#define VIDEO_FILE_MAX_AUDIO_TRACKS 16
+
+/**
+ * Callback called when a frame was decoded and converted by video_file_pump.
+ * The converted data is available in block_buffer of the stream until the next frame.
+ */
+typedef void (*video_file_frame_callback_t)(CDataStream** stream_ptr, void* user_data);
+
+/**
+ * Result of a single video_file_pump call.
+ */
+enum EPumpStatus
+{
+    /**
+     * The time budget was used up, work continues on the next call.
+     */
+    PUMP_STATUS_PENDING = 0,
+
+    /**
+     * All packets were read and every decoder was drained.
+     */
+    PUMP_STATUS_END_OF_FILE,
+
+    PUMP_STATUS_ERROR
+};
+
+/**
+ * Description of a single container stream.
+ */
+typedef struct CTrackInfo
+{
+    int32_t stream_index;
+    enum AVMediaType type;
+    enum AVCodecID codec_id;
+
+    /**
+     * ISO 639 language tag or NULL, valid while the file is open.
+     */
+    const char* language;
+    int32_t width, height;
+    int32_t channels, sample_rate;
+    bool is_default;
+    bool is_selected;
+} CTrackInfo;
+
 /**
  * Structure for working with a video file.
  * 
@@ -21,6 +69,53 @@ typedef struct CVideoFile
     CDataStream* vstream;
     CDataStream* astream;
 
+    /**
+     * Track selection applied by video_file_open_decode. The first selected audio track is decoded 
+     * by astream and the others by extra_astreams, audio_track_count of -1 picks the best audio track.
+     */
+    char* audio_language;
+    int32_t audio_tracks[VIDEO_FILE_MAX_AUDIO_TRACKS];
+    int32_t audio_track_count;
+    CDataStream* extra_astreams[VIDEO_FILE_MAX_AUDIO_TRACKS - 1];
+    int32_t extra_astream_count;
+
+    /**
+     * Cooperative decoding state. Packet that was read but not accepted by the decoder yet, 
+     * and whether the demuxer reached the end of file.
+     */
+    bool packet_pending;
+    bool demuxer_eof;
+
+    video_file_frame_callback_t on_video_frame;
+    video_file_frame_callback_t on_audio_frame;
+    void* callback_user_data;
+
+    /**
+     * Loop mode. Packets from the start of the file kept for replay at the loop point, 
+     * whether they are still being collected and whether they hold the whole file.
+     * loop_seeked is set once the demuxer was moved back to the start while the decoders drain.
+     */
+    bool looping;
+    int32_t loop_count;
+    AVPacket** loop_packets;
+    int32_t loop_packet_count;
+    int32_t loop_replay_index;
+    bool loop_replaying;
+    bool loop_prefetching;
+    bool loop_cache_complete;
+    bool loop_seeked;
+
+    /**
+     * Cache of converted video frames, see video_file_enable_frame_cache.
+     */
+    CFrameCache* frame_cache;
+
+    /**
+     * Atlas rectangle reserved by video_file_attach_atlas, released on close.
+     */
+    CFrameAtlas* atlas;
+    int32_t atlas_rect;
+
 } CVideoFile;
 
 /**
@@ -48,6 +143,188 @@ bool video_file_open_decode(CVideoFile**, const char*);
  */
 bool video_file_read_frame(CVideoFile**);
 
+/**
+ * Finds the opened data stream that decodes packets of container stream.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param stream_index Index of stream in the container.
+ *
+ * @return Returns pointer to the data stream or NULL if packets of this stream are not decoded.
+ */
+CDataStream** video_file_get_stream(CVideoFile** vfile_ptr, int32_t stream_index);
+
+/**
+ * Sets callbacks called by video_file_pump for every converted frame.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param on_video_frame Called for every video frame, may be NULL.
+ *
+ * @param on_audio_frame Called for every audio frame, may be NULL.
+ *
+ * @param user_data Pointer passed to callbacks.
+ */
+void video_file_set_callbacks(CVideoFile** vfile_ptr, video_file_frame_callback_t on_video_frame, video_file_frame_callback_t on_audio_frame, void* user_data);
+
+/**
+ * Enables playing the file in a loop, must be called before decoding starts.
+ * 
+ * The first packets of the file are kept while it plays. At the end the decoders are drained 
+ * and flushed instead of reopened, the kept packets are replayed while the demuxer continues 
+ * after them, and timestamps keep growing across iterations. Both video_file_pump and 
+ * video_file_read_frame deliver the delayed frames before the loop point.
+ * 
+ * Unless the kept packets hold the whole file, the demuxer seeks back to the start once end 
+ * of file is reached, on the calling thread but before the delayed frames are drained rather 
+ * than at the loop point. The flush still leaves the decoders cold, the first frame of every 
+ * iteration costs a keyframe decode.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param looping Whether playback restarts at the end of file.
+ */
+void video_file_set_looping(CVideoFile** vfile_ptr, bool looping);
+
+/**
+ * Enables the on-disk cache of converted video frames, must be called after the output 
+ * size and pixel format are set and before decoding starts.
+ * 
+ * The cache is keyed by the source file hash and the output format. If a finished cache 
+ * exists, video is not decoded at all and frames are read from the mapped file, otherwise 
+ * the cache is filled during this play and used from the next loop iteration or the next open. 
+ * Cached frames are delivered by video_file_pump only.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param cache_dir Directory of cache files.
+ *
+ * @param compression Compression of frames in a new cache.
+ *
+ * @return Returns true if the cache was opened.
+ */
+bool video_file_enable_frame_cache(CVideoFile** vfile_ptr, const char* cache_dir, enum EFrameCacheCompression compression);
+
+/**
+ * Sets playback rate, e.g. 0.25 - 8.0 for a replay viewer.
+ * 
+ * Audio is time-stretched with preserved pitch. Video decoding skips non-reference frames 
+ * above DATA_STREAM_NONREF_RATE and reads keyframes only from DATA_STREAM_KEYFRAME_RATE, 
+ * frames closer than one displayed frame are decoded but not converted. Fast playback 
+ * costs in proportion to the display frame rate, not the source frame rate. 
+ * Timestamps stay in the source timeline, the player clock advances rate times faster.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param rate Playback rate, 1.0 is normal speed.
+ *
+ * @param display_fps Display frame rate, 0 converts every decoded frame.
+ */
+void video_file_set_playback_rate(CVideoFile** vfile_ptr, double rate, double display_fps);
+
+/**
+ * Chooses the video track, e.g. a camera angle. Must be called before video_file_open_decode.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param stream_index Index of the stream in the container, -1 picks the best video track.
+ */
+void video_file_select_video_track(CVideoFile** vfile_ptr, int32_t stream_index);
+
+/**
+ * Chooses the first audio track with the language tag. Must be called before video_file_open_decode, 
+ * the best audio track is used if none matches. Explicitly selected audio tracks take precedence.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param language ISO 639 language tag, e.g. "eng", or NULL to clear.
+ */
+void video_file_select_audio_language(CVideoFile** vfile_ptr, const char* language);
+
+/**
+ * Chooses the audio tracks decoded at once. Must be called before video_file_open_decode.
+ * 
+ * Frames of every track are passed to the audio callback, tracks are told apart 
+ * by data_stream_index of the stream.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param stream_indices Indices of the streams in the container.
+ *
+ * @param count Number of tracks, 0 disables audio and -1 picks the best audio track.
+ *
+ * @return Returns false if there are more than VIDEO_FILE_MAX_AUDIO_TRACKS tracks.
+ */
+bool video_file_select_audio_tracks(CVideoFile** vfile_ptr, const int32_t* stream_indices, int32_t count);
+
+/**
+ * @return Returns number of streams in the opened container.
+ */
+int32_t video_file_get_track_count(CVideoFile** vfile_ptr);
+
+/**
+ * Describes a stream of the opened container. Streams that are not selected are 
+ * discarded by the demuxer, choosing them needs the file to be opened again.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param stream_index Index of the stream in the container.
+ *
+ * @param info Receives the description.
+ *
+ * @return Returns false if there is no such stream.
+ */
+bool video_file_get_track_info(CVideoFile** vfile_ptr, int32_t stream_index, CTrackInfo* info);
+
+/**
+ * Reserves a rectangle of the frame atlas and converts video frames into it.
+ * 
+ * The rectangle is returned to the atlas when the file is closed, so streams can 
+ * come and go while the atlas stays. The atlas must outlive the file.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param atlas Atlas created with frame_atlas_create.
+ *
+ * @param width Width of the rectangle, 0 keeps the current output width.
+ *
+ * @param height Height of the rectangle, 0 keeps the current output height.
+ *
+ * @return Returns false if there is no room in the atlas.
+ */
+bool video_file_attach_atlas(CVideoFile** vfile_ptr, CFrameAtlas* atlas, int32_t width, int32_t height);
+
+/**
+ * Builds a waveform of the audio track with video discarded, see data_stream_build_waveform.
+ * 
+ * Must be called before decoding starts, decoding continues from the start of the file.
+ * In loop mode packets kept for the loop point are released and kept again while playing.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure receiving the peaks.
+ *
+ * @param samples_per_bucket Samples per bucket of the finest level.
+ *
+ * @return Returns false if the file has no audio, decoding failed or a loop iteration already finished.
+ */
+bool video_file_build_waveform(CVideoFile** vfile_ptr, CWaveform** waveform_ptr, int32_t samples_per_bucket);
+
+/**
+ * Does as much demuxing, decoding and conversion as fits into the time budget.
+ * 
+ * Work is split into small steps (read one packet, send one packet, receive one frame), 
+ * the budget is checked between steps and the next call resumes where this one stopped. 
+ * A single step may exceed the budget. Must not be mixed with video_file_read_frame.
+ *
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
+ *
+ * @param budget_us Time budget in microseconds.
+ *
+ * @return Returns status of decoding.
+ */
+enum EPumpStatus video_file_pump(CVideoFile** vfile_ptr, int64_t budget_us);
+
 /**
  * Initialize an CHardwareAccelerator as encoder.
  *
@@ -67,12 +344,11 @@ bool video_file_allow_hwdecoding_video(CVideoFile**);
 bool video_file_allow_hwdecoding_audio(CVideoFile**);
 
 /**
- * Initialize an CHardwareAccelerator as encoder.
+ * Closes the file and releases the CVideoFile, *vfile_ptr is set to NULL.
+ * The structure must not be freed by the caller.
  *
- * @param hwdec_ptr
- *
- * @return Returns true if all initialization got well.
+ * @param vfile_ptr Pointer to pointer to CVideoFile structure.
  */
-void video_file_close(CVideoFile**);
+void video_file_close(CVideoFile** vfile_ptr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,483 @@
+#include "Waveform.h"
+#include "Allocator.h"
+#include "MemoryBudget.h"
+#include <libavutil/samplefmt.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WAVEFORM_SSE2 1
+#else
+#define WAVEFORM_SSE2 0
+#endif
+
+/**
+ * Squares are summed in float within a block and added to the double total between blocks.
+ */
+#define WAVEFORM_SUM_BLOCK 4096
+
+static void waveform_reduce(const float* samples, int64_t count, float* min_ptr, float* max_ptr, double* sum_squares_ptr)
+{
+    float min = *min_ptr, max = *max_ptr;
+    double sum_squares = *sum_squares_ptr;
+    int64_t i = 0;
+
+    #if WAVEFORM_SSE2
+    __m128 min1 = _mm_set1_ps(min), min2 = min1;
+    __m128 max1 = _mm_set1_ps(max), max2 = max1;
+
+    while (i + 8 <= count)
+    {
+        // Two sets of accumulators keep the dependency chains short
+        __m128 sum1 = _mm_setzero_ps(), sum2 = _mm_setzero_ps();
+        int64_t block_end = FFMIN(count, i + WAVEFORM_SUM_BLOCK);
+
+        for (; i + 8 <= block_end; i += 8)
+        {
+            __m128 value1 = _mm_loadu_ps(samples + i);
+            __m128 value2 = _mm_loadu_ps(samples + i + 4);
+
+            min1 = _mm_min_ps(min1, value1);
+            min2 = _mm_min_ps(min2, value2);
+            max1 = _mm_max_ps(max1, value1);
+            max2 = _mm_max_ps(max2, value2);
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(value1, value1));
+            sum2 = _mm_add_ps(sum2, _mm_mul_ps(value2, value2));
+        }
+
+        float sums[4];
+        _mm_storeu_ps(sums, _mm_add_ps(sum1, sum2));
+        sum_squares += (double)sums[0] + sums[1] + sums[2] + sums[3];
+    }
+
+    float mins[4], maxs[4];
+    _mm_storeu_ps(mins, _mm_min_ps(min1, min2));
+    _mm_storeu_ps(maxs, _mm_max_ps(max1, max2));
+    for (int32_t lane = 0; lane < 4; lane++)
+    {
+        min = FFMIN(min, mins[lane]);
+        max = FFMAX(max, maxs[lane]);
+    }
+    #endif
+
+    for (; i < count; i++)
+    {
+        float value = samples[i];
+        min = FFMIN(min, value);
+        max = FFMAX(max, value);
+        sum_squares += (double)value * value;
+    }
+
+    *min_ptr = min;
+    *max_ptr = max;
+    *sum_squares_ptr = sum_squares;
+}
+
+// Converts a single channel of any supported format into normalized float samples
+static bool waveform_convert_channel(const AVFrame* av_frame, int32_t channel, float* output)
+{
+    bool planar = av_sample_fmt_is_planar(av_frame->format);
+    const uint8_t* data = av_frame->extended_data[planar ? channel : 0];
+    int32_t stride = planar ? 1 : av_frame->channels;
+    int32_t offset = planar ? 0 : channel;
+    int32_t count = av_frame->nb_samples;
+
+    switch (av_get_packed_sample_fmt(av_frame->format))
+    {
+        case AV_SAMPLE_FMT_U8:
+            for (int32_t i = 0; i < count; i++)
+                output[i] = (data[i * stride + offset] - 128) * (1.0f / 128.0f);
+            return true;
+        case AV_SAMPLE_FMT_S16:
+            for (int32_t i = 0; i < count; i++)
+                output[i] = ((const int16_t*)data)[i * stride + offset] * (1.0f / 32768.0f);
+            return true;
+        case AV_SAMPLE_FMT_S32:
+            for (int32_t i = 0; i < count; i++)
+                output[i] = (float)(((const int32_t*)data)[i * stride + offset] * (1.0 / 2147483648.0));
+            return true;
+        case AV_SAMPLE_FMT_FLT:
+            for (int32_t i = 0; i < count; i++)
+                output[i] = ((const float*)data)[i * stride + offset];
+            return true;
+        case AV_SAMPLE_FMT_DBL:
+            for (int32_t i = 0; i < count; i++)
+                output[i] = (float)((const double*)data)[i * stride + offset];
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool waveform_reserve(CWaveform* waveform, CWaveformLevel* level, int64_t bucket_capacity)
+{
+    size_t old_size = (size_t)level->bucket_capacity * waveform->channels * sizeof(CWaveformPeak);
+    size_t new_size = (size_t)bucket_capacity * waveform->channels * sizeof(CWaveformPeak);
+    CWaveformPeak* peaks = (CWaveformPeak*)allocator_realloc(level->peaks, new_size);
+
+    if (!peaks)
+    {
+        fprintf(stderr, "Couldn't allocate waveform peaks.\n");
+        return false;
+    }
+
+    level->peaks = peaks;
+    level->bucket_capacity = bucket_capacity;
+    memory_budget_release(MEMORY_CATEGORY_AUDIO, old_size);
+    memory_budget_acquire(MEMORY_CATEGORY_AUDIO, new_size);
+    waveform->memory_size += new_size - old_size;
+
+    return true;
+}
+
+static void waveform_reset_bucket(CWaveform* waveform)
+{
+    for (int32_t c = 0; c < WAVEFORM_MAX_CHANNELS; c++)
+    {
+        waveform->bucket_min[c] = FLT_MAX;
+        waveform->bucket_max[c] = -FLT_MAX;
+        waveform->bucket_sum_squares[c] = 0.0;
+    }
+    waveform->bucket_fill = 0;
+}
+
+static bool waveform_push_bucket(CWaveform* waveform)
+{
+    CWaveformLevel* level = &waveform->levels[0];
+
+    if (level->bucket_count == level->bucket_capacity && !waveform_reserve(waveform, level, FFMAX(level->bucket_capacity * 2, 1024)))
+        return false;
+
+    CWaveformPeak* peaks = &level->peaks[level->bucket_count * waveform->channels];
+    for (int32_t c = 0; c < waveform->channels; c++)
+    {
+        peaks[c].min = waveform->bucket_min[c];
+        peaks[c].max = waveform->bucket_max[c];
+        peaks[c].rms = (float)sqrt(waveform->bucket_sum_squares[c] / waveform->bucket_fill);
+    }
+    level->bucket_count++;
+
+    waveform_reset_bucket(waveform);
+    return true;
+}
+
+static void waveform_merge_peak(CWaveformPeak* target, const CWaveformPeak* source, double* sum_squares)
+{
+    target->min = FFMIN(target->min, source->min);
+    target->max = FFMAX(target->max, source->max);
+    *sum_squares += (double)source->rms * source->rms;
+}
+
+static void waveform_free_levels(CWaveform* waveform)
+{
+    for (int32_t l = 0; l < WAVEFORM_MAX_LEVELS; l++)
+    {
+        allocator_free(waveform->levels[l].peaks);
+        memset(&waveform->levels[l], 0, sizeof(CWaveformLevel));
+    }
+    memory_budget_release(MEMORY_CATEGORY_AUDIO, waveform->memory_size);
+    waveform->memory_size = 0;
+    waveform->level_count = 0;
+}
+
+CWaveform* waveform_alloc()
+{
+    CWaveform* waveform = NULL;
+    waveform = (CWaveform*)allocator_malloc(sizeof(CWaveform));
+
+    if (!waveform)
+    {
+        fprintf(stderr, "Couldn't allocate waveform.\n");
+        return NULL;
+    }
+
+    waveform->sample_rate = 0;
+    waveform->channels = 0;
+    waveform->sample_count = 0;
+    memset(waveform->levels, 0, sizeof(waveform->levels));
+    waveform->level_count = 0;
+    waveform_reset_bucket(waveform);
+    waveform->scratch = NULL;
+    waveform->scratch_capacity = 0;
+    waveform->memory_size = 0;
+    waveform->finished = false;
+
+    return waveform;
+}
+
+bool waveform_begin(CWaveform** waveform_ptr, int32_t sample_rate, int32_t channels, int32_t samples_per_bucket)
+{
+    CWaveform* waveform = *waveform_ptr;
+
+    if (sample_rate <= 0 || channels <= 0 || samples_per_bucket <= 0)
+    {
+        fprintf(stderr, "Invalid waveform settings.\n");
+        return false;
+    }
+
+    waveform_free_levels(waveform);
+    waveform->sample_rate = sample_rate;
+    waveform->channels = FFMIN(channels, WAVEFORM_MAX_CHANNELS);
+    waveform->sample_count = 0;
+    waveform->levels[0].samples_per_bucket = samples_per_bucket;
+    waveform->level_count = 1;
+    waveform->finished = false;
+    waveform_reset_bucket(waveform);
+
+    return true;
+}
+
+bool waveform_add_frame(CWaveform** waveform_ptr, const AVFrame* av_frame)
+{
+    CWaveform* waveform = *waveform_ptr;
+    const float* planes[WAVEFORM_MAX_CHANNELS];
+    int32_t channels = FFMIN(waveform->channels, av_frame->channels);
+    int64_t samples_per_bucket = waveform->levels[0].samples_per_bucket;
+
+    if (waveform->finished || !waveform->level_count)
+        return false;
+
+    // Float planar frames, the usual decoder output, are reduced in place
+    if (av_frame->format != AV_SAMPLE_FMT_FLTP)
+    {
+        size_t required = (size_t)av_frame->nb_samples * channels;
+        if (waveform->scratch_capacity < required)
+        {
+            allocator_free(waveform->scratch);
+            waveform->scratch_capacity = 0;
+            if (!(waveform->scratch = (float*)allocator_aligned_malloc(required * sizeof(float), ALLOCATOR_DEFAULT_ALIGNMENT)))
+                return false;
+            waveform->scratch_capacity = required;
+        }
+    }
+
+    for (int32_t c = 0; c < channels; c++)
+    {
+        if (av_frame->format == AV_SAMPLE_FMT_FLTP)
+            planes[c] = (const float*)av_frame->extended_data[c];
+        else if (waveform_convert_channel(av_frame, c, waveform->scratch + (size_t)c * av_frame->nb_samples))
+            planes[c] = waveform->scratch + (size_t)c * av_frame->nb_samples;
+        else
+        {
+            fprintf(stderr, "Unsupported waveform sample format.\n");
+            return false;
+        }
+    }
+
+    for (int64_t offset = 0; offset < av_frame->nb_samples;)
+    {
+        int64_t count = FFMIN(av_frame->nb_samples - offset, samples_per_bucket - waveform->bucket_fill);
+
+        for (int32_t c = 0; c < channels; c++)
+            waveform_reduce(planes[c] + offset, count, &waveform->bucket_min[c], &waveform->bucket_max[c], &waveform->bucket_sum_squares[c]);
+
+        offset += count;
+        waveform->bucket_fill += count;
+        if (waveform->bucket_fill == samples_per_bucket && !waveform_push_bucket(waveform))
+            return false;
+    }
+
+    waveform->sample_count += av_frame->nb_samples;
+    return true;
+}
+
+bool waveform_finish(CWaveform** waveform_ptr)
+{
+    CWaveform* waveform = *waveform_ptr;
+
+    if (waveform->finished || !waveform->level_count)
+        return waveform->finished;
+
+    if (waveform->bucket_fill > 0 && !waveform_push_bucket(waveform))
+        return false;
+
+    // Every coarser level merges pairs of buckets, the last odd bucket is taken as is
+    while (waveform->level_count < WAVEFORM_MAX_LEVELS && waveform->levels[waveform->level_count - 1].bucket_count > 1)
+    {
+        CWaveformLevel* source = &waveform->levels[waveform->level_count - 1];
+        CWaveformLevel* level = &waveform->levels[waveform->level_count];
+
+        if (!waveform_reserve(waveform, level, (source->bucket_count + 1) / 2))
+            return false;
+        level->samples_per_bucket = source->samples_per_bucket * 2;
+        level->bucket_count = level->bucket_capacity;
+
+        for (int64_t i = 0; i < level->bucket_count; i++)
+        {
+            int64_t merged = FFMIN(source->bucket_count - i * 2, 2);
+
+            for (int32_t c = 0; c < waveform->channels; c++)
+            {
+                CWaveformPeak* peak = &level->peaks[i * waveform->channels + c];
+                double sum_squares = 0.0;
+
+                *peak = source->peaks[i * 2 * waveform->channels + c];
+                peak->rms = 0.0f;
+                waveform_merge_peak(peak, &source->peaks[i * 2 * waveform->channels + c], &sum_squares);
+                if (merged > 1)
+                    waveform_merge_peak(peak, &source->peaks[(i * 2 + 1) * waveform->channels + c], &sum_squares);
+                peak->rms = (float)sqrt(sum_squares / merged);
+            }
+        }
+        waveform->level_count++;
+    }
+
+    allocator_free(waveform->scratch);
+    waveform->scratch = NULL;
+    waveform->scratch_capacity = 0;
+    waveform->finished = true;
+
+    return true;
+}
+
+bool waveform_get_peaks(CWaveform** waveform_ptr, double start_seconds, double end_seconds, int32_t count, CWaveformPeak* peaks)
+{
+    CWaveform* waveform = *waveform_ptr;
+
+    if (!waveform->finished || count <= 0 || end_seconds <= start_seconds)
+        return false;
+
+    double start_sample = start_seconds * waveform->sample_rate;
+    double samples_per_peak = (end_seconds - start_seconds) * waveform->sample_rate / count;
+
+    // The coarsest level that still has at least one bucket per output peak
+    int32_t level_index = 0;
+    while (level_index + 1 < waveform->level_count && waveform->levels[level_index + 1].samples_per_bucket <= samples_per_peak)
+        level_index++;
+    CWaveformLevel* level = &waveform->levels[level_index];
+
+    for (int32_t i = 0; i < count; i++)
+    {
+        int64_t first = (int64_t)floor((start_sample + samples_per_peak * i) / level->samples_per_bucket);
+        int64_t last = (int64_t)ceil((start_sample + samples_per_peak * (i + 1)) / level->samples_per_bucket);
+        first = FFMAX(first, 0);
+        last = FFMIN(FFMAX(last, first + 1), level->bucket_count);
+
+        for (int32_t c = 0; c < waveform->channels; c++)
+        {
+            CWaveformPeak* peak = &peaks[(size_t)i * waveform->channels + c];
+            double sum_squares = 0.0;
+
+            if (first >= last)
+            {
+                memset(peak, 0, sizeof(CWaveformPeak));
+                continue;
+            }
+
+            peak->min = FLT_MAX;
+            peak->max = -FLT_MAX;
+            for (int64_t b = first; b < last; b++)
+                waveform_merge_peak(peak, &level->peaks[b * waveform->channels + c], &sum_squares);
+            peak->rms = (float)sqrt(sum_squares / (last - first));
+        }
+    }
+
+    return true;
+}
+
+bool waveform_save(CWaveform** waveform_ptr, const char* filename)
+{
+    CWaveform* waveform = *waveform_ptr;
+    CWaveformHeader header;
+    FILE* file = NULL;
+    bool result;
+
+    if (!waveform->finished)
+        return false;
+
+    memset(&header, 0, sizeof(CWaveformHeader));
+    header.magic = WAVEFORM_MAGIC;
+    header.version = WAVEFORM_VERSION;
+    header.sample_rate = waveform->sample_rate;
+    header.channels = waveform->channels;
+    header.sample_count = waveform->sample_count;
+    header.samples_per_bucket = (int32_t)waveform->levels[0].samples_per_bucket;
+    header.level_count = waveform->level_count;
+    for (int32_t l = 0; l < waveform->level_count; l++)
+        header.bucket_counts[l] = waveform->levels[l].bucket_count;
+
+    #ifdef _WIN32
+    if(fopen_s(&file, filename, "wb") != 0)
+    #else
+    if(!(file = fopen(filename, "wb")))
+    #endif
+    {
+        fprintf(stderr, "Cannot open waveform file.\n");
+        return false;
+    }
+
+    result = fwrite(&header, sizeof(CWaveformHeader), 1, file) == 1;
+    for (int32_t l = 0; result && l < waveform->level_count; l++)
+    {
+        size_t peak_count = (size_t)waveform->levels[l].bucket_count * waveform->channels;
+        result = fwrite(waveform->levels[l].peaks, sizeof(CWaveformPeak), peak_count, file) == peak_count;
+    }
+
+    result = fclose(file) == 0 && result;
+    if (!result)
+        fprintf(stderr, "Couldn't write waveform file.\n");
+
+    return result;
+}
+
+bool waveform_load(CWaveform** waveform_ptr, const char* filename)
+{
+    CWaveform* waveform = *waveform_ptr;
+    CWaveformHeader header;
+    FILE* file = NULL;
+    bool result;
+
+    #ifdef _WIN32
+    if(fopen_s(&file, filename, "rb") != 0)
+    #else
+    if(!(file = fopen(filename, "rb")))
+    #endif
+        return false;
+
+    result = fread(&header, sizeof(CWaveformHeader), 1, file) == 1 &&
+        header.magic == WAVEFORM_MAGIC && header.version == WAVEFORM_VERSION &&
+        header.level_count > 0 && header.level_count <= WAVEFORM_MAX_LEVELS &&
+        header.channels > 0 && header.channels <= WAVEFORM_MAX_CHANNELS &&
+        waveform_begin(waveform_ptr, header.sample_rate, header.channels, header.samples_per_bucket);
+
+    for (int32_t l = 0; result && l < header.level_count; l++)
+    {
+        CWaveformLevel* level = &waveform->levels[l];
+        size_t peak_count = (size_t)header.bucket_counts[l] * header.channels;
+
+        result = header.bucket_counts[l] >= 0 && (!peak_count || (waveform_reserve(waveform, level, header.bucket_counts[l]) &&
+            fread(level->peaks, sizeof(CWaveformPeak), peak_count, file) == peak_count));
+        level->samples_per_bucket = (int64_t)header.samples_per_bucket << l;
+        level->bucket_count = header.bucket_counts[l];
+    }
+    fclose(file);
+
+    if (!result)
+    {
+        fprintf(stderr, "Invalid waveform file.\n");
+        waveform_free_levels(waveform);
+        return false;
+    }
+
+    waveform->sample_count = header.sample_count;
+    waveform->level_count = header.level_count;
+    waveform->finished = true;
+
+    return true;
+}
+
+void waveform_close(CWaveform** waveform_ptr)
+{
+    CWaveform* waveform = *waveform_ptr;
+
+    if (!waveform)
+        return;
+
+    waveform_free_levels(waveform);
+    allocator_free(waveform->scratch);
+    allocator_free(waveform);
+    *waveform_ptr = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+#ifndef AV_WAVEFORM
+#define AV_WAVEFORM
+
+#include <libavutil/avutil.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAVEFORM_MAGIC 0x46575645u
+#define WAVEFORM_VERSION 1
+
+/**
+ * Every level merges pairs of buckets of the level below, levels stop once a single bucket is left.
+ */
+#define WAVEFORM_MAX_LEVELS 32
+#define WAVEFORM_MAX_CHANNELS 8
+
+/**
+ * Peak values of a single channel within a bucket, samples are normalized to [-1, 1].
+ */
+typedef struct CWaveformPeak
+{
+    float                   min;
+    float                   max;
+    float                   rms;
+} CWaveformPeak;
+
+/**
+ * Buckets of a single resolution, bucket i of channel c is peaks[i * channels + c].
+ */
+typedef struct CWaveformLevel
+{
+    int64_t                 samples_per_bucket;
+    int64_t                 bucket_count;
+    int64_t                 bucket_capacity;
+    CWaveformPeak*          peaks;
+} CWaveformLevel;
+
+/**
+ * Header of a waveform sidecar file, followed by peaks of every level from the finest one.
+ */
+typedef struct CWaveformHeader
+{
+    uint32_t                magic;
+    uint32_t                version;
+    int32_t                 sample_rate;
+    int32_t                 channels;
+    int64_t                 sample_count;
+    int32_t                 samples_per_bucket;
+    int32_t                 level_count;
+    int64_t                 bucket_counts[WAVEFORM_MAX_LEVELS];
+} CWaveformHeader;
+
+/**
+ * Multi-resolution peak pyramid of an audio stream.
+ *
+ * Decoded frames are reduced to min, max and RMS per bucket of the finest level,
+ * coarser levels are built from it once all samples were added. Any zoom level is
+ * served from the closest level without decoding the audio again.
+ */
+typedef struct CWaveform
+{
+    int32_t                 sample_rate;
+    int32_t                 channels;
+    int64_t                 sample_count;
+
+    CWaveformLevel          levels[WAVEFORM_MAX_LEVELS];
+    int32_t                 level_count;
+
+    /**
+     * Bucket being filled, sum_squares is kept in double to stay exact over long buckets.
+     */
+    float                   bucket_min[WAVEFORM_MAX_CHANNELS];
+    float                   bucket_max[WAVEFORM_MAX_CHANNELS];
+    double                  bucket_sum_squares[WAVEFORM_MAX_CHANNELS];
+    int64_t                 bucket_fill;
+
+    /**
+     * Samples of non float planar frames converted into float planes.
+     */
+    float*                  scratch;
+    size_t                  scratch_capacity;
+
+    size_t                  memory_size;
+    bool                    finished;
+} CWaveform;
+
+/**
+ * Allocate an CWaveform and set its fields to default values.
+ *
+ * @return An CWaveform filled with default values or NULL on failure.
+ */
+CWaveform* waveform_alloc(void);
+
+/**
+ * Prepares the waveform for adding samples, previous peaks are released.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ *
+ * @param sample_rate Sample rate of the audio.
+ *
+ * @param channels Number of channels, channels above WAVEFORM_MAX_CHANNELS are ignored.
+ *
+ * @param samples_per_bucket Samples per bucket of the finest level.
+ *
+ * @return Returns false if the settings are not valid.
+ */
+bool waveform_begin(CWaveform** waveform_ptr, int32_t sample_rate, int32_t channels, int32_t samples_per_bucket);
+
+/**
+ * Adds samples of a decoded frame.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ *
+ * @param av_frame Audio frame in any packed or planar U8, S16, S32, FLT or DBL format.
+ *
+ * @return Returns false if the sample format is not supported or allocation failed.
+ */
+bool waveform_add_frame(CWaveform** waveform_ptr, const AVFrame* av_frame);
+
+/**
+ * Closes the last bucket and builds the coarser levels.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ *
+ * @return Returns false if allocation failed.
+ */
+bool waveform_finish(CWaveform** waveform_ptr);
+
+/**
+ * Reduces a time range into evenly spaced peaks, e.g. one per pixel of a timeline clip.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ *
+ * @param start_seconds Start of the range.
+ *
+ * @param end_seconds End of the range.
+ *
+ * @param count Number of output peaks per channel.
+ *
+ * @param peaks Receives count * channels peaks, peak i of channel c is peaks[i * channels + c].
+ *
+ * @return Returns false if the waveform is not finished.
+ */
+bool waveform_get_peaks(CWaveform** waveform_ptr, double start_seconds, double end_seconds, int32_t count, CWaveformPeak* peaks);
+
+/**
+ * Writes the finished waveform into a sidecar file.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ *
+ * @param filename Path to the sidecar file.
+ *
+ * @return Returns true if the file was written.
+ */
+bool waveform_save(CWaveform** waveform_ptr, const char* filename);
+
+/**
+ * Reads a waveform written by waveform_save.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ *
+ * @param filename Path to the sidecar file.
+ *
+ * @return Returns false if the file is missing or not valid.
+ */
+bool waveform_load(CWaveform** waveform_ptr, const char* filename);
+
+/**
+ * Releases peaks and the waveform.
+ *
+ * @param waveform_ptr Pointer to pointer to CWaveform structure.
+ */
+void waveform_close(CWaveform** waveform_ptr);
+
+#endif
\ No newline at end of file
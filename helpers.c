@@ -2,6 +2,15 @@
 #include "assert.h"
 #include "stdio.h"
 #include "string.h"
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HELPERS_SSE2 1
+#else
+#define HELPERS_SSE2 0
+#endif
 
 #define assertm(exp, msg) assert(((void)msg, exp))
 
@@ -90,4 +99,92 @@ enum AVPixelFormat correct_for_deprecated_pixel_format(enum AVPixelFormat pix_fm
     default:
         return pix_fmt;
     }
+}
+
+size_t frame_buffer_size(const AVFrame* av_frame)
+{
+    size_t total_size = 0;
+
+    if(!av_frame)
+        return 0;
+
+    for(int32_t i = 0; i < AV_NUM_DATA_POINTERS; i++)
+    {
+        if(av_frame->buf[i])
+            total_size += av_frame->buf[i]->size;
+    }
+
+    return total_size;
+}
+
+// Fletcher style sums over two 64-bit lanes, the second sum makes the hash depend on the position of the data
+static void frame_content_hash_row(const uint8_t* row, int32_t size, uint64_t sums[4])
+{
+    int32_t i = 0;
+
+    #if HELPERS_SSE2
+    __m128i sum1 = _mm_loadu_si128((const __m128i*)sums);
+    __m128i sum2 = _mm_loadu_si128((const __m128i*)(sums + 2));
+
+    for (; i + 16 <= size; i += 16)
+    {
+        sum1 = _mm_add_epi64(sum1, _mm_loadu_si128((const __m128i*)(row + i)));
+        sum2 = _mm_add_epi64(sum2, sum1);
+    }
+
+    _mm_storeu_si128((__m128i*)sums, sum1);
+    _mm_storeu_si128((__m128i*)(sums + 2), sum2);
+    #else
+    for (; i + 16 <= size; i += 16)
+    {
+        uint64_t words[2];
+        memcpy(words, row + i, 16);
+        sums[0] += words[0];
+        sums[1] += words[1];
+        sums[2] += sums[0];
+        sums[3] += sums[1];
+    }
+    #endif
+
+    uint64_t tail = 0;
+    if (i < size)
+    {
+        memcpy(&tail, row + i, size - i < 8 ? size - i : 8);
+        sums[0] += tail;
+        if (size - i > 8)
+        {
+            tail = 0;
+            memcpy(&tail, row + i + 8, size - i - 8);
+            sums[1] += tail;
+        }
+        sums[2] += sums[0];
+        sums[3] += sums[1];
+    }
+}
+
+bool frame_content_hash(const AVFrame* av_frame, uint64_t* hash)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((enum AVPixelFormat)av_frame->format);
+    int row_size[4] = {0};
+    uint64_t sums[4] = {0};
+
+    // Downloaded frames may still reference the hardware frames context, only the format tells where the data is
+    if (!desc || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) || !av_frame->data[0] ||
+        av_image_fill_linesizes(row_size, (enum AVPixelFormat)av_frame->format, av_frame->width) < 0)
+        return false;
+
+    for (int32_t p = 0; p < 4 && av_frame->data[p]; p++)
+    {
+        int32_t rows = (p == 1 || p == 2) ? -((-av_frame->height) >> desc->log2_chroma_h) : av_frame->height;
+
+        for (int32_t y = 0; y < rows; y++)
+            frame_content_hash_row(av_frame->data[p] + (ptrdiff_t)y * av_frame->linesize[p], row_size[p], sums);
+    }
+
+    uint64_t result = (uint64_t)av_frame->format << 48 ^ (uint64_t)av_frame->width << 24 ^ (uint64_t)av_frame->height;
+    for (int32_t i = 0; i < 4; i++)
+        result = (result ^ sums[i]) * 0x100000001b3ull;
+
+    *hash = result;
+    return true;
 }
\ No newline at end of file
@@ -69,4 +69,25 @@ void*: ffmpeg_call_vm \
  */
 enum AVPixelFormat correct_for_deprecated_pixel_format(enum AVPixelFormat pix_fmt);
 
+/**
+ * Calculates the amount of memory referenced by the frame buffers.
+ *
+ * @param av_frame Decoded audio or video frame.
+ *
+ * @return Returns the summary size of all frame buffers in bytes.
+ */
+size_t frame_buffer_size(const AVFrame* av_frame);
+
+/**
+ * Hashes the visible pixels of a frame in system memory, row padding is ignored.
+ * Meant for detecting repeated frames, not for integrity checks.
+ *
+ * @param av_frame Decoded video frame.
+ *
+ * @param hash Receives the hash.
+ *
+ * @return Returns false if the frame data is not in system memory or the format is unknown.
+ */
+bool frame_content_hash(const AVFrame* av_frame, uint64_t* hash);
+
 #endif
\ No newline at end of file
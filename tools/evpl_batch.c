@@ -0,0 +1,652 @@
+/**
+ * evpl_batch - runs probe, thumbnail, transcode, remux and waveform jobs from a manifest
+ * on a bounded worker pool, so codec and process initialization is paid once.
+ *
+ * Manifest format, one job per line, '#' starts a comment, paths with spaces must be quoted:
+ *
+ *   probe     <input>
+ *   thumbnail <input> <output.ppm> [seconds] [width]
+ *   transcode <input> <output.h264> [width height] [bitrate_kbps]
+ *   remux     <input> <output>
+ *   waveform  <input> <output.evwf> [samples_per_bucket]
+ *
+ * Usage: evpl_batch [-j threads] [-r report.csv] [-c probe_cache.bin] manifest.txt
+ *
+ * Probe jobs open only the demuxer, with -c their results are kept in a cache file
+ * and files that did not change are not opened again.
+ */
+
+#include "VideoFile.h"
+#include "MediaProbe.h"
+#include "ThreadPool.h"
+#include "Allocator.h"
+#include "helpers.h"
+
+#include <libavutil/imgutils.h>
+#include <libavutil/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define BATCH_MAX_LINE 4096
+#define BATCH_MAX_TOKENS 8
+#define BATCH_WAVEFORM_SAMPLES_PER_BUCKET 256
+
+enum EBatchJobType
+{
+    BATCH_JOB_PROBE = 0,
+    BATCH_JOB_THUMBNAIL,
+    BATCH_JOB_TRANSCODE,
+    BATCH_JOB_REMUX,
+    BATCH_JOB_WAVEFORM
+};
+
+/**
+ * Shared by every probe job, so results of the whole manifest end up in one cache.
+ */
+static CMediaProbe* batch_probe = NULL;
+
+static const char* batch_job_names[] = { "probe", "thumbnail", "transcode", "remux", "waveform" };
+
+typedef struct CBatchJob
+{
+    int32_t                 index;
+    enum EBatchJobType      type;
+    char*                   input;
+    char*                   output;
+    double                  seek_seconds;
+    int32_t                 width, height;
+    int64_t                 bit_rate;
+    int32_t                 samples_per_bucket;
+
+    bool                    succeeded;
+    int64_t                 wall_time_us;
+    int64_t                 input_bytes, output_bytes;
+    int64_t                 frames;
+    double                  media_seconds;
+    char                    message[256];
+} CBatchJob;
+
+/**
+ * State shared between the thumbnail/transcode job and frame callbacks.
+ */
+typedef struct CBatchFrameContext
+{
+    CBatchJob*              job;
+    CDataStream*            encoder;
+    AVFrame*                av_frame;
+    bool                    done;
+    bool                    failed;
+} CBatchFrameContext;
+
+static int64_t batch_file_size(const char* path)
+{
+    #ifdef _WIN32
+    struct _stat64 info;
+    if(!path || _stat64(path, &info) != 0)
+        return 0;
+    #else
+    struct stat info;
+    if(!path || stat(path, &info) != 0)
+        return 0;
+    #endif
+    return (int64_t)info.st_size;
+}
+
+static double batch_media_duration(AVFormatContext* av_format_ctx)
+{
+    if(!av_format_ctx || av_format_ctx->duration == AV_NOPTS_VALUE)
+        return 0.0;
+    return av_format_ctx->duration / (double)AV_TIME_BASE;
+}
+
+static bool batch_job_probe(CBatchJob* job)
+{
+    CMediaInfo info;
+
+    if(!media_probe_file(&batch_probe, job->input, &info))
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't open input");
+        return false;
+    }
+
+    job->media_seconds = info.duration_us / 1000000.0;
+
+    int32_t offset = snprintf(job->message, sizeof(job->message), "%s%s", info.format_name, info.from_cache ? " (cached)" : "");
+    for(int32_t i = 0; i < info.stream_count && i < MEDIA_PROBE_MAX_STREAMS && offset < (int32_t)sizeof(job->message); i++)
+    {
+        CMediaStreamInfo* stream = &info.streams[i];
+        if(stream->type == AVMEDIA_TYPE_VIDEO)
+            offset += snprintf(job->message + offset, sizeof(job->message) - offset, " v:%s %dx%d gop %.2fs", avcodec_get_name(stream->codec_id), stream->width, stream->height, stream->keyframe_interval);
+        else if(stream->type == AVMEDIA_TYPE_AUDIO)
+            offset += snprintf(job->message + offset, sizeof(job->message) - offset, " a:%s %dHz", avcodec_get_name(stream->codec_id), stream->sample_rate);
+    }
+
+    return true;
+}
+
+static void batch_on_thumbnail_frame(CDataStream** stream_ptr, void* user_data)
+{
+    CBatchFrameContext* context = (CBatchFrameContext*)user_data;
+    CDataStream* stream = *stream_ptr;
+    CBatchJob* job = context->job;
+
+    context->job->frames++;
+    if(context->done || data_stream_get_pt_seconds(stream_ptr) < job->seek_seconds)
+        return;
+
+    context->done = true;
+
+    FILE* output = fopen(job->output, "wb");
+    if(!output)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't create output");
+        context->failed = true;
+        return;
+    }
+
+    fprintf(output, "P6\n%d %d\n255\n", stream->swidth, stream->sheight);
+    fwrite(stream->block_buffer, 1, (size_t)stream->swidth * stream->sheight * 3, output);
+    fclose(output);
+}
+
+static bool batch_job_thumbnail(CBatchJob* job)
+{
+    CBatchFrameContext context = { job, NULL, NULL, false, false };
+    CVideoFile* vfile = video_file_alloc();
+
+    // Audio is not used, its packets are discarded by the demuxer
+    video_file_select_audio_tracks(&vfile, NULL, 0);
+    if(!video_file_open_decode(&vfile, job->input) || !vfile->vstream->av_codec_ctx || vfile->vstream->fwidth <= 0)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't open video stream");
+        video_file_close(&vfile);
+        return false;
+    }
+
+    CDataStream* vstream = vfile->vstream;
+    int32_t width = job->width > 0 ? job->width : vstream->fwidth;
+    int32_t height = (int32_t)((int64_t)width * vstream->fheight / vstream->fwidth);
+
+    vstream->av_output_pix_fmt = AV_PIX_FMT_RGB24;
+    data_stream_set_frame_size(&vfile->vstream, width, height & ~1);
+    video_file_set_callbacks(&vfile, batch_on_thumbnail_frame, NULL, &context);
+
+    if(job->seek_seconds > 0.0)
+    {
+        av_seek_frame(vfile->av_format_ctx, -1, (int64_t)(job->seek_seconds * AV_TIME_BASE), AVSEEK_FLAG_BACKWARD);
+        avcodec_flush_buffers(vstream->av_codec_ctx);
+    }
+
+    enum EPumpStatus status = PUMP_STATUS_PENDING;
+    while(!context.done && status == PUMP_STATUS_PENDING)
+        status = video_file_pump(&vfile, 100000);
+
+    job->media_seconds = batch_media_duration(vfile->av_format_ctx);
+    video_file_close(&vfile);
+
+    if(!context.done)
+        snprintf(job->message, sizeof(job->message), "no frame at %.3fs", job->seek_seconds);
+
+    return context.done && !context.failed;
+}
+
+static void batch_on_transcode_frame(CDataStream** stream_ptr, void* user_data)
+{
+    CBatchFrameContext* context = (CBatchFrameContext*)user_data;
+    CDataStream* stream = *stream_ptr;
+
+    if(context->failed)
+        return;
+
+    av_image_fill_arrays(context->av_frame->data, context->av_frame->linesize, stream->block_buffer, stream->av_output_pix_fmt, stream->swidth, stream->sheight, 1);
+    context->av_frame->pts = stream->pts;
+
+    if(data_stream_encode(&context->encoder, context->av_frame) < 0)
+    {
+        snprintf(context->job->message, sizeof(context->job->message), "encoding failed");
+        context->failed = true;
+        return;
+    }
+
+    context->job->frames++;
+}
+
+static bool batch_job_transcode(CBatchJob* job)
+{
+    CBatchFrameContext context = { job, NULL, NULL, false, false };
+    CVideoFile* vfile = video_file_alloc();
+    bool result = false;
+
+    video_file_select_audio_tracks(&vfile, NULL, 0);
+    if(!video_file_open_decode(&vfile, job->input) || !vfile->vstream->av_codec_ctx)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't open video stream");
+        video_file_close(&vfile);
+        return false;
+    }
+
+    CDataStream* vstream = vfile->vstream;
+    int32_t width = job->width > 0 ? job->width : vstream->fwidth;
+    int32_t height = job->height > 0 ? job->height : vstream->fheight;
+
+    context.encoder = data_stream_alloc();
+    data_stream_set_frame_size(&context.encoder, width & ~1, height & ~1);
+    data_stream_set_time_base(&context.encoder, vstream->time_base);
+    data_stream_set_bit_rate(&context.encoder, job->bit_rate);
+    data_stream_set_thread_settings(&context.encoder, 1, FF_THREAD_SLICE);
+
+    if(!data_stream_initialize_encode(&context.encoder, job->output, AV_CODEC_ID_H264, AVMEDIA_TYPE_VIDEO, false))
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't open encoder");
+        goto cleanup;
+    }
+
+    context.av_frame = av_frame_alloc();
+    context.av_frame->format = context.encoder->av_output_pix_fmt;
+    context.av_frame->width = context.encoder->swidth;
+    context.av_frame->height = context.encoder->sheight;
+
+    // Decoder converts straight into the encoder input format
+    vstream->av_output_pix_fmt = context.encoder->av_output_pix_fmt;
+    data_stream_set_frame_size(&vfile->vstream, context.encoder->swidth, context.encoder->sheight);
+    video_file_set_callbacks(&vfile, batch_on_transcode_frame, NULL, &context);
+
+    enum EPumpStatus status = PUMP_STATUS_PENDING;
+    while(!context.failed && status == PUMP_STATUS_PENDING)
+        status = video_file_pump(&vfile, 100000);
+
+    if(!context.failed && data_stream_encode(&context.encoder, NULL) < 0)
+        snprintf(job->message, sizeof(job->message), "couldn't flush encoder");
+    else
+        result = !context.failed && status == PUMP_STATUS_END_OF_FILE;
+
+    job->media_seconds = batch_media_duration(vfile->av_format_ctx);
+
+    cleanup:
+        av_frame_free(&context.av_frame);
+        data_stream_close(&context.encoder);
+        video_file_close(&vfile);
+
+    return result;
+}
+
+static bool batch_job_remux(CBatchJob* job)
+{
+    AVFormatContext* input_ctx = NULL;
+    AVFormatContext* output_ctx = NULL;
+    AVPacket* av_packet = NULL;
+    bool result = false;
+
+    if(avformat_open_input(&input_ctx, job->input, NULL, NULL) < 0 || avformat_find_stream_info(input_ctx, NULL) < 0)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't open input");
+        goto cleanup;
+    }
+
+    if(avformat_alloc_output_context2(&output_ctx, NULL, NULL, job->output) < 0)
+    {
+        snprintf(job->message, sizeof(job->message), "unknown output format");
+        goto cleanup;
+    }
+
+    for(unsigned i = 0; i < input_ctx->nb_streams; i++)
+    {
+        AVStream* output_stream = avformat_new_stream(output_ctx, NULL);
+        if(!output_stream || avcodec_parameters_copy(output_stream->codecpar, input_ctx->streams[i]->codecpar) < 0)
+        {
+            snprintf(job->message, sizeof(job->message), "couldn't copy stream %u", i);
+            goto cleanup;
+        }
+        output_stream->codecpar->codec_tag = 0;
+        output_stream->time_base = input_ctx->streams[i]->time_base;
+    }
+
+    if(!(output_ctx->oformat->flags & AVFMT_NOFILE) && avio_open(&output_ctx->pb, job->output, AVIO_FLAG_WRITE) < 0)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't create output");
+        goto cleanup;
+    }
+
+    if(avformat_write_header(output_ctx, NULL) < 0)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't write header");
+        goto cleanup;
+    }
+
+    av_packet = av_packet_alloc();
+    while(av_read_frame(input_ctx, av_packet) >= 0)
+    {
+        AVStream* input_stream = input_ctx->streams[av_packet->stream_index];
+        AVStream* output_stream = output_ctx->streams[av_packet->stream_index];
+
+        av_packet_rescale_ts(av_packet, input_stream->time_base, output_stream->time_base);
+        av_packet->pos = -1;
+        if(av_interleaved_write_frame(output_ctx, av_packet) < 0)
+        {
+            snprintf(job->message, sizeof(job->message), "couldn't write packet");
+            av_packet_unref(av_packet);
+            goto cleanup;
+        }
+        job->frames++;
+    }
+
+    result = av_write_trailer(output_ctx) >= 0;
+    job->media_seconds = batch_media_duration(input_ctx);
+
+    cleanup:
+        av_packet_free(&av_packet);
+        if(output_ctx && !(output_ctx->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&output_ctx->pb);
+        avformat_free_context(output_ctx);
+        avformat_close_input(&input_ctx);
+
+    return result;
+}
+
+static bool batch_job_waveform(CBatchJob* job)
+{
+    CVideoFile* vfile = video_file_alloc();
+    CWaveform* waveform = waveform_alloc();
+    bool result = false;
+
+    if(!video_file_open_decode(&vfile, job->input) || !vfile->astream->av_codec_ctx)
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't open audio stream");
+        goto cleanup;
+    }
+
+    if(!video_file_build_waveform(&vfile, &waveform, job->samples_per_bucket))
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't decode audio");
+        goto cleanup;
+    }
+
+    if(!waveform_save(&waveform, job->output))
+    {
+        snprintf(job->message, sizeof(job->message), "couldn't write waveform");
+        goto cleanup;
+    }
+
+    job->frames = waveform->levels[0].bucket_count;
+    job->media_seconds = (double)waveform->sample_count / waveform->sample_rate;
+    snprintf(job->message, sizeof(job->message), "%d channels %d levels", waveform->channels, waveform->level_count);
+    result = true;
+
+    cleanup:
+        waveform_close(&waveform);
+        video_file_close(&vfile);
+
+    return result;
+}
+
+static void batch_run_job(void* arg)
+{
+    CBatchJob* job = (CBatchJob*)arg;
+    int64_t start_time = av_gettime_relative();
+
+    switch(job->type)
+    {
+    case BATCH_JOB_PROBE:
+        job->succeeded = batch_job_probe(job);
+        break;
+    case BATCH_JOB_THUMBNAIL:
+        job->succeeded = batch_job_thumbnail(job);
+        break;
+    case BATCH_JOB_TRANSCODE:
+        job->succeeded = batch_job_transcode(job);
+        break;
+    case BATCH_JOB_REMUX:
+        job->succeeded = batch_job_remux(job);
+        break;
+    case BATCH_JOB_WAVEFORM:
+        job->succeeded = batch_job_waveform(job);
+        break;
+    }
+
+    job->wall_time_us = av_gettime_relative() - start_time;
+    job->input_bytes = batch_file_size(job->input);
+    job->output_bytes = batch_file_size(job->output);
+}
+
+// Splits line into whitespace separated tokens, double quotes group tokens with spaces
+static int32_t batch_tokenize(char* line, char** tokens, int32_t max_tokens)
+{
+    int32_t count = 0;
+    char* cursor = line;
+
+    while(*cursor && count < max_tokens)
+    {
+        while(*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+            cursor++;
+
+        if(!*cursor || *cursor == '#')
+            break;
+
+        char terminator = ' ';
+        if(*cursor == '"')
+        {
+            terminator = '"';
+            cursor++;
+        }
+
+        tokens[count++] = cursor;
+        while(*cursor && (terminator == '"' ? *cursor != '"' : (*cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n')))
+            cursor++;
+
+        if(*cursor)
+            *cursor++ = '\0';
+    }
+
+    return count;
+}
+
+static bool batch_parse_job(char** tokens, int32_t token_count, CBatchJob* job)
+{
+    int32_t type;
+
+    for(type = 0; type <= BATCH_JOB_WAVEFORM; type++)
+    {
+        if(strcmp(tokens[0], batch_job_names[type]) == 0)
+            break;
+    }
+
+    if(type > BATCH_JOB_WAVEFORM || token_count < (type == BATCH_JOB_PROBE ? 2 : 3))
+        return false;
+
+    memset(job, 0, sizeof(CBatchJob));
+    job->type = (enum EBatchJobType)type;
+    job->input = allocator_strdup(tokens[1]);
+    job->output = type != BATCH_JOB_PROBE ? allocator_strdup(tokens[2]) : NULL;
+
+    if(type == BATCH_JOB_THUMBNAIL)
+    {
+        job->seek_seconds = token_count > 3 ? atof(tokens[3]) : 0.0;
+        job->width = token_count > 4 ? atoi(tokens[4]) : 0;
+    }
+    else if(type == BATCH_JOB_TRANSCODE)
+    {
+        if(token_count > 4)
+        {
+            job->width = atoi(tokens[3]);
+            job->height = atoi(tokens[4]);
+        }
+        job->bit_rate = token_count > 5 ? atoll(tokens[5]) * 1000 : 0;
+    }
+    else if(type == BATCH_JOB_WAVEFORM)
+        job->samples_per_bucket = token_count > 3 ? atoi(tokens[3]) : BATCH_WAVEFORM_SAMPLES_PER_BUCKET;
+
+    return true;
+}
+
+static void batch_free_jobs(CBatchJob* jobs, int32_t job_count)
+{
+    for(int32_t i = 0; i < job_count; i++)
+    {
+        allocator_free(jobs[i].input);
+        if(jobs[i].output)
+            allocator_free(jobs[i].output);
+    }
+    allocator_free(jobs);
+}
+
+static CBatchJob* batch_read_manifest(const char* path, int32_t* job_count)
+{
+    char line[BATCH_MAX_LINE];
+    char* tokens[BATCH_MAX_TOKENS];
+    CBatchJob* jobs = NULL;
+    int32_t capacity = 0;
+    int32_t line_number = 0;
+
+    FILE* manifest = fopen(path, "r");
+    if(!manifest)
+    {
+        fprintf(stderr, "Couldn't open manifest %s\n", path);
+        return NULL;
+    }
+
+    *job_count = 0;
+    while(fgets(line, sizeof(line), manifest))
+    {
+        line_number++;
+
+        int32_t token_count = batch_tokenize(line, tokens, BATCH_MAX_TOKENS);
+        if(!token_count)
+            continue;
+
+        if(*job_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            CBatchJob* grown = (CBatchJob*)allocator_realloc(jobs, sizeof(CBatchJob) * capacity);
+            if(!grown)
+            {
+                fprintf(stderr, "Couldn't allocate jobs\n");
+                batch_free_jobs(jobs, *job_count);
+                fclose(manifest);
+                return NULL;
+            }
+            jobs = grown;
+        }
+
+        if(!batch_parse_job(tokens, token_count, &jobs[*job_count]))
+        {
+            fprintf(stderr, "%s:%d: invalid job\n", path, line_number);
+            continue;
+        }
+
+        jobs[*job_count].index = *job_count;
+        (*job_count)++;
+    }
+
+    fclose(manifest);
+    return jobs;
+}
+
+static void batch_write_report(FILE* output, CBatchJob* jobs, int32_t job_count)
+{
+    fprintf(output, "index,type,input,status,wall_ms,input_mb,output_mb,frames,media_s,fps,input_mb_per_s,realtime_factor,message\n");
+
+    for(int32_t i = 0; i < job_count; i++)
+    {
+        CBatchJob* job = &jobs[i];
+        double seconds = job->wall_time_us / 1000000.0;
+        double input_mb = job->input_bytes / (1024.0 * 1024.0);
+
+        fprintf(output, "%d,%s,\"%s\",%s,%.2f,%.3f,%.3f,%lld,%.3f,%.2f,%.2f,%.2f,\"%s\"\n",
+            job->index, batch_job_names[job->type], job->input, job->succeeded ? "ok" : "failed",
+            job->wall_time_us / 1000.0, input_mb, job->output_bytes / (1024.0 * 1024.0), (long long)job->frames,
+            job->media_seconds, seconds > 0.0 ? job->frames / seconds : 0.0, seconds > 0.0 ? input_mb / seconds : 0.0,
+            seconds > 0.0 ? job->media_seconds / seconds : 0.0, job->message);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int32_t thread_count = 0;
+    const char* report_path = NULL;
+    const char* manifest_path = NULL;
+    const char* cache_path = NULL;
+    int32_t job_count = 0;
+    int32_t failed_count = 0;
+
+    for(int32_t i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            thread_count = atoi(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            report_path = argv[++i];
+        else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            cache_path = argv[++i];
+        else
+            manifest_path = argv[i];
+    }
+
+    if(!manifest_path)
+    {
+        fprintf(stderr, "Usage: %s [-j threads] [-r report.csv] [-c probe_cache.bin] manifest.txt\n", argv[0]);
+        return 1;
+    }
+
+    CBatchJob* jobs = batch_read_manifest(manifest_path, &job_count);
+    if(!jobs)
+        return 1;
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    batch_probe = media_probe_alloc();
+    if(!batch_probe)
+    {
+        batch_free_jobs(jobs, job_count);
+        return 1;
+    }
+    if(cache_path)
+        media_probe_load_cache(&batch_probe, cache_path);
+
+    CThreadPool* pool = thread_pool_alloc();
+    if(!thread_pool_start(&pool, thread_count, 0))
+    {
+        thread_pool_close(&pool);
+        media_probe_close(&batch_probe);
+        batch_free_jobs(jobs, job_count);
+        return 1;
+    }
+
+    int64_t start_time = av_gettime_relative();
+    for(int32_t i = 0; i < job_count; i++)
+    {
+        if(!thread_pool_submit(&pool, batch_run_job, &jobs[i]))
+        {
+            snprintf(jobs[i].message, sizeof(jobs[i].message), "couldn't queue job");
+            jobs[i].succeeded = false;
+        }
+    }
+
+    thread_pool_wait(&pool);
+    double total_seconds = (av_gettime_relative() - start_time) / 1000000.0;
+    int32_t worker_count = pool->thread_count;
+    thread_pool_close(&pool);
+
+    if(cache_path && !media_probe_save_cache(&batch_probe, cache_path))
+        fprintf(stderr, "Couldn't write probe cache %s\n", cache_path);
+    media_probe_close(&batch_probe);
+
+    FILE* report = report_path ? fopen(report_path, "w") : stdout;
+    if(!report)
+    {
+        fprintf(stderr, "Couldn't create report %s\n", report_path);
+        report = stdout;
+    }
+    batch_write_report(report, jobs, job_count);
+    if(report != stdout)
+        fclose(report);
+
+    for(int32_t i = 0; i < job_count; i++)
+        failed_count += !jobs[i].succeeded;
+    batch_free_jobs(jobs, job_count);
+
+    fprintf(stderr, "%d jobs (%d failed) on %d workers in %.2fs, %.2f jobs/s\n",
+        job_count, failed_count, worker_count, total_seconds, total_seconds > 0.0 ? job_count / total_seconds : 0.0);
+
+    return failed_count ? 2 : 0;
+}